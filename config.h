@@ -13,6 +13,9 @@
 /* How many seconds does a shell job run before timing out */
 #define JOB_TIMEOUT 10
 
+/* Directory where the driver caches the reference shell's outputs */
+#define REFCACHE ".refcache"
+
 /* The list of tracefiles that the driver will use for testing. */
 #define TRACEFILES \
   "trace00.txt",\
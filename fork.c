@@ -1,22 +1,47 @@
 /*
  * fork.c - Wrapper for fork() that introduces non-determinism
  *          in the order that the parent and child are executed
+ *
+ * The delays come from a per-process PRNG seeded once, from
+ * TSH_FORK_SEED if it is set (so a run can be repeated) or else from the
+ * clock. The environment also controls:
+ *
+ *   TSH_FORK_DELAY=0       no delay at all, e.g. to benchmark the shell
+ *   TSH_FORK_LOG=file      append the seed and every delay chosen to file
+ *   TSH_FORK_REPLAY=file   take the delays from a log, in order, instead
+ *                          of from the PRNG; once they run out, no delay
+ *   TSH_FORK_SLEEP=1       sleep with clock_nanosleep instead of spinning
+ *
+ * Replay applies the k-th logged fork's delays to the k-th fork, so it
+ * repeats a schedule exactly when all the forks are made by one process
+ * (the shell without its zygote).
  */
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-/* Choose how want to delay */
-#define UDELAY uspin
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 
 /* Sleep for a random period between 0 and MAX_SLEEP microseconds */
 #define MAX_SLEEP 100000
 
-#define CONVERT(val) (((double)val)/(double)RAND_MAX)
+/* Private, where it was a global named time that shadowed time(3) */
+static struct timeval now;
 
-struct timeval time;
+/* The schedule, set up by the first fork in each process */
+static int initialized;
+static int enabled;                 /* delay at all */
+static int sleeping;                /* clock_nanosleep rather than spin */
+static unsigned long long seed;
+static unsigned long long prng_state;
+static long nforks;                 /* forks made by this process */
+static int log_fd = -1;
+static unsigned *replay;            /* parent, child delay pairs */
+static long nreplay;
 
 /*
  * Implement microsecond-scale delay that spins rather than sleeps.
@@ -29,16 +54,136 @@ static void uspin(useconds_t usec)
 	return;
     unsigned long ustart;
     unsigned long ucurr;
-    gettimeofday(&time, NULL);
-    ustart = 1000000 * time.tv_sec + time.tv_usec;
+    gettimeofday(&now, NULL);
+    ustart = 1000000 * now.tv_sec + now.tv_usec;
     ucurr = ustart;
     while (ucurr - ustart < usec)
     {
-	gettimeofday(&time, NULL);
-	ucurr = 1000000 * time.tv_sec + time.tv_usec;
+	gettimeofday(&now, NULL);
+	ucurr = 1000000 * now.tv_sec + now.tv_usec;
+    }
+}
+
+/*
+ * usleep_full - Sleep for usec microseconds, all of them even if signals
+ * arrive meanwhile, without using the CPU
+ */
+static void usleep_full(useconds_t usec)
+{
+    struct timespec until;
+
+    if (usec == 0)
+	return;
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += usec / 1000000;
+    until.tv_nsec += (usec % 1000000) * 1000L;
+    if (until.tv_nsec >= 1000000000L) {
+	until.tv_sec++;
+	until.tv_nsec -= 1000000000L;
     }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL)
+	   == EINTR)
+	;
 }
 
+/*
+ * prng_next - Next value of this process's PRNG (splitmix64)
+ */
+static unsigned long long prng_next(void)
+{
+    unsigned long long z = (prng_state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * load_replay - Read the delays of every fork in a TSH_FORK_LOG file
+ */
+static void load_replay(const char *path)
+{
+    char line[256];
+    unsigned parent, child;
+    long cap = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	perror(path);
+	exit(1);
+    }
+    while (fgets(line, sizeof(line), fp)) {
+	if (sscanf(line, "fork %*d pid %*d child %*d parent_us %u child_us %u",
+		   &parent, &child) != 2)
+	    continue;
+	if (nreplay == cap) {
+	    cap = cap ? 2 * cap : 256;
+	    if ((replay = realloc(replay, cap * 2 * sizeof(unsigned))) == NULL) {
+		perror("realloc");
+		exit(1);
+	    }
+	}
+	replay[2 * nreplay] = parent;
+	replay[2 * nreplay + 1] = child;
+	nreplay++;
+    }
+    fclose(fp);
+}
+
+/*
+ * schedule_init - Read the settings and seed the PRNG
+ */
+static void schedule_init(void)
+{
+    char buf[128], *env;
+    int len;
+
+    initialized = 1;
+    env = getenv("TSH_FORK_DELAY");
+    enabled = env == NULL || strcmp(env, "0") != 0;
+    env = getenv("TSH_FORK_SLEEP");
+    sleeping = env != NULL && strcmp(env, "0") != 0;
+
+    if ((env = getenv("TSH_FORK_SEED")) != NULL)
+	seed = strtoull(env, NULL, 0);
+    else {
+	gettimeofday(&now, NULL);
+	seed = (1000000ULL * now.tv_sec + now.tv_usec) ^
+	       ((unsigned long long)getpid() << 32);
+    }
+    prng_state = seed;
+
+    if ((env = getenv("TSH_FORK_REPLAY")) != NULL)
+	load_replay(env);
+    if ((env = getenv("TSH_FORK_LOG")) != NULL) {
+	log_fd = open(env, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (log_fd >= 0) {
+	    len = snprintf(buf, sizeof(buf), "# pid %d seed %llu%s\n",
+			   (int)getpid(), seed, replay ? " replay" : "");
+	    if (write(log_fd, buf, len) < 0)
+		log_fd = -1;
+	}
+    }
+}
+
+/*
+ * log_fork - Record the delays chosen for a fork
+ */
+static void log_fork(pid_t child, useconds_t parent_delay,
+		     useconds_t child_delay)
+{
+    char buf[128];
+    int len;
+
+    if (log_fd < 0)
+	return;
+    len = snprintf(buf, sizeof(buf),
+		   "fork %ld pid %d child %d parent_us %u child_us %u\n",
+		   nforks, (int)getpid(), (int)child, (unsigned)parent_delay,
+		   (unsigned)child_delay);
+    if (write(log_fd, buf, len) < 0)
+	log_fd = -1;
+}
 
 pid_t __real_fork(void);
 
@@ -54,28 +199,49 @@ pid_t __real_fork(void);
  */
 pid_t __wrap_fork(void)
 {
-    gettimeofday(&time, NULL);
-    srand(time.tv_usec);
+    useconds_t parent_delay = 0, child_delay = 0;
+    unsigned long long r;
+
+    if (!initialized)
+	schedule_init();
+    if (!enabled)
+	return __real_fork();
 
-    unsigned bool = (unsigned)(CONVERT(rand()) + 0.5);
-    unsigned usecs = (unsigned)(CONVERT(rand()) * MAX_SLEEP);
-    useconds_t parent_delay = bool ? usecs : 0;
-    useconds_t child_delay = bool ? 0 : usecs;
+    if (replay != NULL) {
+	if (nforks < nreplay) {
+	    parent_delay = replay[2 * nforks];
+	    child_delay = replay[2 * nforks + 1];
+	}
+    }
+    else {
+	r = prng_next();
+	if (r & 1)
+	    parent_delay = (r >> 1) % (MAX_SLEEP + 1);
+	else
+	    child_delay = (r >> 1) % (MAX_SLEEP + 1);
+    }
 
     /* Call the real fork function */
     pid_t pid = __real_fork();
-    
 
-    /* Randomly decide to sleep in the parent or the child */
+    /* Sleep in the parent or the child, as decided */
     if (pid == 0) {
-	UDELAY(child_delay);
+	/* A child that forks again draws from a stream of its own */
+	prng_state ^= 0xd1b54a32d192ed03ULL;
+	nforks++;
+	if (sleeping)
+	    usleep_full(child_delay);
+	else
+	    uspin(child_delay);
     }
     else {
-	UDELAY(parent_delay);
-#if 0
-	printf("Parent: pid=%d, delay=%dus.  Child: pid=%d, delay=%dus\n",
-	       getpid(), (int) parent_delay, pid, (int) child_delay);
-#endif
+	if (pid > 0)
+	    log_fork(pid, parent_delay, child_delay);
+	nforks++;
+	if (sleeping)
+	    usleep_full(parent_delay);
+	else
+	    uspin(parent_delay);
     }
 
     /* Return the PID like a normal fork call */
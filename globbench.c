@@ -0,0 +1,173 @@
+/*
+ * globbench.c - Benchmark for recursive ("**") pathname expansion
+ *
+ * Generates a directory tree under a scratch directory and times the
+ * expansion of a "**" pattern that matches every .csv file in it, with
+ * different numbers of walker threads. The first expansion warms the
+ * dentry cache and is not timed.
+ *
+ * Usage: globbench [-h] [-d depth] [-f fanout] [-n files] [-r reps]
+ *                  [-t threads,...] [-k]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "tsh_glob.h"
+
+/* Global variables */
+int depth = 4;              /* Levels of subdirectories (-d) */
+int fanout = 8;             /* Subdirectories per directory (-f) */
+int nfiles = 16;            /* Files per directory, half of them .csv (-n) */
+int reps = 5;               /* Timed repetitions per thread count (-r) */
+char *threadlist = "1,2,4,8"; /* Thread counts to try (-t) */
+int keep = 0;               /* Keep the generated tree (-k) */
+long ndirs, ncsv;           /* Size of the generated tree */
+
+void usage(void);
+
+/*
+ * mktree - Create depth levels of fanout subdirectories below path
+ */
+void mktree(char *path, size_t len, int level)
+{
+    int i, n, fd;
+
+    if (mkdir(path, 0755) < 0) {
+        perror(path);
+        exit(1);
+    }
+    ndirs++;
+    for (i = 0; i < nfiles; i++) {
+        snprintf(path + len, PATH_MAX - len, "/f%d.%s",
+                 i, i % 2 ? "txt" : "csv");
+        if ((fd = open(path, O_WRONLY | O_CREAT, 0644)) < 0) {
+            perror(path);
+            exit(1);
+        }
+        close(fd);
+        ncsv += (i % 2 == 0);
+    }
+    if (level < depth) {
+        for (i = 0; i < fanout; i++) {
+            n = snprintf(path + len, PATH_MAX - len, "/d%d", i);
+            mktree(path, len + n, level + 1);
+        }
+    }
+    path[len] = '\0';
+}
+
+/*
+ * expand - Run one expansion, return its wall time in seconds
+ */
+double expand(const char *pattern, struct glob_out *out, int *nmatch)
+{
+    struct timespec start, end;
+
+    out->argc = 0;
+    out->textlen = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *nmatch = glob_expand(pattern, out);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ * cmpdouble - qsort comparator for doubles
+ */
+int cmpdouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+    char root[PATH_MAX], pattern[PATH_MAX + 16], cmd[PATH_MAX + 16];
+    char *tok, *list;
+    struct glob_out out;
+    double *t, base = 0;
+    int c, i, nmatch;
+
+    while ((c = getopt(argc, argv, "hd:f:n:r:t:k")) != EOF) {
+        switch (c) {
+        case 'd': depth = atoi(optarg); break;
+        case 'f': fanout = atoi(optarg); break;
+        case 'n': nfiles = atoi(optarg); break;
+        case 'r': reps = atoi(optarg); break;
+        case 't': threadlist = optarg; break;
+        case 'k': keep = 1; break;
+        default: usage();
+        }
+    }
+    if (reps < 1)
+        usage();
+
+    snprintf(root, sizeof(root), "/tmp/globbench.%d", (int)getpid());
+    mktree(root, strlen(root), 0);
+    snprintf(pattern, sizeof(pattern), "%s/**/*.csv", root);
+    printf("tree: %s, %ld dirs, %ld .csv of %ld files\n",
+           root, ndirs, ncsv, ndirs * nfiles);
+
+    out.maxargc = ncsv + 1;
+    out.argv = malloc((out.maxargc + 1) * sizeof(char *));
+    out.textsize = ncsv * (strlen(root) + 16 * (depth + 2));
+    out.text = malloc(out.textsize);
+    t = malloc(reps * sizeof(double));
+    if (!out.argv || !out.text || !t) {
+        perror("malloc");
+        exit(1);
+    }
+
+    setenv("TSH_GLOB_THREADS", "1", 1);
+    expand(pattern, &out, &nmatch);     /* warm up */
+    if (nmatch != ncsv) {
+        printf("error: expected %ld matches, got %d\n", ncsv, nmatch);
+        exit(1);
+    }
+
+    printf("%8s %12s %12s %9s\n",
+           "threads", "median(ms)", "min(ms)", "speedup");
+    list = strdup(threadlist);
+    for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        setenv("TSH_GLOB_THREADS", tok, 1);
+        for (i = 0; i < reps; i++)
+            t[i] = expand(pattern, &out, &nmatch);
+        qsort(t, reps, sizeof(double), cmpdouble);
+        if (base == 0)
+            base = t[reps / 2];
+        printf("%8s %12.2f %12.2f %8.2fx\n", tok, t[reps / 2] * 1e3,
+               t[0] * 1e3, base / t[reps / 2]);
+    }
+
+    if (!keep) {
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+        if (system(cmd) != 0)
+            printf("unable to remove %s\n", root);
+    }
+    exit(0);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+void usage(void)
+{
+    printf("Usage: globbench [-h] [-d depth] [-f fanout] [-n files] [-r reps]"
+           " [-t threads,...] [-k]\n");
+    printf("Options\n");
+    printf("\t-d <n>       Levels of subdirectories (default %d)\n", depth);
+    printf("\t-f <n>       Subdirectories per directory (default %d)\n",
+           fanout);
+    printf("\t-n <n>       Files per directory (default %d)\n", nfiles);
+    printf("\t-r <n>       Timed repetitions (default %d)\n", reps);
+    printf("\t-t <list>    Comma separated thread counts (default %s)\n",
+           threadlist);
+    printf("\t-k           Keep the generated tree\n");
+    exit(0);
+}
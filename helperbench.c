@@ -0,0 +1,311 @@
+/*
+ * helperbench.c - Microbenchmarks for the helpers in tsh_helper.c
+ *
+ * Times parseline() on realistic and adversarial command lines, the job
+ * list helpers (addjob/deletejob, getjobpid, getjobjid, fgpid) with the
+ * list empty, half full and nearly full, and listjobs() to /dev/null.
+ * Each benchmark is warmed up, then run for a number of repetitions of
+ * a batch calibrated to take about the same time; the result is the
+ * mean ns/op over the repetitions with a 95% confidence interval
+ * (Student's t), the standard deviation and the fastest repetition. The
+ * results can be printed as a table, CSV or JSON, to track them over
+ * time. "make bench" builds and runs it.
+ *
+ * Usage: helperbench [-h] [-f text|csv|json] [-r reps] [-t ms] [-w ms]
+ *                    [-b filter]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include "tsh_helper.h"
+
+#define MAXREPS 1000
+
+/* Global variables */
+char *format = "text";      /* Output format (-f) */
+int reps = 10;              /* Timed repetitions per benchmark (-r) */
+double batch_ms = 20;       /* Target time of one repetition (-t) */
+double warmup_ms = 100;     /* Warmup time per benchmark (-w) */
+char *filter = NULL;        /* Only run benchmarks whose name has this (-b) */
+int nresults;               /* Results printed so far */
+
+volatile long sink;         /* Keeps results of the timed calls alive */
+struct cmdline_tokens token;
+int null_fd;
+
+void bench_usage(void);
+
+/* Two-sided 95% Student's t values for 1..30 degrees of freedom */
+static const double t95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+/* Command lines for parseline */
+struct line {
+    const char *name;
+    char text[MAXLINE_TSH];
+};
+struct line lines[] = {
+    {"simple", "/bin/ls -l /tmp"},
+    {"background", "./myspin1 10 &"},
+    {"redirect", "./mycat < in.txt > out.txt 2>&1 3<> rw.txt"},
+    {"quoted", "/bin/echo \"a b c\" 'd \"e\" f' \"g'h\" i j k"},
+    {"builtin", "jobs"},
+    {"many_args", ""},      /* filled in by make_lines */
+    {"long_arg", ""},
+    {"many_redirs", ""},
+};
+#define NLINES (sizeof(lines) / sizeof(lines[0]))
+const char *cur_line;
+
+/*
+ * now_ns - Monotonic time in ns
+ */
+double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * make_lines - Build the adversarial command lines
+ */
+void make_lines(void)
+{
+    char *p;
+    int i;
+
+    /* As many one-letter arguments as fit in argv */
+    p = lines[5].text;
+    p += sprintf(p, "/bin/true");
+    for (i = 0; i < MAXARGS - 3; i++)
+        p += sprintf(p, " %c", 'a' + i % 26);
+
+    /* One argument filling the whole line */
+    p = lines[6].text;
+    p += sprintf(p, "/bin/true ");
+    memset(p, 'x', MAXLINE_TSH - 12);
+    p[MAXLINE_TSH - 12] = '\0';
+
+    /* Every redirection slot used */
+    p = lines[7].text;
+    p += sprintf(p, "/bin/true");
+    for (i = 0; i < MAXREDIR; i++)
+        p += sprintf(p, " %d>f%d", 3 + i % 6, i);
+}
+
+/* The benchmarks; each runs its operation iters times */
+void b_parseline(long iters)
+{
+    while (iters-- > 0)
+        sink += parseline(cur_line, &token);
+}
+
+void b_addjob_deletejob(long iters)
+{
+    while (iters-- > 0) {
+        addjob(job_list, 99999, BG, "/bin/true &");
+        sink += deletejob(job_list, 99999);
+    }
+}
+
+pid_t last_pid;             /* pid of the last job in the list, or 1 */
+void b_getjobpid_hit(long iters)
+{
+    while (iters-- > 0)
+        sink += (long)getjobpid(job_list, last_pid);
+}
+
+void b_getjobpid_miss(long iters)
+{
+    while (iters-- > 0)
+        sink += (long)getjobpid(job_list, 99998);
+}
+
+void b_getjobjid(long iters)
+{
+    while (iters-- > 0)
+        sink += (long)getjobjid(job_list, MAXJOBS);
+}
+
+void b_fgpid(long iters)
+{
+    while (iters-- > 0)
+        sink += fgpid(job_list);
+}
+
+void b_listjobs(long iters)
+{
+    while (iters-- > 0)
+        listjobs(job_list, null_fd);
+}
+
+/*
+ * fill_jobs - Put n background jobs in the job list
+ */
+void fill_jobs(int n)
+{
+    int i;
+
+    initjobs(job_list);
+    last_pid = 1;
+    for (i = 0; i < n; i++) {
+        last_pid = 1000 + i;
+        addjob(job_list, last_pid, BG, "./myspin1 10 &");
+    }
+}
+
+/*
+ * cmpdouble - qsort comparator for doubles
+ */
+int cmpdouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * run - Time one benchmark and print its result
+ */
+void run(const char *name, void (*fn)(long))
+{
+    double t[MAXREPS], start, elapsed, mean = 0, var = 0, ci;
+    long iters = 1;
+    int i;
+
+    if (filter != NULL && strstr(name, filter) == NULL)
+        return;
+
+    /* Calibrate a batch to batch_ms, then warm up */
+    for (;;) {
+        start = now_ns();
+        fn(iters);
+        elapsed = now_ns() - start;
+        if (elapsed >= batch_ms * 1e6 / 10 || iters >= 1L << 40)
+            break;
+        iters *= 2;
+    }
+    iters = (long)(iters * batch_ms * 1e6 / (elapsed > 0 ? elapsed : 1));
+    if (iters < 1)
+        iters = 1;
+    for (start = now_ns(); now_ns() - start < warmup_ms * 1e6; )
+        fn(iters / 10 + 1);
+
+    for (i = 0; i < reps; i++) {
+        start = now_ns();
+        fn(iters);
+        t[i] = (now_ns() - start) / iters;
+        mean += t[i];
+    }
+    mean /= reps;
+    for (i = 0; i < reps; i++)
+        var += (t[i] - mean) * (t[i] - mean);
+    var = reps > 1 ? var / (reps - 1) : 0;
+    ci = (reps - 1 <= 30 ? t95[reps > 1 ? reps - 2 : 0] : 1.96) *
+         sqrt(var / reps);
+    qsort(t, reps, sizeof(double), cmpdouble);
+
+    if (strcmp(format, "csv") == 0) {
+        if (nresults == 0)
+            printf("benchmark,ns_per_op,ci95,stddev,min,reps,iters\n");
+        printf("%s,%.2f,%.2f,%.2f,%.2f,%d,%ld\n",
+               name, mean, ci, sqrt(var), t[0], reps, iters);
+    } else if (strcmp(format, "json") == 0) {
+        printf("%s\n  {\"benchmark\": \"%s\", \"ns_per_op\": %.2f, "
+               "\"ci95\": %.2f, \"stddev\": %.2f, \"min\": %.2f, "
+               "\"reps\": %d, \"iters\": %ld}",
+               nresults ? "," : "[", name, mean, ci, sqrt(var), t[0],
+               reps, iters);
+    } else {
+        if (nresults == 0)
+            printf("%-32s %10s %9s %10s %12s\n",
+                   "benchmark", "ns/op", "+-95%", "min", "iters/rep");
+        printf("%-32s %10.1f %9.1f %10.1f %12ld\n",
+               name, mean, ci, t[0], iters);
+    }
+    fflush(stdout);
+    nresults++;
+}
+
+int main(int argc, char **argv)
+{
+    int occupancy[] = {0, MAXJOBS / 2, MAXJOBS - 1};
+    char name[64];
+    sigset_t all;
+    size_t i;
+    int c;
+
+    while ((c = getopt(argc, argv, "hf:r:t:w:b:")) != EOF) {
+        switch (c) {
+        case 'f': format = optarg; break;
+        case 'r': reps = atoi(optarg); break;
+        case 't': batch_ms = atof(optarg); break;
+        case 'w': warmup_ms = atof(optarg); break;
+        case 'b': filter = optarg; break;
+        default: bench_usage();
+        }
+    }
+    if (reps < 2 || reps > MAXREPS || batch_ms <= 0 ||
+        (strcmp(format, "text") && strcmp(format, "csv") &&
+         strcmp(format, "json")))
+        bench_usage();
+
+    /* The job list helpers expect signals to be blocked */
+    sigfillset(&all);
+    sigprocmask(SIG_BLOCK, &all, NULL);
+    if ((null_fd = open("/dev/null", O_WRONLY)) < 0) {
+        perror("/dev/null");
+        exit(1);
+    }
+    make_lines();
+
+    for (i = 0; i < NLINES; i++) {
+        snprintf(name, sizeof(name), "parseline/%s", lines[i].name);
+        cur_line = lines[i].text;
+        run(name, b_parseline);
+    }
+    for (i = 0; i < sizeof(occupancy) / sizeof(occupancy[0]); i++) {
+        fill_jobs(occupancy[i]);
+#define RUN(bench) \
+        snprintf(name, sizeof(name), #bench "/jobs=%d", occupancy[i]); \
+        run(name, b_##bench)
+        RUN(addjob_deletejob);
+        RUN(getjobpid_hit);
+        RUN(getjobpid_miss);
+        RUN(getjobjid);
+        RUN(fgpid);
+        RUN(listjobs);
+#undef RUN
+    }
+    if (strcmp(format, "json") == 0)
+        printf("%s]\n", nresults ? "\n" : "[");
+    exit(0);
+}
+
+/*
+ * bench_usage - Explain the command line arguments
+ */
+void bench_usage(void)
+{
+    printf("Usage: helperbench [-h] [-f text|csv|json] [-r reps] [-t ms]"
+           " [-w ms] [-b filter]\n");
+    printf("Options\n");
+    printf("\t-f <format>  Output as a table, CSV or JSON (default %s)\n",
+           format);
+    printf("\t-r <n>       Timed repetitions per benchmark (default %d)\n",
+           reps);
+    printf("\t-t <ms>      Time of one repetition (default %g)\n", batch_ms);
+    printf("\t-w <ms>      Warmup time per benchmark (default %g)\n",
+           warmup_ms);
+    printf("\t-b <text>    Only run benchmarks whose name contains text\n");
+    exit(0);
+}
@@ -0,0 +1,160 @@
+/*
+ * inputbench.c - Command input throughput benchmark for the shell
+ *
+ * Streams n copies of a cheap builtin command line into a shell run with
+ * -p (no prompt), and reports how many commands per second it gets
+ * through, from the first byte sent until the shell exits at EOF. By
+ * default the commands go through a pipe in large writes; with -d they
+ * are sent one message per line over a SOCK_SEQPACKET socketpair, as
+ * runtrace does.
+ *
+ * Usage: inputbench [-h] [-d] [-n count] [-c cmdline] [-s shell ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#define MAXSHELLS 8
+
+/* Global variables */
+long ncmds = 200000;        /* Commands per run (-n) */
+char *cmdline = "jobs";     /* Command line to repeat (-c) */
+int packets = 0;            /* One message per line (-d) */
+
+void usage(void);
+
+/*
+ * run - Feed ncmds commands to shell, return commands per second
+ */
+double run(char *shell)
+{
+    char line[256], *chunk;
+    int fd[2], devnull, status;
+    size_t len, per, chunklen;
+    struct timespec start, end;
+    pid_t pid;
+    long i;
+
+    len = snprintf(line, sizeof(line), "%s\n", cmdline);
+    if (packets) {
+        if (socketpair(AF_LOCAL, SOCK_SEQPACKET, 0, fd) < 0) {
+            perror("socketpair");
+            exit(1);
+        }
+    }
+    else if (pipe(fd) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    if ((pid = fork()) == 0) {
+        devnull = open("/dev/null", O_WRONLY);
+        dup2(packets ? fd[1] : fd[0], 0);
+        dup2(devnull, 1);
+        dup2(devnull, 2);
+        close(fd[0]);
+        close(fd[1]);
+        execl(shell, shell, "-p", (char *)NULL);
+        perror("execl");
+        exit(1);
+    }
+    if (packets)
+        close(fd[1]);
+    else
+        close(fd[0]);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (packets) {
+        for (i = 0; i < ncmds; i++) {
+            if (send(fd[0], line, len, 0) < 0) {
+                perror("send");
+                exit(1);
+            }
+        }
+        shutdown(fd[0], SHUT_WR);   /* EOF */
+    }
+    else {
+        per = 65536 / len;
+        chunk = malloc(per * len);
+        for (i = 0; i < (long)per; i++)
+            memcpy(chunk + i * len, line, len);
+        for (i = 0; i < ncmds; i += per) {
+            chunklen = (ncmds - i < (long)per ? ncmds - i : (long)per) * len;
+            if (write(fd[1], chunk, chunklen) != (ssize_t)chunklen) {
+                perror("write");
+                exit(1);
+            }
+        }
+        free(chunk);
+    }
+    close(packets ? fd[0] : fd[1]);
+    waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("%s: exited abnormally\n", shell);
+        exit(1);
+    }
+    return ncmds / ((end.tv_sec - start.tv_sec) +
+                    (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+    char *shells[MAXSHELLS];
+    int c, i, nshells = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    while ((c = getopt(argc, argv, "hdn:c:s:")) != EOF) {
+        switch (c) {
+        case 'd':
+            packets = 1;
+            break;
+        case 'n':
+            ncmds = atol(optarg);
+            break;
+        case 'c':
+            cmdline = optarg;
+            break;
+        case 's':
+            if (nshells < MAXSHELLS)
+                shells[nshells++] = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (ncmds < 1)
+        usage();
+    if (nshells == 0) {
+        shells[nshells++] = "./tsh";
+        shells[nshells++] = "./tshref";
+    }
+
+    printf("%ld x '%s' over a %s\n", ncmds, cmdline,
+           packets ? "seqpacket socketpair" : "pipe");
+    for (i = 0; i < nshells; i++)
+        printf("%-12s %12.0f cmds/s\n", shells[i], run(shells[i]));
+    exit(0);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+void usage(void)
+{
+    printf("Usage: inputbench [-h] [-d] [-n count] [-c cmdline] [-s shell ...]\n");
+    printf("Options\n");
+    printf("\t-h           Print this message.\n");
+    printf("\t-d           Send one message per line over a socketpair\n");
+    printf("\t-n <count>   Commands per run (default %ld)\n", ncmds);
+    printf("\t-c <cmd>     Command line to repeat (default '%s')\n", cmdline);
+    printf("\t-s <shell>   Shell to test; repeatable (default ./tsh ./tshref)\n");
+    exit(0);
+}
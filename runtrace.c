@@ -16,8 +16,13 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/prctl.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
 #include "config.h"
 
 #define MAXBUF 1024
@@ -30,6 +35,7 @@ char line[MAXBUF];
 char command[MAXBUF];
 extern char **environ;
 char *state;
+int child_pid;              /* The shell */
 
 /* Modified by command line args */
 int verbose = 0;
@@ -37,17 +43,58 @@ int sandboxing = 0;
 char *tracefile = NULL;
 char *shellprog = "./tsh";
 char *shellargs = NULL;
+int timeout_ms = DRIVER_TIMEOUT * 1000; /* Longest wait (-T, TIMEOUT) */
+int show_latency = 0;       /* Latency summary (-L), and each one (-LL) */
+
+/*
+ * The latency of each NEXT and WAIT: the time from the last thing
+ * runtrace did to the shell (a command line, a signal or a SIGNAL) to
+ * the prompt or the sync
+ */
+struct latency {
+    char kind;              /* 'N' for NEXT, 'W' for WAIT */
+    int lineno;             /* Line of the trace */
+    double ms;
+    char after[40];         /* What it was measured from */
+};
+struct latency *latencies;
+int nlatencies, latencies_size;
+long last_action_us;        /* When runtrace last did something */
+char last_action[40];
 
 /* domain socket pairs */
 int datafd[2];
 int syncfd[2];
 
+/* epoll sets: the shell's output alone, and with the jobs' syncs */
+int data_epfd;
+int sync_epfd;
+
+/*
+ * Shell output received but not yet printed, kept as a queue of the
+ * messages the shell sent, each stored as its length and then its bytes.
+ * It is read whenever it arrives, also while waiting for a sync, so the
+ * shell never blocks on a full socket.
+ */
+char *outq;
+size_t outq_head, outq_tail, outq_size;
+int shell_eof;              /* The shell and its jobs closed their output */
+size_t prompt_match;        /* Bytes of PROMPT seen and held back */
+
 /* Prototypes */
 void usage(char *msg);
 int blankline(char *str);
-void print_child_status(void);
-int next_prompt(void);
-int readable(int fd, int secs);
+void print_child_status(int options);
+int next_prompt(int ms);
+void watch(int epfd, int fd);
+int wait_for(int fd, int ms);
+long now_us(void);
+void set_alarm(int ms);
+void record_action(char *what);
+void record_latency(char kind, int lineno);
+void print_latencies(void);
+int directive_timeout(char *line);
+char *next_message(size_t *len);
 void clean(void);
 
 /*
@@ -56,6 +103,7 @@ void clean(void);
 void sigalrm_handler(int sig) 
 {
     printf("%s: Runtrace timed out while %s.\n", tracefile, state);
+    print_latencies();
     clean();
     exit(1);
 }
@@ -64,9 +112,10 @@ void sigalrm_handler(int sig)
 int main(int argc, char **argv) 
 {
     char *shellargv[MAXARGS];
-    int child_pid;
     char c;
     char *bufp;
+    char sync_buf[MAXBUF];
+    int lineno = 0, ms;
     FILE *tracefp;
     //int n=0; /* keep gcc happy */
     struct stat statbuf;
@@ -74,8 +123,18 @@ int main(int argc, char **argv)
     /* Install the signal handler */
     signal(SIGALRM, sigalrm_handler);
 
+    /* 
+     * Jobs the shell leaves behind are reparented to us rather than to
+     * init, so that clean() can find them, and only them, even while
+     * other runtraces are running.
+     */
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) {
+        perror("prctl");
+        exit(1);
+    }
+
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hVxs:f:")) != EOF) {
+    while ((c = getopt(argc, argv, "hVxLs:f:T:")) != EOF) {
         switch (c) {
         case 'h':             /* Print help message */
             usage("");
@@ -92,6 +151,14 @@ int main(int argc, char **argv)
         case 'x':             /* Enable sandboxing */
             sandboxing = 1;   /* Hidden argument */
             break;
+        case 'T':             /* Default timeout in ms */
+            timeout_ms = atoi(optarg);
+            if (timeout_ms < 1)
+                usage("Invalid timeout (-T)");
+            break;
+        case 'L':             /* Print the NEXT and WAIT latencies */
+            show_latency++;
+            break;
         default:
             usage("Unrecognized argument");
         }
@@ -116,14 +183,18 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    /* Socket pair for data transfers between runtrace and shell */
-    if (socketpair(AF_LOCAL, SOCK_DGRAM, 0, datafd) < 0) {
+    /* 
+     * Socket pair for data transfers between runtrace and shell. Each
+     * write of the shell is a message, of any size; the shell and its
+     * jobs closing it is EOF.
+     */
+    if (socketpair(AF_LOCAL, SOCK_SEQPACKET, 0, datafd) < 0) {
         perror("socketpair datafd");
         exit(1);
     }
 
     /* Socket pair for synchronization between runtrace and shell jobs */
-    if (socketpair(AF_LOCAL, SOCK_DGRAM, 0, syncfd) < 0) {
+    if (socketpair(AF_LOCAL, SOCK_SEQPACKET, 0, syncfd) < 0) {
         perror("socketpair syncfd");
         exit(1);
     }
@@ -185,16 +256,26 @@ int main(int argc, char **argv)
     /* Close the descriptor the parent is not using */
     close(datafd[1]); 
 
+    /* Watch for output, and with it for syncs */
+    if ((data_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        (sync_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+    watch(data_epfd, datafd[0]);
+    watch(sync_epfd, datafd[0]);
+    watch(sync_epfd, syncfd[0]);
+
     /* Read the initial prompt from the shell */
-    if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
+    if (wait_for(datafd[0], timeout_ms) == 0) {
         fprintf(stderr, "%s: Runtrace timed out waiting for initial shell prompt\n", tracefile);
-        //n = n; /* keep gcc happy */
     }     
     else {
-        bzero(buf, MAXBUF);
-        /*n = */recv(datafd[0], buf, MAXBUF, 0);
-        if (strcmp(buf, PROMPT)) {
-            fprintf(stderr, "%s: Runtrace expected initial shell prompt but got '%s' instead.\n", tracefile, buf);
+        size_t len = 0;
+        char *msg = next_message(&len);
+
+        if (msg == NULL || len != strlen(PROMPT) || memcmp(msg, PROMPT, len)) {
+            fprintf(stderr, "%s: Runtrace expected initial shell prompt but got '%.*s' instead.\n", tracefile, (int)len, msg ? msg : "");
             exit(1);
         }
     }
@@ -203,6 +284,7 @@ int main(int argc, char **argv)
      * Parent reads trace file and sends commands to the shell 
      */
     while (fgets(line, MAXBUF, tracefp)) {
+        lineno++;
 
         /* Delete newline character */
         line[strlen(line)-1] = '\0';
@@ -225,19 +307,31 @@ int main(int argc, char **argv)
         if (verbose)
             printf("runtrace: command=%s line=%s\n", command, line);
         
-        /* WAIT command */
-        if (!strcmp(command, "WAIT")) {
-            if (readable(syncfd[0], DRIVER_TIMEOUT) == 0) {
+        /* TIMEOUT command: the longest wait from here on, in ms */
+        if (!strcmp(command, "TIMEOUT")) {
+            if ((timeout_ms = directive_timeout(line)) == 0) {
+                fprintf(stderr, "%s:%d: TIMEOUT needs a time in ms\n",
+                        tracefile, lineno);
+                exit(1);
+            }
+            continue;
+        }
+
+        /* WAIT command; "WAIT ms" overrides the timeout */
+        else if (!strcmp(command, "WAIT")) {
+            ms = directive_timeout(line);
+            if (wait_for(syncfd[0], ms ? ms : timeout_ms) == 0) {
                 printf("%s: Runtrace timed out waiting for sync from job\n", 
                        tracefile);
+                print_latencies();
                 exit(1);
             }
             else {
-                bzero(buf, MAXBUF);
-                if ((recv(syncfd[0], buf, MAXBUF, 0)) < 0) {
+                if ((recv(syncfd[0], sync_buf, sizeof(sync_buf), 0)) < 0) {
                     perror("recv syncfd");
                     exit(1);
                 }
+                record_latency('W', lineno);
                 if (verbose)
                     printf("runtrace: received sync from job\n");
                 continue;
@@ -245,10 +339,14 @@ int main(int argc, char **argv)
         }
 
 
-        /* NEXT command */
+        /* NEXT command; "NEXT ms" overrides the timeout */
         else if (!strcmp(command, "NEXT")) {
-            if (next_prompt() == 0) 
+            ms = directive_timeout(line);
+            if (next_prompt(ms ? ms : timeout_ms) == 0) {
+                print_latencies();
                 exit(0);
+            }
+            record_latency('N', lineno);
             continue;
         }
 
@@ -259,6 +357,7 @@ int main(int argc, char **argv)
                 perror("send syncfd");
                 exit(1);
             }
+            record_action("SIGNAL");
             if (verbose)
                 printf("runtrace: sent sync to shell job\n");
             continue;
@@ -270,6 +369,7 @@ int main(int argc, char **argv)
                 perror("kill SIGINT");
                 exit(1);
             }
+            record_action("SIGINT");
             if (verbose)
                 printf("Runtrace sent SIGINT to process %d\n", child_pid);
             continue;
@@ -281,6 +381,7 @@ int main(int argc, char **argv)
                 perror("kill SIGTSTP");
                 exit(1);
             }
+            record_action("SIGTSTP");
             if (verbose)
                 printf("Runtrace sent SIGTSTP to process %d\n", child_pid);
             continue;
@@ -291,6 +392,7 @@ int main(int argc, char **argv)
             if (verbose) {
                 printf("runtrace: Sending '%s' to shell\n", line);
             }
+            record_action(line);
             strcat(line, "\n");
             if ((send(datafd[0], line, strlen(line), 0)) < 0) {
                 perror("send datafd[0]");
@@ -301,25 +403,67 @@ int main(int argc, char **argv)
     } /* while loop */
 
     /* Signal EOF to the shell */
-    bufp = "";
-    send(datafd[0], bufp, 0, 0);
+    shutdown(datafd[0], SHUT_WR);
 
     /* Wait for the shell to terminate */
-    alarm(DRIVER_TIMEOUT);
+    set_alarm(timeout_ms);
     state = "waiting for shell to terminate";
     waitpid(child_pid, NULL, 0);
 
     /* Kill any of our stray shells and jobs */
     clean();
+    print_latencies();
     exit(0);
 }
 
 
 /*
- * clean - clean up any stray jobs or shells 
+ * kill_children - Send SIGKILL to every child of ours, return how many
+ */
+int kill_children(void)
+{
+    char path[MAXBUF], stat[MAXBUF], *p;
+    int fd, n, ppid, count = 0;
+    struct dirent *de;
+    DIR *dir;
+
+    if ((dir = opendir("/proc")) == NULL) {
+        perror("opendir /proc");
+        exit(1);
+    }
+    while ((de = readdir(dir)) != NULL) {
+        if (!isdigit(de->d_name[0]))
+            continue;
+        sprintf(path, "/proc/%s/stat", de->d_name);
+        if ((fd = open(path, O_RDONLY)) < 0)
+            continue;
+        n = read(fd, stat, sizeof(stat) - 1);
+        close(fd);
+        if (n <= 0)
+            continue;
+        stat[n] = '\0';
+
+        /* The parent pid follows the state, after the parenthesized name */
+        if ((p = strrchr(stat, ')')) == NULL ||
+            sscanf(p + 1, " %*c %d", &ppid) != 1 || ppid != getpid())
+            continue;
+        kill(atoi(de->d_name), SIGKILL);
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+/*
+ * clean - kill and reap the shell and any jobs it left behind
  */
 void clean() {
-    system("/bin/kill -9 tsh tshref mytstpp mytstps mycat myenv myintp myints myspin1 myspin2 mysplit > /dev/null 2>&1");
+    while (kill_children() > 0) {
+        /* Reap at least one, then whatever else has died meanwhile */
+        waitpid(-1, NULL, 0);
+        while (waitpid(-1, NULL, WNOHANG) > 0)
+            ;
+    }
 }
 
 /*
@@ -328,11 +472,14 @@ void clean() {
 void usage(char *msg)
 {
     printf("%s\n", msg);
-    printf("Usage: runtrace -f <file> -s <shellprog> [-hV]\n");
+    printf("Usage: runtrace -f <file> -s <shellprog> [-hVL] [-T <ms>]\n");
     printf("Options:\n");
     printf("  -h            Print this message\n");
     printf("  -s <shell>    Shell program to test (default ./tsh)\n");
     printf("  -f <file>     Trace file\n");
+    printf("  -T <ms>       Longest wait for the shell or a job (default %d)\n",
+           DRIVER_TIMEOUT * 1000);
+    printf("  -L            Print the latency of NEXT and WAIT; twice, each one\n");
     printf("  -V            Be more verbose\n");
 
     exit(0);
@@ -353,14 +500,15 @@ int blankline(char *str)
 
         
 /*
- * print_child_status - Print the exit/termination status of the shell after a timeout
+ * print_child_status - Print the exit/termination status of the shell after a timeout,
+ *                      or with options 0, waiting for it to terminate
  */
-void print_child_status()
+void print_child_status(int options)
 {
     pid_t pid; 
     int status;
 
-    pid = waitpid(-1, &status, WNOHANG);
+    pid = waitpid(child_pid, &status, options);
 
     if (pid > 0) {
         if (WIFEXITED(status)) {
@@ -399,74 +547,331 @@ void print_child_status()
 }
 
 /*
- * next_prompt - Print the shell response until the next prompt or EOF
- *               Returns 1 if OK, 0 on EOF or timeout
+ * now_us - Monotonic time in microseconds
  */
-int next_prompt(void)
+long now_us(void)
 {
-    int n;
-    
-    bzero(buf, MAXBUF);
-    if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
-        printf("%s: Runtrace timed out waiting for next shell prompt\n", 
-               tracefile);
-        print_child_status();
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/*
+ * set_alarm - Deliver SIGALRM in ms milliseconds; 0 cancels it
+ */
+void set_alarm(int ms)
+{
+    struct itimerval it;
+
+    memset(&it, 0, sizeof(it));
+    it.it_value.tv_sec = ms / 1000;
+    it.it_value.tv_usec = (ms % 1000) * 1000;
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+/*
+ * directive_timeout - The time in ms after a directive, as in "NEXT 250",
+ *                     or 0 if there is none
+ */
+int directive_timeout(char *line)
+{
+    int ms;
+
+    if (sscanf(line, "%*s %d", &ms) != 1 || ms < 1)
         return 0;
-    }
-    else {
-        if ((n = recv(datafd[0], buf, MAXBUF, 0)) < 0) {
-            perror("next_prompt:recv1");
+    return ms;
+}
+
+/*
+ * record_action - Note that runtrace just did something to the shell,
+ *                 which the next NEXT or WAIT is timed from
+ */
+void record_action(char *what)
+{
+    last_action_us = now_us();
+    snprintf(last_action, sizeof(last_action), "%s", what);
+}
+
+/*
+ * record_latency - Record the time since the last action, for the NEXT
+ *                  ('N') or WAIT ('W') on line lineno of the trace
+ */
+void record_latency(char kind, int lineno)
+{
+    struct latency *l;
+
+    if (!show_latency)
+        return;
+    if (nlatencies == latencies_size) {
+        latencies_size = latencies_size ? 2 * latencies_size : 64;
+        latencies = realloc(latencies, latencies_size * sizeof(*latencies));
+        if (latencies == NULL) {
+            perror("realloc");
             exit(1);
         }
-        else if (n == 0) { /* EOF */
-            return 0;
-        } 
     }
+    l = &latencies[nlatencies++];
+    l->kind = kind;
+    l->lineno = lineno;
+    l->ms = last_action_us ? (now_us() - last_action_us) / 1000.0 : 0;
+    snprintf(l->after, sizeof(l->after), "%s", last_action);
+}
 
-    while(strcmp(buf, PROMPT)) {
-        printf("%s", buf);
+/*
+ * cmpdouble - qsort comparator for doubles
+ */
+int cmpdouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
 
-        bzero(buf, MAXBUF);
-        if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
-            printf("%s: Runtrace timed out waiting for next shell prompt\n", 
-                   tracefile);
-            print_child_status();
-            return 0;
-        }
-        else {
-            if ((n = recv(datafd[0], buf, MAXBUF, 0)) < 0) {
-                perror("next_prompt:recv1");
-                exit(1);
-            }
-            else if (n == 0) { /* EOF */
-                return 0;
-            } 
+/*
+ * print_latencies - With -L, print a table of the NEXT and WAIT
+ *                   latencies (percentiles are nearest rank), and with
+ *                   -LL each latency first
+ */
+void print_latencies(void)
+{
+    static const double pcts[] = {0.50, 0.90, 0.99};
+    char kinds[] = "NW";
+    double *v, sum;
+    int i, k, n, j, p;
+
+    if (!show_latency)
+        return;
+    if (show_latency > 1) {
+        printf("%-7s %5s %10s  %s\n", "latency", "line", "ms", "after");
+        for (i = 0; i < nlatencies; i++)
+            printf("%-7s %5d %10.3f  %s\n",
+                   latencies[i].kind == 'N' ? "NEXT" : "WAIT",
+                   latencies[i].lineno, latencies[i].ms, latencies[i].after);
+    }
+    if ((v = malloc((nlatencies + 1) * sizeof(double))) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    printf("%-7s %6s %9s %9s %9s %9s %9s %9s\n", "latency", "count",
+           "min ms", "p50 ms", "p90 ms", "p99 ms", "max ms", "mean ms");
+    for (k = 0; k < 2; k++) {
+        for (i = n = 0, sum = 0; i < nlatencies; i++)
+            if (latencies[i].kind == kinds[k])
+                sum += v[n++] = latencies[i].ms;
+        if (n == 0)
+            continue;
+        qsort(v, n, sizeof(double), cmpdouble);
+        printf("%-7s %6d %9.3f", k ? "WAIT" : "NEXT", n, v[0]);
+        for (p = 0; p < 3; p++) {
+            j = (int)(pcts[p] * n + 0.999999) - 1;
+            printf(" %9.3f", v[j < 0 ? 0 : j]);
         }
+        printf(" %9.3f %9.3f\n", v[n - 1], sum / n);
     }
-    return 1;
+    free(v);
+    fflush(stdout);
 }
 
 /*
- * readable - Wait secs seconds for descriptor fd to become readable
- *            Return > 0 if fd is readable, 0 if timeout.
+ * now_ms - Monotonic time in milliseconds
  */
-int readable(int fd, int secs) 
+long now_ms(void)
 {
-    int n;
+    struct timespec ts;
 
-    fd_set rset;
-    struct timeval tv;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
 
-    FD_ZERO(&rset);
-    FD_SET(fd, &rset);
+/*
+ * watch - Add descriptor fd to epoll set epfd, for input
+ */
+void watch(int epfd, int fd)
+{
+    struct epoll_event ev;
 
-    tv.tv_sec = secs;
-    tv.tv_usec = 0;
-    
-    if ((n = select(fd+1, &rset, NULL, NULL, &tv)) < 0) {
-        perror("select");
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+/*
+ * receive_output - Append the next message from the shell to the queue,
+ *                  growing it to fit
+ */
+void receive_output(void)
+{
+    ssize_t n;
+    size_t need;
+
+    if ((n = recv(datafd[0], NULL, 0, MSG_PEEK | MSG_TRUNC)) < 0) {
+        perror("recv datafd[0]");
+        exit(1);
+    }
+    need = sizeof(size_t) + n;
+    if (outq_head == outq_tail)
+        outq_head = outq_tail = 0;
+    if (outq_tail + need > outq_size) {
+        memmove(outq, outq + outq_head, outq_tail - outq_head);
+        outq_tail -= outq_head;
+        outq_head = 0;
+        while (outq_tail + need > outq_size)
+            outq_size = outq_size ? 2 * outq_size : MAXBUF;
+        if ((outq = realloc(outq, outq_size)) == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    if ((n = recv(datafd[0], outq + outq_tail + sizeof(size_t), n, 0)) < 0) {
+        perror("recv datafd[0]");
         exit(1);
     }
+    if (n == 0) {               /* EOF */
+        shell_eof = 1;
+        epoll_ctl(data_epfd, EPOLL_CTL_DEL, datafd[0], NULL);
+        epoll_ctl(sync_epfd, EPOLL_CTL_DEL, datafd[0], NULL);
+        return;
+    }
+    memcpy(outq + outq_tail, &n, sizeof(size_t));
+    outq_tail += sizeof(size_t) + n;
+}
+
+/*
+ * next_message - Take the oldest message off the queue and return it,
+ *                or NULL if there is none
+ */
+char *next_message(size_t *len)
+{
+    char *msg;
+
+    if (outq_head == outq_tail)
+        return NULL;
+    memcpy(len, outq + outq_head, sizeof(size_t));
+    msg = outq + outq_head + sizeof(size_t);
+    outq_head += sizeof(size_t) + *len;
+    return msg;
+}
+
+/*
+ * wait_for - Wait ms milliseconds for shell output (fd is datafd[0]) or
+ *            a sync from a job (fd is syncfd[0]), reading the shell's
+ *            output into the queue meanwhile. Output counts as there
+ *            once the shell has closed its end. Return 1 if it is there,
+ *            0 on timeout.
+ */
+int wait_for(int fd, int ms)
+{
+    struct epoll_event ev[2];
+    int epfd = fd == syncfd[0] ? sync_epfd : data_epfd;
+    long deadline = now_ms() + ms, left;
+    int i, n, ready;
+
+    for (;;) {
+        if (fd == datafd[0] && (outq_head != outq_tail || shell_eof))
+            return 1;
+        if ((left = deadline - now_ms()) < 0)
+            left = 0;
+        if ((n = epoll_wait(epfd, ev, 2, left)) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            exit(1);
+        }
+        if (n == 0)
+            return 0;
+        for (i = ready = 0; i < n; i++) {
+            if (ev[i].data.fd == datafd[0])
+                receive_output();
+            else
+                ready = 1;
+        }
+        if (ready)
+            return 1;
+    }
+}
+
+/*
+ * flush_prompt_match - Print the bytes held back as a possible prompt
+ */
+void flush_prompt_match(void)
+{
+    fwrite(PROMPT, 1, prompt_match, stdout);
+    prompt_match = 0;
+}
+
+/*
+ * scan_output - Print a message from the shell, except for a prompt at
+ *               its end, and return 1 if there is one. The output is
+ *               scanned as a stream: a prompt is PROMPT starting a message
+ *               or a line and ending a message, perhaps split over
+ *               several, so the bytes that might begin one are held back
+ *               until the match is decided.
+ */
+int scan_output(char *msg, size_t len)
+{
+    size_t plen = strlen(PROMPT), i = 0;
+    int line_start = prompt_match == 0;
+
+    while (i < len) {
+        if (prompt_match > 0 || line_start) {
+            if (msg[i] == PROMPT[prompt_match]) {
+                if (++prompt_match == plen) {
+                    if (i == len - 1) {
+                        prompt_match = 0;
+                        return 1;
+                    }
+                    flush_prompt_match();   /* Not the end: not a prompt */
+                    line_start = 0;
+                }
+                i++;
+                continue;
+            }
+            if (prompt_match > 0) {
+                /* Mismatch: print what was held, then look at msg[i] again */
+                flush_prompt_match();
+                line_start = i == 0;
+                continue;
+            }
+        }
+        putchar(msg[i]);
+        line_start = msg[i++] == '\n';
+    }
+    return 0;
+}
+
+/*
+ * next_prompt - Print the shell response until the next prompt or EOF,
+ *               waiting at most ms for each message
+ *               Returns 1 if OK, 0 on EOF or timeout
+ */
+int next_prompt(int ms)
+{
+    char *msg;
+    size_t len;
 
-    return n;
+    for (;;) {
+        if (wait_for(datafd[0], ms) == 0) {
+            flush_prompt_match();
+            printf("%s: Runtrace timed out waiting for next shell prompt\n", 
+                   tracefile);
+            print_child_status(WNOHANG);
+            return 0;
+        }
+        if ((msg = next_message(&len)) == NULL) { /* EOF */
+            flush_prompt_match();
+            printf("%s: Shell closed its output while runtrace waited for the next prompt\n", 
+                   tracefile);
+            set_alarm(timeout_ms);
+            state = "waiting for shell to terminate";
+            print_child_status(0);
+            set_alarm(0);
+            return 0;
+        }
+        if (scan_output(msg, len))
+            return 1;
+    }
 }
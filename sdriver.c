@@ -15,29 +15,62 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
 #include <time.h>
+#include <signal.h>
+#include <getopt.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 //#include "driverlib.h"
 #include "config.h"
 
+/* The output of one run of runtrace, in memory */
+struct output {
+    char *text;
+    size_t len;
+};
+
+/* The lines of an output, each with its newline if it has one */
+struct lines {
+    char **line;
+    size_t *len;
+    long n;
+};
+
+/* The wall and CPU times of the runs of one shell on one trace */
+struct times {
+    int n;
+    double *wall;
+    double *cpu;
+};
+
 /* Prototypes */
 void usage(void);
 int runtrace(char *tracefile);
-void delete_tmpfiles(void);
+int run_iters(char *tracefile);
+void run_parallel(char **tracefiles, int num_tracefiles, int *correct);
+int exclusive(char *tracefile);
+int hash_file(char *filename, unsigned long long *hash);
+void ref_cache_path(char *tracefile, char *path);
+int load_ref(char *path, struct output *out);
+void save_ref(char *path, struct output *out);
+int run_shell(char *shell, char *tracefile, int sandbox, struct output *out,
+              struct times *times);
+void add_time(struct times *times, double wall, double cpu);
+void save_times(char *filename, int trace);
+void load_times(char *filename, int trace);
+void print_times(char **tracefiles, int num_tracefiles);
+void write_json(char *filename, char **tracefiles, int num_tracefiles,
+                int *correct);
+void write_junit(char *filename, char **tracefiles, int num_tracefiles,
+                 int *correct);
+void filter_output(struct output *out, struct output *filtered);
+void diff_outputs(struct output *a, struct output *b);
+void emit_output(struct output *out);
 void emit_file(char *filename);
 
-/* 
- * Perl program that filters a shell output file:
- *
- * (1) Elides all whitespace. 
- * (2) Converts PIDs of the form "(12345)" to "(PID)". 
- *
- * These transformations allow us to do diffs on the outputs of 
- * different runs of different shells.  
- */
-#define PERLPROG "while(<>){chomp; s/\\s+//g; s/\\(\\d+\\)/\\(PID\\)/g; print \"$_\"}"
-
 /********************
  * Global variables
  *******************/
@@ -46,6 +79,20 @@ char *shellprog = "./tsh";  /* Name of test shell (-s) */
 int sandboxing = 0;         /* Enable sandboxing (-x) */
 int autograded = 0;         /* Set only on the Autolab server (-A) */
 int num_iters=ITERS;        /* How many times to test each trace file */
+int num_jobs = 1;           /* Traces to run at once (-j) */
+char *fixed_seed = NULL;    /* $TSH_FORK_SEED, used for every run if set */
+unsigned long long next_seed; /* Otherwise, seeds are drawn from this */
+int refresh_ref = 0;        /* Rerun tshref even if cached (--refresh-ref) */
+unsigned long long ref_hash; /* Hash of ./tshref and ./runtrace */
+char *json_file = NULL;     /* Write a JSON report here (--json) */
+char *junit_file = NULL;    /* Write a JUnit XML report here (--junit) */
+int show_times = 0;         /* Print a table of the times (--times) */
+int timing = 0;             /* Any of those; tshref then runs every time */
+
+/* Times of the test and reference shells on each trace */
+int trace_index;            /* Trace being run, whose times are recorded */
+struct times test_times[MAXTRACES];
+struct times ref_times[MAXTRACES];
 
 /* Null-terminated list of trace files */
 static char *default_tracefiles[] = {TRACEFILES, NULL};
@@ -54,15 +101,8 @@ static char *default_tracefiles[] = {TRACEFILES, NULL};
 char autoresult[MAXBUF]; /* Autolab autoresult string */  
 char status[MAXBUF];
 
-/* Temp filenames for unfiltered shell output */
-char ref_raw_outfile[MAXBUF];
-char test_raw_outfile[MAXBUF];
-char diff_raw_outfile[MAXBUF];
-
-/* Temp filenames for filtered shell output */
-char ref_filtered_outfile[MAXBUF];
-char test_filtered_outfile[MAXBUF];
-char diff_filtered_outfile[MAXBUF];
+/* Prefix of the files the traces run with -j write their output to */
+char outfile_prefix[MAXBUF];
 
 /**************
  * Main routine
@@ -79,11 +119,20 @@ int main(int argc, char **argv)
 
     char **tracefiles = NULL;  /* Null-terminated array of trace file names */
     int num_tracefiles = 0;    /* The number of traces in that array */
-    int tracenum;              /* Number of trace file to test (-t) */
+    int tracenum = 0;          /* Number of trace file to test (-t) */
     int singletrace = 0;       /* Are we testing one trace or all? (-t) */
     int num_iters_specified = 0; /* True if the user specifed the i flag */
 
     struct stat statbuf;
+    char path[MAXBUF];
+
+    static struct option long_options[] = {
+        {"refresh-ref", no_argument, NULL, 'R'},
+        {"json", required_argument, NULL, 'J'},
+        {"junit", required_argument, NULL, 'U'},
+        {"times", no_argument, NULL, 'T'},
+        {NULL, 0, NULL, 0}
+    };
 
     /* Set up the default list of tracefiles */
     tracefiles = default_tracefiles;
@@ -92,7 +141,8 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "Ai:t:s:hVx")) != EOF) {
+    while ((c = getopt_long(argc, argv, "Ai:j:t:s:hVx", long_options,
+                            NULL)) != EOF) {
         switch (c) {
 
         case 'A': /* hidden Autolab driver argument */
@@ -109,6 +159,16 @@ int main(int argc, char **argv)
             num_iters_specified = 1;
             break;
 
+        case 'j': /* number of traces to run at once; 0 for one per CPU */
+            num_jobs = atoi(optarg);
+            if (num_jobs == 0)
+                num_jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+            if (num_jobs < 1) {
+                printf("Error: Invalid number of jobs (-j)\n");
+                usage();
+            }
+            break;
+
         case 's':  /* The name of the test shell (default ./tsh) */
             shellprog = strdup(optarg);
             break;
@@ -131,6 +191,25 @@ int main(int argc, char **argv)
             sandboxing = 1;
             break;
 
+        case 'R': /* Rerun the reference shell instead of using the cache */
+            refresh_ref = 1;
+            break;
+
+        case 'J': /* Write the results and times as JSON */
+            json_file = optarg;
+            timing = 1;
+            break;
+
+        case 'U': /* Write the results and times as JUnit XML */
+            junit_file = optarg;
+            timing = 1;
+            break;
+
+        case 'T': /* Print the times of each trace */
+            show_times = 1;
+            timing = 1;
+            break;
+
         case 'h': /* Print help */
             usage();
             exit(0);
@@ -159,23 +238,35 @@ int main(int argc, char **argv)
     current_time = (int) time(NULL);
     pid = (int) getpid();
 
-    /* Generate some (truly) unique filenames in /usr/tmp */
-    sprintf(test_raw_outfile, 
-            "/tmp/test_raw_outfile.%d.%d", current_time, pid);
-    sprintf(ref_raw_outfile, 
-            "/tmp/ref_raw_outfile.%d.%d", current_time, pid);
-    sprintf(diff_raw_outfile, 
-            "/tmp/diff_raw_outfile.%d.%d", current_time, pid);
-
-    sprintf(test_filtered_outfile, 
-            "/tmp/test_filtered_outfile.%d.%d", current_time, pid);
-    sprintf(ref_filtered_outfile, 
-            "/tmp/ref_filtered_outfile.%d.%d", current_time, pid);
-    sprintf(diff_filtered_outfile, 
-            "/tmp/diff_filtered_outfile.%d.%d", current_time, pid);
+    /* Each run of the test shell gets a fork.c seed, printed on failure */
+    fixed_seed = getenv("TSH_FORK_SEED");
+    next_seed = ((unsigned long long)current_time << 20) ^ pid;
+
+    sprintf(outfile_prefix, "/tmp/sdriver.%d.%d", current_time, pid);
+
+    /* 
+     * Reference outputs are cached under a hash of the trace, tshref and
+     * runtrace. To refresh them, drop the entries of the traces to run
+     * and let the first iteration of each write them again.
+     */
+    ref_hash = 14695981039346656037ULL;
+    if (hash_file("./tshref", &ref_hash) < 0 ||
+        hash_file("./runtrace", &ref_hash) < 0) {
+        fprintf(stderr, "./tshref or ./runtrace: File not found\n");
+        exit(1);
+    }
+    if (refresh_ref) {
+        for (i = 0; i < num_tracefiles; i++) {
+            if (singletrace && i != tracenum)
+                continue;
+            ref_cache_path(tracefiles[i], path);
+            unlink(path);
+        }
+    }
 
     /* Evaluate a single tracefile */
     if (singletrace) {
+        trace_index = tracenum;
         num_correct = 0;
         num_iters = num_iters_specified ? num_iters : 1;
         if (num_iters_specified) {
@@ -195,30 +286,22 @@ int main(int argc, char **argv)
         }
         printf("\n");
         printf("Summary: %d/%d correct iterations\n", num_correct, num_iters);
+        correct[tracenum] = num_correct == num_iters;
     }
 
     /* Evaluate all trace files */
     else {
         num_correct = 0;
-        for (i = 0; i < num_tracefiles; i++) {
-            if (num_iters > 1) 
-                printf("Running %d iters of %s\n", num_iters, tracefiles[i]);
-            for (j = 0; j < num_iters; j++) {
-                if (num_iters > 1) 
-                    printf("%d. Running %s...\n", j+1, tracefiles[i]);
-                else
-                    printf("Running %s...\n", tracefiles[i]);
-
-                /* Run the trace interpreter on trace i */
-                correct[i] = runtrace(tracefiles[i]);
-                if (!correct[i]) {
-                    break;
-                }
+        if (num_jobs > 1)
+            run_parallel(tracefiles, num_tracefiles, correct);
+        else
+            for (i = 0; i < num_tracefiles; i++) {
+                trace_index = i;
+                correct[i] = run_iters(tracefiles[i]);
             }
-		    
+        for (i = 0; i < num_tracefiles; i++)
             if (correct[i])
                 num_correct+=num_iters;
-        }
 
         printf("Score: %d/%d\n", num_correct, num_tracefiles*num_iters);
 
@@ -242,11 +325,137 @@ int main(int argc, char **argv)
         }
     }
 
-    /* Clean up */
-    delete_tmpfiles();
+    /* Report the times */
+    if (show_times)
+        print_times(tracefiles, num_tracefiles);
+    if (json_file != NULL)
+        write_json(json_file, tracefiles, num_tracefiles, correct);
+    if (junit_file != NULL)
+        write_junit(junit_file, tracefiles, num_tracefiles, correct);
+
     exit(0);
 }
 
+/*
+ * run_iters - Run a trace file num_iters times, stopping at the first
+ *             failure. Return 1 if every iteration was correct.
+ */
+int run_iters(char *tracefile)
+{
+    int j;
+
+    if (num_iters > 1) 
+        printf("Running %d iters of %s\n", num_iters, tracefile);
+    for (j = 0; j < num_iters; j++) {
+        if (num_iters > 1) 
+            printf("%d. Running %s...\n", j+1, tracefile);
+        else
+            printf("Running %s...\n", tracefile);
+
+        /* Run the trace interpreter on the trace */
+        if (!runtrace(tracefile))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * exclusive - Return true if a trace looks at every process of the user
+ *             (with ps, or mykill.pl, which kills by name), so that it
+ *             must run while no other trace is running
+ */
+int exclusive(char *tracefile)
+{
+    FILE *fp;
+    char buf[MAXBUF];
+    int found = 0;
+
+    if ((fp = fopen(tracefile, "r")) == NULL)
+        return 1;
+    while (!found && fgets(buf, MAXBUF, fp))
+        if (buf[0] != '#' && (strstr(buf, "/bin/ps") || strstr(buf, "mykill")))
+            found = 1;
+    fclose(fp);
+    return found;
+}
+
+/*
+ * run_parallel - Run the iterations of up to num_jobs trace files at
+ *                once, each in a child process with its output in a
+ *                file, and print the outputs in trace order as soon as
+ *                each trace and those before it are done. Exclusive
+ *                traces run on their own.
+ */
+void run_parallel(char **tracefiles, int num_tracefiles, int *correct)
+{
+    char outfile[MAXTRACES][MAXBUF], buf[MAXBUF + 8];
+    pid_t pids[MAXTRACES], pid;
+    int done[MAXTRACES], excl[MAXTRACES];
+    int next = 0, printed = 0, running = 0, excl_running = 0, status, i;
+
+    for (i = 0; i < num_tracefiles; i++) {
+        sprintf(outfile[i], "%s.trace%d", outfile_prefix, i);
+        done[i] = 0;
+        excl[i] = exclusive(tracefiles[i]);
+    }
+
+    while (printed < num_tracefiles) {
+        /* Start traces until num_jobs are running */
+        while (running < num_jobs && next < num_tracefiles &&
+               !excl_running && !(excl[next] && running > 0)) {
+            fflush(stdout);
+            if ((pid = fork()) < 0) {
+                perror("fork");
+                exit(1);
+            }
+            if (pid == 0) {
+                if (freopen(outfile[next], "w", stdout) == NULL)
+                    exit(1);
+                next_seed ^= (unsigned long long)(next + 1) << 40;
+                trace_index = next;
+                i = run_iters(tracefiles[next]);
+                if (timing) {
+                    sprintf(buf, "%s.times", outfile[next]);
+                    save_times(buf, next);
+                }
+                fflush(stdout);
+                exit(i ? 0 : 1);
+            }
+            excl_running = excl[next];
+            pids[next++] = pid;
+            running++;
+        }
+
+        /* Wait for one to finish */
+        if ((pid = wait(&status)) < 0) {
+            perror("wait");
+            exit(1);
+        }
+        for (i = 0; i < next && pids[i] != pid; i++)
+            ;
+        if (i == next)
+            continue;
+        correct[i] = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        done[i] = 1;
+        if (timing) {
+            sprintf(buf, "%s.times", outfile[i]);
+            load_times(buf, i);
+            unlink(buf);
+        }
+        running--;
+        if (excl[i])
+            excl_running = 0;
+
+        /* Print what is ready, in order */
+        while (printed < num_tracefiles && done[printed]) {
+            emit_file(outfile[printed]);
+            unlink(outfile[printed]);
+            printed++;
+        }
+        fflush(stdout);
+    }
+}
+
 /*
  * runtrace - Run trace file on test and reference shells
  *            Return 0 if results are different, 1 if identical
@@ -254,7 +463,9 @@ int main(int argc, char **argv)
 int runtrace(char *tracefile)
 { 
     int status;
-    char buf[MAXBUF];
+    char seed[32];
+    char path[MAXBUF];
+    struct output test, ref, test_filtered, ref_filtered;
     struct stat statbuf;
 
     if (stat(tracefile, &statbuf) < 0) {
@@ -262,84 +473,295 @@ int runtrace(char *tracefile)
         exit(1);
     }
 
-    /* Run the student's test shell */
-    if (sandboxing)
-        sprintf(buf, "./runtrace -x -s %s -f %s > %s\n", 
-                shellprog, tracefile, test_raw_outfile);
-    else
-        sprintf(buf, "./runtrace -s %s -f %s > %s\n", 
-                shellprog, tracefile, test_raw_outfile);
+    /* Pick the seed for the delays fork.c puts in the test shell */
+    if (fixed_seed != NULL)
+        snprintf(seed, sizeof(seed), "%s", fixed_seed);
+    else {
+        next_seed = next_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        snprintf(seed, sizeof(seed), "%llu", next_seed >> 16);
+    }
+    setenv("TSH_FORK_SEED", seed, 1);
 
-    if (system(buf) != 0) {
-        printf("sdriver unable to run %s\n", buf);
+    /* Run the student's test shell */
+    if (run_shell(shellprog, tracefile, sandboxing, &test,
+                  timing ? &test_times[trace_index] : NULL) != 0) {
+        printf("sdriver unable to run ./runtrace %s-s %s -f %s\n\n", 
+               sandboxing ? "-x " : "", shellprog, tracefile);
     }
     
-    /* Run the reference shell */
-    sprintf(buf, "./runtrace -s ./tshref -f %s > %s\n", 
-            tracefile, ref_raw_outfile);
-    if (system(buf) != 0) {
-        emit_file(ref_raw_outfile);
-        printf("sdriver unable to run %s\n", buf);
-        delete_tmpfiles();
-        exit(1);
+    /* Run the reference shell, unless its output is cached and it is
+       not being timed */
+    ref_cache_path(tracefile, path);
+    if (timing || load_ref(path, &ref) < 0) {
+        if (run_shell("./tshref", tracefile, 0, &ref,
+                      timing ? &ref_times[trace_index] : NULL) != 0) {
+            emit_output(&ref);
+            printf("sdriver unable to run ./runtrace -s ./tshref -f %s\n\n", 
+                   tracefile);
+            exit(1);
+        }
+        save_ref(path, &ref);
     }
     
-    /* Filter the test and reference outputs */
-    sprintf(buf, "perl -e '%s' < %s | sort > %s", 
-            PERLPROG, test_raw_outfile, test_filtered_outfile);
-    system(buf);
-    
-    sprintf(buf, "perl -e '%s' < %s | sort > %s", 
-            PERLPROG, ref_raw_outfile, ref_filtered_outfile);
-    system(buf);
-    
-    /* Diff the filtered output files */
-    sprintf(buf, "diff %s %s > %s\n", 
-            test_filtered_outfile, ref_filtered_outfile, diff_filtered_outfile);
-    status = system(buf);
+    /* Compare the filtered test and reference outputs */
+    filter_output(&test, &test_filtered);
+    filter_output(&ref, &ref_filtered);
+    status = test_filtered.len != ref_filtered.len ||
+             memcmp(test_filtered.text, ref_filtered.text, ref_filtered.len);
+    free(test_filtered.text);
+    free(ref_filtered.text);
     
-    /* Filtered output files were different */
+    /* Filtered outputs were different */
     if (status != 0) {
-        sprintf(buf, "diff %s %s > %s\n", 
-                test_raw_outfile, ref_raw_outfile, diff_raw_outfile);
-        system(buf);
-
         printf("Oops: test and reference outputs for %s differed.\n", 
                tracefile);
+        printf("Fork seed: %s (rerun with TSH_FORK_SEED=%s)\n", seed, seed);
         printf("\n");
 
         printf("Test output:\n");
-        emit_file(test_raw_outfile);
+        emit_output(&test);
         printf("\n");
 
         printf("Reference output:\n");
-        emit_file(ref_raw_outfile);
+        emit_output(&ref);
         printf("\n");
 
         printf("Output of 'diff test reference':\n");
-        emit_file(diff_raw_outfile);
+        diff_outputs(&test, &ref);
         printf("\n");
 
+        free(test.text);
+        free(ref.text);
         return 0;
     }
     
-    /* Filtered output files were identical */
+    /* Filtered outputs were identical */
     if (verbose) {
         printf("Success: The test and reference outputs for %s matched!\n", tracefile);
     }
     if (verbose > 1) {
         printf("Test output:\n");
-        emit_file(test_raw_outfile);
+        emit_output(&test);
         printf("\n");
         printf("Reference output:\n");
-        fflush(stdout);
-        emit_file(ref_raw_outfile);
+        emit_output(&ref);
         printf("\n");
     }
 
+    free(test.text);
+    free(ref.text);
     return 1;
 }
 
+/*
+ * hash_file - Fold the contents of a file into a 64-bit FNV-1a hash.
+ *             Return -1 if the file cannot be read.
+ */
+int hash_file(char *filename, unsigned long long *hash)
+{
+    unsigned char buf[MAXBUF];
+    size_t n, i;
+    FILE *fp;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        return -1;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        for (i = 0; i < n; i++)
+            *hash = (*hash ^ buf[i]) * 1099511628211ULL;
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * ref_cache_path - Name of the file in REFCACHE that holds the reference
+ *                  output for a trace file, from the hash of its contents
+ *                  and of ./tshref and ./runtrace
+ */
+void ref_cache_path(char *tracefile, char *path)
+{
+    unsigned long long hash = ref_hash;
+
+    hash_file(tracefile, &hash);
+    sprintf(path, "%s/%016llx", REFCACHE, hash);
+}
+
+/*
+ * load_ref - Read a cached reference output into out.
+ *            Return -1 if there is none.
+ */
+int load_ref(char *path, struct output *out)
+{
+    struct stat statbuf;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+    if (fstat(fileno(fp), &statbuf) < 0 ||
+        (out->text = malloc(statbuf.st_size + 1)) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    out->len = fread(out->text, 1, statbuf.st_size, fp);
+    fclose(fp);
+    if (out->len != (size_t)statbuf.st_size) {
+        free(out->text);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * save_ref - Cache a reference output. It is written to a temp file
+ *            first, so that traces run with -j never read half an entry.
+ */
+void save_ref(char *path, struct output *out)
+{
+    char tmp[MAXBUF];
+    FILE *fp;
+
+    if (mkdir(REFCACHE, 0755) < 0 && errno != EEXIST)
+        return;
+    sprintf(tmp, "%s.%d", path, (int)getpid());
+    if ((fp = fopen(tmp, "w")) == NULL)
+        return;
+    if (fwrite(out->text, 1, out->len, fp) != out->len || fclose(fp) != 0 ||
+        rename(tmp, path) < 0)
+        unlink(tmp);
+}
+
+/*
+ * run_shell - Run runtrace on a trace file with a shell, reading what it
+ *             prints into out, and if times is not NULL, adding the wall
+ *             time and the CPU time of runtrace and all it reaped (the
+ *             shell and its jobs) to times. Return its wait status,
+ *             nonzero if the trace could not be run.
+ */
+int run_shell(char *shell, char *tracefile, int sandbox, struct output *out,
+              struct times *times)
+{
+    size_t size = MAXBUF;
+    int fd[2], status;
+    struct timespec start, end;
+    struct rusage ru;
+    ssize_t n;
+    pid_t pid;
+
+    out->len = 0;
+    if ((out->text = malloc(size)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    if (pipe(fd) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        dup2(fd[1], STDOUT_FILENO);
+        close(fd[0]);
+        close(fd[1]);
+        if (sandbox)
+            execl("./runtrace", "./runtrace", "-x", "-s", shell,
+                  "-f", tracefile, (char *)NULL);
+        else
+            execl("./runtrace", "./runtrace", "-s", shell,
+                  "-f", tracefile, (char *)NULL);
+        perror("./runtrace");
+        exit(127);
+    }
+    close(fd[1]);
+
+    for (;;) {
+        if (out->len == size &&
+            (out->text = realloc(out->text, size *= 2)) == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        n = read(fd[0], out->text + out->len, size - out->len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        out->len += n;
+    }
+    close(fd[0]);
+
+    while (wait4(pid, &status, 0, &ru) < 0)
+        if (errno != EINTR)
+            return -1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (times != NULL)
+        add_time(times, (end.tv_sec - start.tv_sec) +
+                        (end.tv_nsec - start.tv_nsec) / 1e9,
+                 ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+                 ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+    return status;
+}
+
+/* 
+ * filter_output - Filter a shell's output so that the outputs of
+ *                 different runs of different shells can be compared:
+ *
+ * (1) Elides all whitespace. 
+ * (2) Converts PIDs of the form "(12345)" to "(PID)". 
+ *
+ *                 This used to be a perl one-liner piped through sort.
+ *                 It works line by line, so a PID is never matched across
+ *                 a line break, but joins the lines, so that there was
+ *                 only ever one line to sort.
+ */
+void filter_output(struct output *out, struct output *filtered)
+{
+    char *line, *p, *q, *end = out->text + out->len;
+    size_t n = 0;
+
+    /* Whitespace out, at most 5 bytes for every 3 in */
+    if ((filtered->text = malloc(out->len * 2 + 1)) == NULL ||
+        (line = malloc(out->len + 1)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (p = out->text; p < end; p = q) {
+        size_t len = 0, i, j;
+
+        for (q = p; q < end && *q != '\n'; q++)
+            if (!strchr(" \t\r\f\v", *q) || *q == '\0')
+                line[len++] = *q;
+        if (q < end)
+            q++;
+
+        for (i = 0; i < len; i++) {
+            if (line[i] == '(') {
+                for (j = i + 1; j < len && line[j] >= '0' && line[j] <= '9'; j++)
+                    ;
+                if (j > i + 1 && j < len && line[j] == ')') {
+                    memcpy(filtered->text + n, "(PID)", 5);
+                    n += 5;
+                    i = j;
+                    continue;
+                }
+            }
+            filtered->text[n++] = line[i];
+        }
+    }
+    filtered->len = n;
+    free(line);
+}
+
+/*
+ * emit_output - Print an output of runtrace to stdout
+ */
+void emit_output(struct output *out)
+{
+    fwrite(out->text, 1, out->len, stdout);
+}
+
 /*
  * emit_file - prints an ascii file to stdout
  */
@@ -358,16 +780,779 @@ void emit_file(char *filename)
     fclose(fp);
 }
 
+/*****************************************************************
+ * Times of the runs, and the reports of them
+ *****************************************************************/
+
 /*
- * delete_tmpfiles - Clean up the temp files we created during testing
+ * add_time - Record the times of one run of a shell
  */
-void delete_tmpfiles()
+void add_time(struct times *times, double wall, double cpu)
 {
-    char buf[MAXBUF];
-    sprintf(buf, "rm -rf %s %s %s %s %s %s",
-            test_raw_outfile, ref_raw_outfile, diff_raw_outfile,
-            test_filtered_outfile, ref_filtered_outfile, diff_filtered_outfile);
-    system(buf);
+    if (times->n == 0) {
+        times->wall = malloc(num_iters * sizeof(double));
+        times->cpu = malloc(num_iters * sizeof(double));
+        if (times->wall == NULL || times->cpu == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    if (times->n < num_iters) {
+        times->wall[times->n] = wall;
+        times->cpu[times->n] = cpu;
+        times->n++;
+    }
+}
+
+/*
+ * save_times - Write the times of a trace to a file, for a trace run
+ *              in a child process (-j) to hand them back
+ */
+void save_times(char *filename, int trace)
+{
+    FILE *fp;
+    int i;
+
+    if ((fp = fopen(filename, "w")) == NULL)
+        return;
+    for (i = 0; i < test_times[trace].n; i++)
+        fprintf(fp, "test %.9f %.9f\n", test_times[trace].wall[i],
+                test_times[trace].cpu[i]);
+    for (i = 0; i < ref_times[trace].n; i++)
+        fprintf(fp, "ref %.9f %.9f\n", ref_times[trace].wall[i],
+                ref_times[trace].cpu[i]);
+    fclose(fp);
+}
+
+/*
+ * load_times - Read the times save_times wrote
+ */
+void load_times(char *filename, int trace)
+{
+    char shell[8];
+    double wall, cpu;
+    FILE *fp;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        return;
+    while (fscanf(fp, "%7s %lf %lf", shell, &wall, &cpu) == 3)
+        add_time(strcmp(shell, "ref") ? &test_times[trace] : &ref_times[trace],
+                 wall, cpu);
+    fclose(fp);
+}
+
+/*
+ * cmpdouble - qsort comparator for doubles
+ */
+int cmpdouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * summarize - The minimum, median and 95th percentile (nearest rank)
+ *             of n times, all 0 if there are none
+ */
+void summarize(double *v, int n, double *stats)
+{
+    double *sorted;
+    int i;
+
+    stats[0] = stats[1] = stats[2] = 0;
+    if (n == 0)
+        return;
+    if ((sorted = malloc(n * sizeof(double))) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(sorted, v, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), cmpdouble);
+    stats[0] = sorted[0];
+    i = (int)(0.50 * n + 0.999999) - 1;
+    stats[1] = sorted[i < 0 ? 0 : i];
+    i = (int)(0.95 * n + 0.999999) - 1;
+    stats[2] = sorted[i < 0 ? 0 : i >= n ? n - 1 : i];
+    free(sorted);
+}
+
+/*
+ * ratio - Median wall time of the test shell over that of tshref, or 0
+ */
+double ratio(int trace)
+{
+    double test[3], ref[3];
+
+    summarize(test_times[trace].wall, test_times[trace].n, test);
+    summarize(ref_times[trace].wall, ref_times[trace].n, ref);
+    return ref[1] > 0 ? test[1] / ref[1] : 0;
+}
+
+/*
+ * print_times - Print a table of the times of each trace that ran
+ */
+void print_times(char **tracefiles, int num_tracefiles)
+{
+    double wall[3], cpu[3];
+    struct times *t;
+    int i, k;
+
+    printf("\n%-12s %-5s %4s %9s %9s %9s %9s %9s %9s %6s\n", "trace",
+           "shell", "runs", "wall min", "wall med", "wall p95", "cpu min",
+           "cpu med", "cpu p95", "ratio");
+    for (i = 0; i < num_tracefiles; i++) {
+        if (test_times[i].n == 0)
+            continue;
+        for (k = 0; k < 2; k++) {
+            t = k ? &ref_times[i] : &test_times[i];
+            summarize(t->wall, t->n, wall);
+            summarize(t->cpu, t->n, cpu);
+            printf("%-12s %-5s %4d %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f",
+                   k ? "" : tracefiles[i], k ? "ref" : "test", t->n,
+                   wall[0], wall[1], wall[2], cpu[0], cpu[1], cpu[2]);
+            if (k == 0)
+                printf(" %6.2f", ratio(i));
+            printf("\n");
+        }
+    }
+}
+
+/*
+ * print_escaped - Print a string inside quotes in JSON (xml = 0) or in
+ *                 an XML attribute (xml = 1)
+ */
+void print_escaped(FILE *fp, char *str, int xml)
+{
+    for (; *str; str++) {
+        if (xml && *str == '&')
+            fputs("&amp;", fp);
+        else if (xml && *str == '<')
+            fputs("&lt;", fp);
+        else if (xml && *str == '>')
+            fputs("&gt;", fp);
+        else if (xml && *str == '"')
+            fputs("&quot;", fp);
+        else if (!xml && (*str == '"' || *str == '\\'))
+            fprintf(fp, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(fp, xml ? "&#%d;" : "\\u%04x", *str);
+        else
+            putc(*str, fp);
+    }
+}
+
+/*
+ * json_times - Print the times of one shell on one trace as JSON
+ */
+void json_times(FILE *fp, char *name, struct times *t)
+{
+    double wall[3], cpu[3];
+
+    summarize(t->wall, t->n, wall);
+    summarize(t->cpu, t->n, cpu);
+    fprintf(fp, "\"%s\": {\"runs\": %d, "
+            "\"wall_s\": {\"min\": %.6f, \"median\": %.6f, \"p95\": %.6f}, "
+            "\"cpu_s\": {\"min\": %.6f, \"median\": %.6f, \"p95\": %.6f}}",
+            name, t->n, wall[0], wall[1], wall[2], cpu[0], cpu[1], cpu[2]);
+}
+
+/*
+ * write_json - Write the result and the times of each trace that ran as
+ *              JSON. The ratio is the test shell's median wall time over
+ *              tshref's.
+ */
+void write_json(char *filename, char **tracefiles, int num_tracefiles,
+                int *correct)
+{
+    FILE *fp;
+    int i, first = 1;
+
+    if ((fp = fopen(filename, "w")) == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    fprintf(fp, "{\n  \"shell\": \"");
+    print_escaped(fp, shellprog, 0);
+    fprintf(fp, "\",\n  \"iterations\": %d,\n  \"traces\": [", num_iters);
+    for (i = 0; i < num_tracefiles; i++) {
+        if (test_times[i].n == 0)
+            continue;
+        fprintf(fp, "%s\n    {\"trace\": \"", first ? "" : ",");
+        print_escaped(fp, tracefiles[i], 0);
+        fprintf(fp, "\", \"passed\": %s,\n     ",
+                correct[i] ? "true" : "false");
+        json_times(fp, "test", &test_times[i]);
+        fprintf(fp, ",\n     ");
+        json_times(fp, "ref", &ref_times[i]);
+        fprintf(fp, ",\n     \"wall_ratio\": %.3f}", ratio(i));
+        first = 0;
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+}
+
+/*
+ * write_junit - Write the result of each trace that ran as a JUnit XML
+ *               test case, with the times as its properties
+ */
+void write_junit(char *filename, char **tracefiles, int num_tracefiles,
+                 int *correct)
+{
+    double stats[3], total, suite_time = 0;
+    int i, j, k, tests = 0, failures = 0;
+    struct times *t;
+    FILE *fp;
+
+    if ((fp = fopen(filename, "w")) == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    for (i = 0; i < num_tracefiles; i++) {
+        if (test_times[i].n == 0)
+            continue;
+        tests++;
+        failures += !correct[i];
+        for (j = 0; j < test_times[i].n; j++)
+            suite_time += test_times[i].wall[j];
+    }
+    fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(fp, "<testsuite name=\"sdriver\" tests=\"%d\" failures=\"%d\" "
+            "errors=\"0\" time=\"%.3f\">\n", tests, failures, suite_time);
+    for (i = 0; i < num_tracefiles; i++) {
+        if (test_times[i].n == 0)
+            continue;
+        for (j = 0, total = 0; j < test_times[i].n; j++)
+            total += test_times[i].wall[j];
+        fprintf(fp, "  <testcase classname=\"");
+        print_escaped(fp, shellprog, 1);
+        fprintf(fp, "\" name=\"");
+        print_escaped(fp, tracefiles[i], 1);
+        fprintf(fp, "\" time=\"%.3f\">\n    <properties>\n", total);
+        for (k = 0; k < 2; k++) {
+            t = k ? &ref_times[i] : &test_times[i];
+            fprintf(fp, "      <property name=\"%s_runs\" value=\"%d\"/>\n",
+                    k ? "ref" : "test", t->n);
+            summarize(t->wall, t->n, stats);
+            fprintf(fp, "      <property name=\"%s_wall_min\" value=\"%.6f\"/>\n"
+                    "      <property name=\"%s_wall_median\" value=\"%.6f\"/>\n"
+                    "      <property name=\"%s_wall_p95\" value=\"%.6f\"/>\n",
+                    k ? "ref" : "test", stats[0], k ? "ref" : "test",
+                    stats[1], k ? "ref" : "test", stats[2]);
+            summarize(t->cpu, t->n, stats);
+            fprintf(fp, "      <property name=\"%s_cpu_min\" value=\"%.6f\"/>\n"
+                    "      <property name=\"%s_cpu_median\" value=\"%.6f\"/>\n"
+                    "      <property name=\"%s_cpu_p95\" value=\"%.6f\"/>\n",
+                    k ? "ref" : "test", stats[0], k ? "ref" : "test",
+                    stats[1], k ? "ref" : "test", stats[2]);
+        }
+        fprintf(fp, "      <property name=\"wall_ratio\" value=\"%.3f\"/>\n"
+                "    </properties>\n", ratio(i));
+        if (!correct[i])
+            fprintf(fp, "    <failure message=\"test and reference outputs "
+                    "differed\"/>\n");
+        fprintf(fp, "  </testcase>\n");
+    }
+    fprintf(fp, "</testsuite>\n");
+    fclose(fp);
+}
+
+/*****************************************************************
+ * Differences between two outputs, printed the way "diff a b" prints
+ * them. The algorithm is the one GNU diff uses, so that the hunks come
+ * out the same: strip the common prefix and suffix, set aside lines
+ * that cannot match (discard_confusing_lines), find a shortest edit
+ * script on the rest with Myers' O(ND) divide and conquer (diag and
+ * compareseq), and slide each run of changes to merge it with its
+ * neighbours (shift_boundaries). GNU diff gives up on an optimal
+ * script past 4096 edits or so; traces never print that much.
+ *****************************************************************/
+
+/* State of the diff being computed */
+static long *xvec, *yvec;       /* Classes of the lines left to compare */
+static long *fdiag, *bdiag;     /* Furthest x reached on each diagonal */
+static char *changed[2];        /* changed[f][i]: line i of file f differs */
+static long *realindex[2];      /* Line of file f each compared line is */
+
+/*
+ * split_lines - Split an output into lines
+ */
+void split_lines(struct output *out, struct lines *l)
+{
+    char *p = out->text, *end = out->text + out->len, *q;
+    long max = 1;
+
+    for (q = p; q < end; q++)
+        if (*q == '\n')
+            max++;
+    l->line = malloc(max * sizeof(char *));
+    l->len = malloc(max * sizeof(size_t));
+    if (l->line == NULL || l->len == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (l->n = 0; p < end; l->n++, p = q) {
+        if ((q = memchr(p, '\n', end - p)) == NULL)
+            q = end;
+        else
+            q++;
+        l->line[l->n] = p;
+        l->len[l->n] = q - p;
+    }
+}
+
+/*
+ * same_line - Are line i of a and line j of b the same?
+ */
+int same_line(struct lines *a, long i, struct lines *b, long j)
+{
+    return a->len[i] == b->len[j] &&
+           memcmp(a->line[i], b->line[j], a->len[i]) == 0;
+}
+
+/*
+ * classify - Number the distinct lines of n[0] lines of file 0 and n[1]
+ *            of file 1 from 1 up, so that equivs[f][i] is the number of
+ *            line first[f] + i of file f. Return how many there are.
+ */
+long classify(struct lines *l, long *first, long *n, long **equivs)
+{
+    long size = 1, nclasses = 0, *bucket, *next, *rep_line, i, k, h;
+    int f, *rep_file;
+
+    while (size < 2 * (n[0] + n[1]))
+        size *= 2;
+    bucket = malloc(size * sizeof(long));
+    next = malloc((n[0] + n[1] + 1) * sizeof(long));
+    rep_line = malloc((n[0] + n[1] + 1) * sizeof(long));
+    rep_file = malloc((n[0] + n[1] + 1) * sizeof(int));
+    if (bucket == NULL || next == NULL || rep_line == NULL ||
+        rep_file == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (h = 0; h < size; h++)
+        bucket[h] = 0;
+
+    for (f = 0; f < 2; f++) {
+        for (i = 0; i < n[f]; i++) {
+            unsigned long hash = 5381;
+            char *p = l[f].line[first[f] + i];
+            size_t len = l[f].len[first[f] + i];
+
+            while (len-- > 0)
+                hash = hash * 33 + (unsigned char)*p++;
+            h = hash & (size - 1);
+            for (k = bucket[h]; k != 0; k = next[k])
+                if (same_line(&l[f], first[f] + i,
+                              &l[rep_file[k]], rep_line[k]))
+                    break;
+            if (k == 0) {
+                k = ++nclasses;
+                rep_file[k] = f;
+                rep_line[k] = first[f] + i;
+                next[k] = bucket[h];
+                bucket[h] = k;
+            }
+            equivs[f][i] = k;
+        }
+    }
+    free(bucket);
+    free(next);
+    free(rep_line);
+    free(rep_file);
+    return nclasses;
+}
+
+/*
+ * discard_confusing_lines - Set aside the lines that cannot match a line
+ *            of the other file, and in long runs of those, lines that
+ *            match too many, marking them changed. What is left goes in
+ *            xvec and yvec.
+ */
+void discard_confusing_lines(long **equivs, long *n, long nclasses,
+                             long *nleft)
+{
+    long *counts[2], i, j, f, end, length, provisional, consec, minimum, tem;
+    unsigned long many;
+    char *discards[2], *d;
+
+    for (f = 0; f < 2; f++) {
+        counts[f] = calloc(nclasses + 1, sizeof(long));
+        discards[f] = calloc(n[f] + 1, 1);
+        if (counts[f] == NULL || discards[f] == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        for (i = 0; i < n[f]; i++)
+            counts[f][equivs[f][i]]++;
+    }
+
+    /* 1: matches nothing in the other file; 2: matches too many */
+    for (f = 0; f < 2; f++) {
+        d = discards[f];
+        many = 5;
+        for (tem = n[f] / 64; (tem = tem >> 2) > 0; )
+            many *= 2;
+        for (i = 0; i < n[f]; i++) {
+            long nmatch = counts[1 - f][equivs[f][i]];
+            if (nmatch == 0)
+                d[i] = 1;
+            else if ((unsigned long)nmatch > many)
+                d[i] = 2;
+        }
+    }
+
+    /* Keep the 2s only inside runs of discards that begin and end with 1s */
+    for (f = 0; f < 2; f++) {
+        d = discards[f];
+        end = n[f];
+        for (i = 0; i < end; i++) {
+            if (d[i] == 2)
+                d[i] = 0;
+            else if (d[i] != 0) {
+                provisional = 0;
+                for (j = i; j < end; j++) {
+                    if (d[j] == 0)
+                        break;
+                    if (d[j] == 2)
+                        ++provisional;
+                }
+                while (j > i && d[j - 1] == 2)
+                    d[--j] = 0, --provisional;
+                length = j - i;
+
+                if (provisional * 4 > length) {
+                    while (j > i)
+                        if (d[--j] == 2)
+                            d[j] = 0;
+                }
+                else {
+                    minimum = 1;
+                    for (tem = length >> 2; 0 < (tem >>= 2); )
+                        minimum <<= 1;
+                    minimum++;
+
+                    for (j = 0, consec = 0; j < length; j++)
+                        if (d[i + j] != 2)
+                            consec = 0;
+                        else if (minimum == ++consec)
+                            j -= consec;
+                        else if (minimum < consec)
+                            d[i + j] = 0;
+
+                    for (j = 0, consec = 0; j < length; j++) {
+                        if (j >= 8 && d[i + j] == 1)
+                            break;
+                        if (d[i + j] == 2)
+                            consec = 0, d[i + j] = 0;
+                        else if (d[i + j] == 0)
+                            consec = 0;
+                        else
+                            consec++;
+                        if (consec == 3)
+                            break;
+                    }
+
+                    i += length - 1;
+
+                    for (j = 0, consec = 0; j < length; j++) {
+                        if (j >= 8 && d[i - j] == 1)
+                            break;
+                        if (d[i - j] == 2)
+                            consec = 0, d[i - j] = 0;
+                        else if (d[i - j] == 0)
+                            consec = 0;
+                        else
+                            consec++;
+                        if (consec == 3)
+                            break;
+                    }
+                }
+            }
+        }
+    }
+
+    for (f = 0; f < 2; f++) {
+        long *vec = f ? yvec : xvec;
+        for (i = j = 0; i < n[f]; i++)
+            if (discards[f][i] == 0) {
+                vec[j] = equivs[f][i];
+                realindex[f][j++] = i;
+            }
+            else
+                changed[f][i] = 1;
+        nleft[f] = j;
+        free(counts[f]);
+        free(discards[f]);
+    }
+}
+
+/*
+ * diag - Find the midpoint of a shortest edit script for
+ *        xvec[xoff..xlim) and yvec[yoff..ylim), searching forward from
+ *        the start and backward from the end at once
+ */
+void diag(long xoff, long xlim, long yoff, long ylim, long *xmid, long *ymid)
+{
+    long dmin = xoff - ylim, dmax = xlim - yoff;
+    long fmid = xoff - yoff, bmid = xlim - ylim;
+    long fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    long d, x, y, tlo, thi, x0;
+    int odd = (fmid - bmid) & 1;
+
+    fdiag[fmid] = xoff;
+    bdiag[bmid] = xlim;
+
+    for (;;) {
+        /* Extend the forward search by one edit on each diagonal */
+        if (fmin > dmin)
+            fdiag[--fmin - 1] = -1;
+        else
+            ++fmin;
+        if (fmax < dmax)
+            fdiag[++fmax + 1] = -1;
+        else
+            --fmax;
+        for (d = fmax; d >= fmin; d -= 2) {
+            tlo = fdiag[d - 1];
+            thi = fdiag[d + 1];
+            x0 = tlo < thi ? thi : tlo + 1;
+            for (x = x0, y = x0 - d;
+                 x < xlim && y < ylim && xvec[x] == yvec[y]; x++, y++)
+                ;
+            fdiag[d] = x;
+            if (odd && bmin <= d && d <= bmax && bdiag[d] <= x) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+
+        /* And the backward search */
+        if (bmin > dmin)
+            bdiag[--bmin - 1] = LONG_MAX;
+        else
+            ++bmin;
+        if (bmax < dmax)
+            bdiag[++bmax + 1] = LONG_MAX;
+        else
+            --bmax;
+        for (d = bmax; d >= bmin; d -= 2) {
+            tlo = bdiag[d - 1];
+            thi = bdiag[d + 1];
+            x0 = tlo < thi ? tlo : thi - 1;
+            for (x = x0, y = x0 - d;
+                 xoff < x && yoff < y && xvec[x - 1] == yvec[y - 1]; x--, y--)
+                ;
+            bdiag[d] = x;
+            if (!odd && fmin <= d && d <= fmax && x <= fdiag[d]) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * compareseq - Mark the lines of a shortest edit script for
+ *              xvec[xoff..xlim) and yvec[yoff..ylim) changed
+ */
+void compareseq(long xoff, long xlim, long yoff, long ylim)
+{
+    long xmid, ymid;
+
+    while (xoff < xlim && yoff < ylim && xvec[xoff] == yvec[yoff])
+        xoff++, yoff++;
+    while (xoff < xlim && yoff < ylim && xvec[xlim - 1] == yvec[ylim - 1])
+        xlim--, ylim--;
+
+    if (xoff == xlim)
+        while (yoff < ylim)
+            changed[1][realindex[1][yoff++]] = 1;
+    else if (yoff == ylim)
+        while (xoff < xlim)
+            changed[0][realindex[0][xoff++]] = 1;
+    else {
+        diag(xoff, xlim, yoff, ylim, &xmid, &ymid);
+        compareseq(xoff, xmid, yoff, ymid);
+        compareseq(xmid, xlim, ymid, ylim);
+    }
+}
+
+/*
+ * shift_boundaries - Slide each run of changed lines back, and then
+ *            forward, over equal lines, to merge it with the runs next to
+ *            it and to line it up with a run in the other file
+ */
+void shift_boundaries(long **equivs, long *n)
+{
+    long i, j, i_end, runlength, start, corresponding;
+    char *chg, *other;
+    long *eq;
+    int f;
+
+    for (f = 0; f < 2; f++) {
+        chg = changed[f];
+        other = changed[1 - f];
+        eq = equivs[f];
+        i = j = 0;
+        i_end = n[f];
+
+        for (;;) {
+            /* Find the next run, and where the other file is there */
+            while (i < i_end && !chg[i]) {
+                while (other[j++])
+                    ;
+                i++;
+            }
+            if (i == i_end)
+                break;
+            start = i;
+            while (chg[++i])
+                ;
+            while (other[j])
+                j++;
+
+            do {
+                runlength = i - start;
+
+                while (start && eq[start - 1] == eq[i - 1]) {
+                    chg[--start] = 1;
+                    chg[--i] = 0;
+                    while (chg[start - 1])
+                        start--;
+                    while (other[--j])
+                        ;
+                }
+
+                corresponding = other[j - 1] ? i : i_end;
+
+                while (i != i_end && eq[start] == eq[i]) {
+                    chg[start++] = 0;
+                    chg[i++] = 1;
+                    while (chg[i])
+                        i++;
+                    while (other[++j])
+                        corresponding = i;
+                }
+            } while (runlength != i - start);
+
+            while (corresponding < i) {
+                chg[--start] = 1;
+                chg[--i] = 0;
+                while (other[--j])
+                    ;
+            }
+        }
+    }
+}
+
+/*
+ * print_range - Print lines first..last (1-based) the way diff does
+ */
+void print_range(long first, long last)
+{
+    if (last > first)
+        printf("%ld,%ld", first, last);
+    else
+        printf("%ld", last);
+}
+
+/*
+ * print_lines - Print n lines of l from line i, after a marker
+ */
+void print_lines(struct lines *l, long i, long n, char *marker)
+{
+    for (; n > 0; i++, n--) {
+        printf("%s", marker);
+        fwrite(l->line[i], 1, l->len[i], stdout);
+        if (l->line[i][l->len[i] - 1] != '\n')
+            printf("\n\\ No newline at end of file\n");
+    }
+}
+
+/*
+ * diff_outputs - Print the differences between outputs a and b in the
+ *                format of "diff a b"
+ */
+void diff_outputs(struct output *a, struct output *b)
+{
+    struct lines l[2];
+    long first[2], n[2], nleft[2], *equivs[2], *fd;
+    long prefix = 0, suffix = 0, nclasses, i0, i1, s0, s1;
+    int f;
+
+    split_lines(a, &l[0]);
+    split_lines(b, &l[1]);
+
+    /* Lines the same at both ends are never part of a change */
+    while (prefix < l[0].n && prefix < l[1].n &&
+           same_line(&l[0], prefix, &l[1], prefix))
+        prefix++;
+    while (suffix < l[0].n - prefix && suffix < l[1].n - prefix &&
+           same_line(&l[0], l[0].n - 1 - suffix, &l[1], l[1].n - 1 - suffix))
+        suffix++;
+    for (f = 0; f < 2; f++) {
+        first[f] = prefix;
+        n[f] = l[f].n - prefix - suffix;
+        equivs[f] = malloc((n[f] + 1) * sizeof(long));
+        realindex[f] = malloc((n[f] + 1) * sizeof(long));
+        changed[f] = calloc(n[f] + 2, 1);
+        if (equivs[f] == NULL || realindex[f] == NULL || changed[f] == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        changed[f]++;           /* changed[f][-1] and [n[f]] stay 0 */
+    }
+    xvec = malloc((n[0] + 1) * sizeof(long));
+    yvec = malloc((n[1] + 1) * sizeof(long));
+    fd = malloc(2 * (n[0] + n[1] + 3) * sizeof(long));
+    if (xvec == NULL || yvec == NULL || fd == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    fdiag = fd + n[1] + 1;
+    bdiag = fdiag + n[0] + n[1] + 3;
+
+    nclasses = classify(l, first, n, equivs);
+    discard_confusing_lines(equivs, n, nclasses, nleft);
+    compareseq(0, nleft[0], 0, nleft[1]);
+    shift_boundaries(equivs, n);
+
+    /* Print each run of changes in a hunk */
+    i0 = i1 = 0;
+    while (i0 < n[0] || i1 < n[1]) {
+        if (!changed[0][i0] && !changed[1][i1]) {
+            i0++, i1++;
+            continue;
+        }
+        s0 = i0;
+        s1 = i1;
+        while (changed[0][i0])
+            i0++;
+        while (changed[1][i1])
+            i1++;
+        print_range(prefix + s0 + 1, prefix + i0);
+        printf("%c", i0 == s0 ? 'a' : i1 == s1 ? 'd' : 'c');
+        print_range(prefix + s1 + 1, prefix + i1);
+        printf("\n");
+        print_lines(&l[0], prefix + s0, i0 - s0, "< ");
+        if (i0 > s0 && i1 > s1)
+            printf("---\n");
+        print_lines(&l[1], prefix + s1, i1 - s1, "> ");
+    }
+
+    for (f = 0; f < 2; f++) {
+        free(l[f].line);
+        free(l[f].len);
+        free(equivs[f]);
+        free(realindex[f]);
+        free(changed[f] - 1);
+    }
+    free(xvec);
+    free(yvec);
+    free(fd);
 }
 
 /* 
@@ -375,13 +1560,22 @@ void delete_tmpfiles()
  */
 void usage(void) 
 {
-    printf("Usage: sdriver [-hV] [-s <shell> -t <tracenum> -i <iters>]\n");
+    printf("Usage: sdriver [-hV] [-s <shell> -t <tracenum> -i <iters> -j <jobs>]"
+           " [--refresh-ref]\n"
+           "               [--times] [--json <file>] [--junit <file>]\n");
     printf("Options\n");
     printf("\t-h           Print this message.\n");
     printf("\t-i <iters>   Run each trace <iters> times (default %d)\n", 
            num_iters);
+    printf("\t-j <jobs>    Run <jobs> traces at once, 0 for one per CPU"
+           " (default 1)\n");
     printf("\t-s <shell>   Name of test shell (default ./tsh)\n");
     printf("\t-t <n>       Run trace <n> only (default all)\n");
     printf("\t-V           Be more verbose.\n");
+    printf("\t--refresh-ref Rerun ./tshref instead of using its outputs"
+           " cached in %s\n", REFCACHE);
+    printf("\t--times       Print the wall and CPU times of each trace\n");
+    printf("\t--json <file> Write the results and times as JSON\n");
+    printf("\t--junit <file> Write the results and times as JUnit XML\n");
     exit(0);
 }
@@ -0,0 +1,369 @@
+/*
+ * shellbench.c - End-to-end command throughput and latency of the shell
+ *
+ * Drives a shell the way runtrace does, over a SOCK_SEQPACKET socketpair
+ * on its stdin and stdout, with n copies of each workload: a foreground
+ * /bin/true, a foreground ./myenv and a background /bin/true. With the
+ * prompt on (the default), each command is sent when the shell prints
+ * "tsh> ", found as runtrace finds it: PROMPT starting a message or a
+ * line and ending a message, perhaps split over several. A command's
+ * latency is the time from sending it to the next prompt; the report gives commands per second and the latency
+ * percentiles. With -p the shell runs without a prompt, the commands are
+ * sent as fast as the shell takes them, and only the throughput, up to
+ * the shell exiting at EOF, is reported.
+ *
+ * The fork.c wrapper's random delay is turned off (TSH_FORK_DELAY=0)
+ * unless -d is given. It can only be turned off in a shell linked with
+ * this tree's fork.c; tshref keeps whatever it was built with.
+ *
+ * Usage: shellbench [-h] [-p] [-d] [-n count] [-w workload ...]
+ *                   [-s shell ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#define MAXSHELLS 8
+#define MAXBUF 8192
+#define PROMPT "tsh> "
+#define TIMEOUT_MS 10000    /* Longest wait for the shell to answer */
+
+/* The workloads */
+struct workload {
+    char *name;
+    char *cmdline;
+};
+struct workload workloads[] = {
+    {"true", "/bin/true\n"},
+    {"myenv", "./myenv\n"},
+    {"bg", "/bin/true &\n"},
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+/* Global variables */
+long ncmds = 500;           /* Commands per workload (-n) */
+int noprompt = 0;           /* Run the shell without a prompt (-p) */
+int fork_delay = 0;         /* Keep the fork.c delay (-d) */
+
+char *msgbuf;               /* The last message from the shell */
+size_t msgbuf_size;
+size_t prompt_match;        /* Bytes of PROMPT seen at the end of output */
+
+void usage(void);
+
+/*
+ * now - Monotonic time in seconds
+ */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * cmpdouble - qsort comparator for doubles
+ */
+int cmpdouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * percentile - Nearest-rank percentile p of the n sorted values in v
+ */
+double percentile(double *v, long n, double p)
+{
+    long i = (long)(p * n + 0.999999) - 1;
+
+    return v[i < 0 ? 0 : i >= n ? n - 1 : i];
+}
+
+/*
+ * start_shell - Run shell on one end of a new socketpair, return the other
+ */
+int start_shell(char *shell, pid_t *pidp)
+{
+    int fd[2], devnull;
+
+    if (socketpair(AF_LOCAL, SOCK_SEQPACKET, 0, fd) < 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    if ((*pidp = fork()) < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (*pidp == 0) {
+        devnull = open("/dev/null", O_WRONLY);
+        dup2(fd[1], 0);
+        dup2(fd[1], 1);
+        dup2(devnull, 2);
+        close(fd[0]);
+        close(fd[1]);
+        if (!fork_delay)
+            setenv("TSH_FORK_DELAY", "0", 1);
+        if (noprompt)
+            execl(shell, shell, "-p", (char *)NULL);
+        else
+            execl(shell, shell, (char *)NULL);
+        perror("execl");
+        exit(1);
+    }
+    close(fd[1]);
+    prompt_match = 0;
+    return fd[0];
+}
+
+/*
+ * recv_message - Receive the next message from the shell into msgbuf,
+ * however long it is, and return its length, or 0 at EOF
+ */
+ssize_t recv_message(int fd)
+{
+    ssize_t n;
+
+    if ((n = recv(fd, NULL, 0, MSG_PEEK | MSG_TRUNC)) < 0) {
+        perror("recv");
+        exit(1);
+    }
+    if ((size_t)n > msgbuf_size) {
+        msgbuf_size = n;
+        if ((msgbuf = realloc(msgbuf, msgbuf_size)) == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    if ((n = recv(fd, msgbuf, n, 0)) < 0) {
+        perror("recv");
+        exit(1);
+    }
+    return n;
+}
+
+/*
+ * scan_prompt - Scan a message as part of the shell's output stream and
+ * return 1 if it ends with a prompt, the way runtrace's scan_output does
+ */
+int scan_prompt(const char *msg, size_t len)
+{
+    size_t plen = strlen(PROMPT), i = 0;
+    int line_start = prompt_match == 0;
+
+    while (i < len) {
+        if (prompt_match > 0 || line_start) {
+            if (msg[i] == PROMPT[prompt_match]) {
+                if (++prompt_match == plen) {
+                    prompt_match = 0;
+                    if (i == len - 1)
+                        return 1;
+                    line_start = 0;     /* Not the end: not a prompt */
+                }
+                i++;
+                continue;
+            }
+            if (prompt_match > 0) {
+                prompt_match = 0;       /* Look at msg[i] again */
+                line_start = i == 0;
+                continue;
+            }
+        }
+        line_start = msg[i++] == '\n';
+    }
+    return 0;
+}
+
+/*
+ * wait_prompt - Read the shell's output up to the next prompt
+ */
+void wait_prompt(int fd, char *shell)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    ssize_t n;
+
+    for (;;) {
+        if (poll(&pfd, 1, TIMEOUT_MS) <= 0) {
+            printf("%s: no prompt after %d ms\n", shell, TIMEOUT_MS);
+            exit(1);
+        }
+        if ((n = recv_message(fd)) == 0) {
+            printf("%s: exited before the prompt\n", shell);
+            exit(1);
+        }
+        if (scan_prompt(msgbuf, n))
+            return;
+    }
+}
+
+/*
+ * stream - Send every command without waiting for the shell, then EOF
+ * (a shutdown, as runtrace sends it), reading its output all the while
+ * so that neither side blocks
+ */
+void stream(int fd, char *cmdline, pid_t pid, char *shell)
+{
+    char buf[MAXBUF];
+    size_t len = strlen(cmdline);
+    struct pollfd pfd = {fd, 0, 0};
+    long sent = 0;
+    double idle = now();
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    for (;;) {
+        pfd.events = POLLIN | (sent < ncmds ? POLLOUT : 0);
+        if (poll(&pfd, 1, 10) > 0) {
+            idle = now();
+            if (pfd.revents & POLLIN)
+                while (recv(fd, buf, sizeof(buf), MSG_TRUNC) > 0)
+                    ;
+            if ((pfd.revents & POLLOUT) && sent < ncmds &&
+                send(fd, cmdline, len, 0) >= 0 && ++sent == ncmds)
+                shutdown(fd, SHUT_WR);
+        }
+        if (sent == ncmds && waitpid(pid, NULL, WNOHANG) == pid)
+            return;
+        if (now() - idle > TIMEOUT_MS / 1e3) {
+            printf("%s: stuck after %ld commands\n", shell, sent);
+            exit(1);
+        }
+    }
+}
+
+/*
+ * run - Run one workload through shell and print its line of the report
+ */
+void run(char *shell, struct workload *w)
+{
+    double *lat, start, end, t;
+    int fd, status;
+    size_t len = strlen(w->cmdline);
+    pid_t pid;
+    long i;
+
+    if ((lat = malloc(ncmds * sizeof(double))) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    fd = start_shell(shell, &pid);
+
+    if (noprompt) {
+        start = now();
+        stream(fd, w->cmdline, pid, shell);
+        end = now();
+        printf("%-12s %-6s %10.0f\n", shell, w->name,
+               ncmds / (end - start));
+    } else {
+        wait_prompt(fd, shell);
+        start = now();
+        for (i = 0; i < ncmds; i++) {
+            t = now();
+            if (send(fd, w->cmdline, len, 0) < 0) {
+                perror("send");
+                exit(1);
+            }
+            wait_prompt(fd, shell);
+            lat[i] = now() - t;
+        }
+        end = now();
+        shutdown(fd, SHUT_WR);  /* EOF */
+        waitpid(pid, &status, 0);
+
+        qsort(lat, ncmds, sizeof(double), cmpdouble);
+        printf("%-12s %-6s %10.0f %9.3f %9.3f %9.3f %9.3f\n", shell,
+               w->name, ncmds / (end - start),
+               percentile(lat, ncmds, 0.50) * 1e3,
+               percentile(lat, ncmds, 0.90) * 1e3,
+               percentile(lat, ncmds, 0.99) * 1e3, lat[ncmds - 1] * 1e3);
+    }
+    fflush(stdout);
+    close(fd);
+    free(lat);
+}
+
+int main(int argc, char **argv)
+{
+    char *shells[MAXSHELLS];
+    int selected[NWORKLOADS] = {0};
+    int c, i, nshells = 0, nselected = 0;
+    size_t w;
+
+    signal(SIGPIPE, SIG_IGN);
+    while ((c = getopt(argc, argv, "hpdn:w:s:")) != EOF) {
+        switch (c) {
+        case 'p':
+            noprompt = 1;
+            break;
+        case 'd':
+            fork_delay = 1;
+            break;
+        case 'n':
+            ncmds = atol(optarg);
+            break;
+        case 'w':
+            for (w = 0; w < NWORKLOADS; w++)
+                if (strcmp(optarg, workloads[w].name) == 0)
+                    break;
+            if (w == NWORKLOADS)
+                usage();
+            selected[w] = 1;
+            nselected++;
+            break;
+        case 's':
+            if (nshells < MAXSHELLS)
+                shells[nshells++] = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (ncmds < 1)
+        usage();
+    if (nshells == 0) {
+        shells[nshells++] = "./tsh";
+        shells[nshells++] = "./tshref";
+    }
+
+    printf("%ld commands per workload, prompt %s, fork delay %s\n", ncmds,
+           noprompt ? "off" : "on", fork_delay ? "on" : "off");
+    if (noprompt)
+        printf("%-12s %-6s %10s\n", "shell", "load", "cmds/s");
+    else
+        printf("%-12s %-6s %10s %9s %9s %9s %9s\n", "shell", "load",
+               "cmds/s", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (i = 0; i < nshells; i++)
+        for (w = 0; w < NWORKLOADS; w++)
+            if (nselected == 0 || selected[w])
+                run(shells[i], &workloads[w]);
+    exit(0);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+void usage(void)
+{
+    size_t w;
+
+    printf("Usage: shellbench [-h] [-p] [-d] [-n count] [-w workload ...]"
+           " [-s shell ...]\n");
+    printf("Options\n");
+    printf("\t-h             Print this message.\n");
+    printf("\t-p             Run the shell without a prompt (throughput only)\n");
+    printf("\t-d             Keep the fork.c delay in the shell\n");
+    printf("\t-n <count>     Commands per workload (default %ld)\n", ncmds);
+    printf("\t-w <workload>  Workload to run; repeatable (default all):\n");
+    for (w = 0; w < NWORKLOADS; w++)
+        printf("\t                 %-6s %s", workloads[w].name,
+               workloads[w].cmdline);
+    printf("\t-s <shell>     Shell to test; repeatable (default ./tsh ./tshref)\n");
+    exit(0);
+}
@@ -0,0 +1,143 @@
+/*
+ * spawnbench.c - Spawn latency of fork and of the tsh zygote
+ *
+ * Starts a zygote, then grows its own resident set in steps, as a shell
+ * does when its history and caches fill up. At each size it times
+ * spawning /bin/true and waiting for it, once with fork+execve from this
+ * process and once through the zygote, which was forked while this
+ * process was still small.
+ *
+ * Usage: spawnbench [-h] [-m MB,...] [-n spawns]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "tsh_zygote.h"
+
+/* Global variables */
+char *sizelist = "0,64,256,1024"; /* Resident set sizes in MB (-m) */
+int nspawn = 200;               /* Spawns timed per size and method (-n) */
+char *true_argv[] = {"/bin/true", NULL};
+extern char **environ;
+
+void usage(void);
+
+/*
+ * now - Monotonic time in seconds
+ */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * cmpdouble - qsort comparator for doubles
+ */
+int cmpdouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * spawn - Start /bin/true with fork or the zygote, wait for it, and
+ *    return the elapsed time in seconds
+ */
+double spawn(int use_zygote)
+{
+    double start = now();
+    pid_t pid;
+    int status;
+
+    if (use_zygote) {
+        pid = zygote_spawn(true_argv, NULL, 0);
+    } else if ((pid = fork()) == 0) {
+        execve(true_argv[0], true_argv, environ);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || status != 0) {
+        printf("error: spawn failed\n");
+        exit(1);
+    }
+    return now() - start;
+}
+
+/*
+ * median_us - Median of nspawn spawns, in microseconds
+ */
+double median_us(int use_zygote, double *t)
+{
+    int i;
+
+    for (i = 0; i < nspawn; i++)
+        t[i] = spawn(use_zygote);
+    qsort(t, nspawn, sizeof(double), cmpdouble);
+    return t[nspawn / 2] * 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    char *tok, *list, *mem = NULL;
+    size_t size = 0, target;
+    double *t, f, z;
+    int c;
+
+    while ((c = getopt(argc, argv, "hm:n:")) != EOF) {
+        switch (c) {
+        case 'm': sizelist = optarg; break;
+        case 'n': nspawn = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (nspawn < 1)
+        usage();
+    if ((t = malloc(nspawn * sizeof(double))) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    zygote_start();
+    spawn(0);                           /* warm up */
+    spawn(1);
+
+    printf("%8s %12s %12s %9s\n", "RSS(MB)", "fork(us)", "zygote(us)",
+           "speedup");
+    list = strdup(sizelist);
+    for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        /* Grow the resident set; memset touches every page */
+        target = strtoul(tok, NULL, 0) << 20;
+        if (target > size) {
+            if ((mem = realloc(mem, target)) == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+            memset(mem + size, 1, target - size);
+            size = target;
+        }
+        f = median_us(0, t);
+        z = median_us(1, t);
+        printf("%8s %12.1f %12.1f %8.2fx\n", tok, f, z, f / z);
+    }
+    exit(0);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+void usage(void)
+{
+    printf("Usage: spawnbench [-h] [-m MB,...] [-n spawns]\n");
+    printf("Options\n");
+    printf("\t-m <list>    Comma separated resident set sizes in MB"
+           " (default %s)\n", sizelist);
+    printf("\t-n <n>       Spawns timed per size and method (default %d)\n",
+           nspawn);
+    exit(0);
+}
@@ -0,0 +1,255 @@
+/*
+ * stressgen.c - Stress trace generator for the shell's job control
+ *
+ * Writes a trace in the runtrace language that puts far more load on
+ * the job list and sigchld_handler than trace00-trace24 do:
+ *
+ *   exit storms    n background ./myspin1 jobs are started and synced
+ *                  with, then all released by n back-to-back SIGNALs so
+ *                  that they exit at once (repeated r times)
+ *   signal storms  b bursts of k SIGTSTPs at a foreground job, which is
+ *                  then resumed in the background and released, and of
+ *                  k SIGINTs at another foreground job
+ *   fg/bg churn    c ./mytstps jobs that stop themselves, then resumed
+ *                  alternately with fg and bg
+ *
+ * After each phase the trace waits for the background jobs with the wait
+ * builtin (or, with -w, by running /bin/sleep for shells without it),
+ * and it ends by listing the jobs, which should be none. The header
+ * records how many "stopped" and "terminated" messages the shell should
+ * print; stressreport runs the trace and checks them.
+ *
+ * fg and bg need job ids, which the generator predicts the way the job
+ * list assigns them, so -m must match the MAXJOBS of the shell under test.
+ * Hundreds of jobs need a shell built with a larger MAXJOBS, such as
+ * tshstress ("make tshstress").
+ *
+ * Usage: stressgen [-h] [-n jobs] [-r rounds] [-b bursts] [-k signals]
+ *                  [-c jobs] [-m maxjobs] [-w secs] [-o file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+/* Global variables */
+int njobs = 200;            /* Jobs per exit storm (-n) */
+int rounds = 3;             /* Exit storms (-r) */
+int bursts = 20;            /* Signal bursts of each kind (-b) */
+int burst_len = 4;          /* Signals per burst (-k) */
+int churn = 100;            /* Jobs in the fg/bg churn (-c) */
+int maxjobs = 1024;         /* MAXJOBS of the shell, to predict jids (-m) */
+int sleep_secs = 0;         /* Settle with /bin/sleep, not wait (-w) */
+char *outfile = NULL;       /* Trace file (-o, default stdout) */
+
+int nextjid = 1;            /* Next job id the shell will assign */
+char *live;                 /* live[jid] is set while the job is listed */
+int nstopped;               /* "stopped by signal" messages expected */
+int nterminated;            /* "terminated by signal" messages expected */
+FILE *out;
+
+void usage(void);
+
+/*
+ * spawn - Emit a command line that creates a job, return its job id
+ */
+int spawn(const char *cmdline)
+{
+    int jid = nextjid++;
+
+    if (nextjid > maxjobs)
+        nextjid = 1;
+    live[jid] = 1;
+    fprintf(out, "%s\n", cmdline);
+    return jid;
+}
+
+/*
+ * done - Note that job jid has been deleted; like deletejob, the shell
+ * then gives the next job the id after the largest one in use
+ */
+void done(int jid)
+{
+    live[jid] = 0;
+    for (nextjid = maxjobs; nextjid > 0 && !live[nextjid]; nextjid--)
+        ;
+    nextjid++;
+}
+
+/*
+ * settle - Emit commands that wait until no background job is running,
+ * which must leave none in the job list
+ */
+void settle(void)
+{
+    char cmd[64];
+    int jid;
+
+    if (sleep_secs > 0) {
+        snprintf(cmd, sizeof(cmd), "/bin/sleep %d", sleep_secs);
+        done(spawn(cmd));
+    } else
+        fprintf(out, "wait\n");
+    fprintf(out, "NEXT\n\n");
+    for (jid = 1; jid <= maxjobs; jid++)
+        if (live[jid])
+            done(jid);
+}
+
+/*
+ * repeat - Emit a runtrace directive n times
+ */
+void repeat(const char *directive, int n)
+{
+    while (n-- > 0)
+        fprintf(out, "%s\n", directive);
+}
+
+/*
+ * exit_storm - n background jobs, all released at once
+ */
+void exit_storm(int round)
+{
+    int i;
+
+    fprintf(out, "# stress: exit storm %d, %d jobs\n", round, njobs);
+    for (i = 0; i < njobs; i++) {
+        spawn("./myspin1 &");
+        fprintf(out, "NEXT\nWAIT\n");
+    }
+    repeat("SIGNAL", njobs);
+    settle();
+}
+
+/*
+ * signal_storm - Bursts of SIGTSTP and SIGINT at foreground jobs
+ */
+void signal_storm(void)
+{
+    int i, jid;
+
+    fprintf(out, "# stress: signal storm, %d bursts of %d\n", bursts,
+            burst_len);
+    for (i = 0; i < bursts; i++) {
+        jid = spawn("./myspin1");
+        fprintf(out, "WAIT\n");
+        repeat("SIGTSTP", burst_len);
+        fprintf(out, "NEXT\nbg %%%d\nNEXT\nSIGNAL\n", jid);
+        nstopped++;
+        settle();
+
+        jid = spawn("./myspin1");
+        fprintf(out, "WAIT\n");
+        repeat("SIGINT", burst_len);
+        fprintf(out, "NEXT\n");
+        done(jid);
+        nterminated++;
+    }
+}
+
+/*
+ * churn_jobs - Jobs that stop themselves, resumed alternately in fg and bg
+ */
+void churn_jobs(void)
+{
+    int *jids, i;
+
+    if ((jids = malloc(churn * sizeof(int))) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    fprintf(out, "# stress: fg/bg churn, %d jobs\n", churn);
+    for (i = 0; i < churn; i++) {
+        jids[i] = spawn("./mytstps");
+        fprintf(out, "NEXT\n");
+        nstopped++;
+    }
+    for (i = 0; i < churn; i++)
+        fprintf(out, "%s %%%d\nNEXT\n", i % 2 ? "bg" : "fg", jids[i]);
+    settle();
+    free(jids);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *body;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "hn:r:b:k:c:m:w:o:")) != EOF) {
+        switch (c) {
+        case 'n': njobs = atoi(optarg); break;
+        case 'r': rounds = atoi(optarg); break;
+        case 'b': bursts = atoi(optarg); break;
+        case 'k': burst_len = atoi(optarg); break;
+        case 'c': churn = atoi(optarg); break;
+        case 'm': maxjobs = atoi(optarg); break;
+        case 'w': sleep_secs = atoi(optarg); break;
+        case 'o': outfile = optarg; break;
+        default: usage();
+        }
+    }
+    if (njobs < 0 || rounds < 0 || bursts < 0 || burst_len < 1 ||
+        churn < 0 || maxjobs < 1 || njobs > maxjobs || churn > maxjobs)
+        usage();
+
+    if ((live = calloc(maxjobs + 1, 1)) == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    body = stdout;
+    if (outfile != NULL && (body = fopen(outfile, "w")) == NULL) {
+        perror(outfile);
+        exit(1);
+    }
+
+    /* The phases go to a temporary file first, so that the header can
+       give the expected counts */
+    if ((out = tmpfile()) == NULL) {
+        perror("tmpfile");
+        exit(1);
+    }
+    for (i = 1; i <= rounds; i++)
+        exit_storm(i);
+    if (bursts > 0)
+        signal_storm();
+    if (churn > 0)
+        churn_jobs();
+    fprintf(out, "# stress: final jobs\njobs\nNEXT\n# stress: end\n\nquit\n");
+
+    fprintf(body, "#\n# stress trace - stressgen -n %d -r %d -b %d -k %d "
+            "-c %d -m %d -w %d\n", njobs, rounds, bursts, burst_len, churn,
+            maxjobs, sleep_secs);
+    fprintf(body, "# expect stopped=%d terminated=%d\n#\n", nstopped,
+            nterminated);
+    rewind(out);
+    while ((c = getc(out)) != EOF)
+        putc(c, body);
+    fclose(out);
+    if (fclose(body) != 0) {
+        perror(outfile ? outfile : "stdout");
+        exit(1);
+    }
+    exit(0);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+void usage(void)
+{
+    printf("Usage: stressgen [-h] [-n jobs] [-r rounds] [-b bursts]"
+           " [-k signals] [-c jobs]\n"
+           "                 [-m maxjobs] [-w secs] [-o file]\n");
+    printf("Options\n");
+    printf("\t-h             Print this message\n");
+    printf("\t-n <jobs>      Jobs per exit storm (default %d)\n", njobs);
+    printf("\t-r <rounds>    Number of exit storms (default %d)\n", rounds);
+    printf("\t-b <bursts>    SIGTSTP and SIGINT bursts (default %d)\n",
+           bursts);
+    printf("\t-k <signals>   Signals per burst (default %d)\n", burst_len);
+    printf("\t-c <jobs>      Jobs in the fg/bg churn (default %d)\n", churn);
+    printf("\t-m <maxjobs>   MAXJOBS of the shell (default %d)\n", maxjobs);
+    printf("\t-w <secs>      Settle with /bin/sleep instead of wait\n");
+    printf("\t-o <file>      Write the trace to file (default stdout)\n");
+    exit(0);
+}
@@ -0,0 +1,342 @@
+/*
+ * stressreport.c - Run a stressgen trace and report on reaping
+ *
+ * Runs ./runtrace on a trace written by stressgen, with the shell's
+ * event trace ($TSH_TRACE_FILE) turned on and the fork.c delay turned
+ * off (unless -d), and reports
+ *
+ *   correctness  the "stopped" and "terminated" messages against the
+ *                counts in the trace header, jobs left over at the end,
+ *                "Tried to create too many jobs" and driver timeouts, and
+ *                from the event trace, jobs added twice, deleted without
+ *                being added, reaped outside the job list or never deleted
+ *   reaping      how many times sigchld_handler ran and how many children
+ *                each run reaped; the reap latency, from the start of the
+ *                handler to the wait that returned the child; and the
+ *                time per reap against the number of jobs in the list,
+ *                which shows how the list lookups scale
+ *
+ * The latency is measured from the handler starting, not from the child
+ * exiting, which the shell cannot see. Shells without the event trace
+ * (tshref) get only the checks on their output. It exits with status 1
+ * if any check fails.
+ *
+ * Usage: stressreport [-h] [-v] [-d] [-s shell] [-t tracefile] stressfile
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "tsh_trace.h"
+
+#define MAXLINE 1024
+#define NBUCKETS 5
+
+/* Global variables */
+int verbose = 0;            /* Echo the driver's output (-v) */
+int fork_delay = 0;         /* Keep the fork.c delay (-d) */
+char *shell = "./tsh";      /* Shell to run (-s) */
+char *ringfile = NULL;      /* Keep the event trace in this file (-t) */
+int failed = 0;             /* A check failed */
+
+/* Job list sizes the time per reap is broken down by */
+static const int bucket_max[NBUCKETS] = {15, 63, 255, 1023, 1 << 30};
+
+void usage(void);
+
+/*
+ * check - Print the result of one check
+ */
+void check(const char *what, long got, long want)
+{
+    printf("  %-28s %8ld %8ld   %s\n", what, got, want,
+           got == want ? "ok" : "FAIL");
+    if (got != want)
+        failed = 1;
+}
+
+/*
+ * cmplong - qsort comparator for longs
+ */
+int cmplong(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * pct - Nearest-rank percentile p of the n sorted values in v
+ */
+long pct(long *v, long n, double p)
+{
+    long i = (long)(p * n + 0.999999) - 1;
+
+    return n == 0 ? 0 : v[i < 0 ? 0 : i >= n ? n - 1 : i];
+}
+
+/*
+ * run_driver - Run runtrace on the stress trace, checking its output
+ */
+void run_driver(char *stressfile, char *ring)
+{
+    char line[MAXLINE];
+    int want_stopped = -1, want_terminated = -1;
+    long stopped = 0, terminated = 0, leftover = 0, toomany = 0, timeouts = 0;
+    int fd[2], in_final = 0, status;
+    struct timespec start, end;
+    FILE *fp;
+    pid_t pid;
+
+    /* The expected counts are in the header stressgen writes */
+    if ((fp = fopen(stressfile, "r")) == NULL) {
+        perror(stressfile);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp) && line[0] == '#')
+        sscanf(line, "# expect stopped=%d terminated=%d", &want_stopped,
+               &want_terminated);
+    fclose(fp);
+    if (want_stopped < 0 || want_terminated < 0) {
+        fprintf(stderr, "%s: not a stressgen trace\n", stressfile);
+        exit(1);
+    }
+
+    if (pipe(fd) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((pid = fork()) == 0) {
+        dup2(fd[1], 1);
+        close(fd[0]);
+        close(fd[1]);
+        setenv("TSH_TRACE_FILE", ring, 1);
+        setenv("TSH_TRACE_RECORDS", "262144", 1);
+        if (!fork_delay)
+            setenv("TSH_FORK_DELAY", "0", 1);
+        execl("./runtrace", "./runtrace", "-f", stressfile, "-s", shell,
+              (char *)NULL);
+        perror("./runtrace");
+        exit(1);
+    }
+    close(fd[1]);
+    fp = fdopen(fd[0], "r");
+    while (fgets(line, sizeof(line), fp)) {
+        if (verbose)
+            fputs(line, stdout);
+        if (strstr(line, ") stopped by signal"))
+            stopped++;
+        else if (strstr(line, ") terminated by signal"))
+            terminated++;
+        else if (strstr(line, "Tried to create too many jobs"))
+            toomany++;
+        else if (strstr(line, "timed out"))
+            timeouts++;
+        if (strncmp(line, "# stress: final jobs", 20) == 0)
+            in_final = 1;
+        else if (strncmp(line, "# stress: end", 13) == 0)
+            in_final = 0;
+        else if (in_final)
+            leftover++;
+    }
+    fclose(fp);
+    waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%s on %s: %.2f s\n", stressfile, shell,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    printf("  %-28s %8s %8s\n", "check", "got", "want");
+    check("driver exit status", WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+          0);
+    check("driver timeouts", timeouts, 0);
+    check("too many jobs", toomany, 0);
+    check("stopped messages", stopped, want_stopped);
+    check("terminated messages", terminated, want_terminated);
+    check("jobs left at the end", leftover, 0);
+}
+
+/*
+ * find_pid - Index of pid among the n live pids, or -1
+ */
+long find_pid(const pid_t *live, long n, pid_t pid)
+{
+    long i;
+
+    for (i = 0; i < n; i++)
+        if (live[i] == pid)
+            return i;
+    return -1;
+}
+
+/*
+ * analyze - Report on reaping from the shell's event trace
+ */
+void analyze(char *ring)
+{
+    struct trace_header h;
+    struct trace_record *recs, *r;
+    long *lat, nlat = 0, nlive = 0, maxlive = 0, i, j;
+    long handlers = 0, batch = 0, maxbatch = 0, sigint = 0, sigtstp = 0;
+    long added = 0, deleted = 0, dup_add = 0, bad_delete = 0, stray = 0;
+    double cost[NBUCKETS] = {0};
+    long ncost[NBUCKETS] = {0};
+    int64_t handler_start = 0, prev = 0;
+    uint64_t first, seq;
+    pid_t *live;
+    size_t n;
+    FILE *fp;
+
+    if ((fp = fopen(ring, "r")) == NULL ||
+        fread(&h, sizeof(h), 1, fp) != 1 ||
+        memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0 ||
+        h.nrecords == 0) {
+        printf("no event trace from %s; reaping not measured\n", shell);
+        if (fp != NULL)
+            fclose(fp);
+        return;
+    }
+    recs = malloc(h.nrecords * sizeof(*recs));
+    lat = malloc(h.nrecords * sizeof(*lat));
+    live = malloc(h.nrecords * sizeof(*live));
+    if (recs == NULL || lat == NULL || live == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    fseek(fp, TRACE_HDRSIZE, SEEK_SET);
+    n = fread(recs, sizeof(*recs), h.nrecords, fp);
+    fclose(fp);
+
+    first = h.head > h.nrecords ? h.head - h.nrecords : 0;
+    if (first > 0)
+        printf("event trace overflowed: %llu of %llu events lost\n",
+               (unsigned long long)first, (unsigned long long)h.head);
+    for (seq = first; seq < h.head; seq++) {
+        r = &recs[seq % h.nrecords];
+        if (seq % h.nrecords >= n || r->seq != seq + 1)
+            continue;
+        switch (r->kind) {
+        case TRACE_ADDJOB:
+            added++;
+            if (find_pid(live, nlive, r->pid) >= 0)
+                dup_add++;
+            else
+                live[nlive++] = r->pid;
+            if (nlive > maxlive)
+                maxlive = nlive;
+            break;
+        case TRACE_DELETEJOB:
+            deleted++;
+            if ((i = find_pid(live, nlive, r->pid)) < 0)
+                bad_delete++;
+            else
+                live[i] = live[--nlive];
+            break;
+        case TRACE_SIGCHLD:
+            handlers++;
+            handler_start = prev = r->time;
+            batch = 0;
+            break;
+        case TRACE_REAP:
+            if (r->jid == 0)
+                stray++;
+            lat[nlat++] = r->time - handler_start;
+            for (j = 0; nlive > bucket_max[j]; j++)
+                ;
+            cost[j] += r->time - prev;
+            ncost[j]++;
+            prev = r->time;
+            if (++batch > maxbatch)
+                maxbatch = batch;
+            break;
+        case TRACE_SIGINT:
+            sigint++;
+            break;
+        case TRACE_SIGTSTP:
+            sigtstp++;
+            break;
+        }
+    }
+
+    check("jobs added twice", dup_add, 0);
+    check("jobs deleted but not added", bad_delete, 0);
+    check("children outside job list", stray, 0);
+    check("jobs never deleted", nlive, 0);
+
+    printf("jobs: %ld added, %ld deleted, %ld at most at once\n", added,
+           deleted, maxlive);
+    printf("sigchld_handler: %ld runs, %ld reaps, %.2f per run (max %ld)\n",
+           handlers, nlat, handlers ? (double)nlat / handlers : 0.0,
+           maxbatch);
+    printf("signal handlers: %ld SIGINT, %ld SIGTSTP\n", sigint, sigtstp);
+    qsort(lat, nlat, sizeof(long), cmplong);
+    printf("reap latency (us): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           pct(lat, nlat, 0.50) / 1e3, pct(lat, nlat, 0.90) / 1e3,
+           pct(lat, nlat, 0.99) / 1e3, nlat ? lat[nlat - 1] / 1e3 : 0.0);
+    printf("time per reap by jobs in the list:\n");
+    for (j = 0; j < NBUCKETS; j++) {
+        if (ncost[j] == 0)
+            continue;
+        if (j + 1 < NBUCKETS)
+            printf("  %4d-%-4d", j ? bucket_max[j - 1] + 1 : 0, bucket_max[j]);
+        else
+            printf("  %4d+    ", bucket_max[j - 1] + 1);
+        printf(" %8.1f us  (%ld reaps)\n", cost[j] / ncost[j] / 1e3,
+               ncost[j]);
+    }
+    free(recs);
+    free(lat);
+    free(live);
+}
+
+int main(int argc, char **argv)
+{
+    char tmpring[64];
+    char *ring;
+    int c;
+
+    while ((c = getopt(argc, argv, "hvds:t:")) != EOF) {
+        switch (c) {
+        case 'v': verbose = 1; break;
+        case 'd': fork_delay = 1; break;
+        case 's': shell = optarg; break;
+        case 't': ringfile = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    ring = ringfile;
+    if (ring == NULL) {
+        snprintf(tmpring, sizeof(tmpring), "/tmp/stressreport.%d.trace",
+                 (int)getpid());
+        ring = tmpring;
+    }
+    unlink(ring);
+    run_driver(argv[optind], ring);
+    analyze(ring);
+    if (ringfile == NULL)
+        unlink(ring);
+    printf("result: %s\n", failed ? "FAIL" : "PASS");
+    exit(failed);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+void usage(void)
+{
+    printf("Usage: stressreport [-h] [-v] [-d] [-s shell] [-t tracefile]"
+           " stressfile\n");
+    printf("Options\n");
+    printf("\t-h             Print this message\n");
+    printf("\t-v             Echo the driver's output\n");
+    printf("\t-d             Keep the fork.c delay in the shell\n");
+    printf("\t-s <shell>     Shell to test (default %s)\n", shell);
+    printf("\t-t <file>      Keep the shell's event trace in file\n");
+    exit(0);
+}
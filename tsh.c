@@ -16,6 +16,15 @@
  */
 
 #include "tsh_helper.h"
+#include "tsh_history.h"
+#include "tsh_input.h"
+#include "tsh_metrics.h"
+#include "tsh_perf.h"
+#include "tsh_server.h"
+#include "tsh_stats.h"
+#include "tsh_timer.h"
+#include "tsh_trace.h"
+#include "tsh_zygote.h"
 #include <stdio.h>
 #include <stdlib.h>
 /*
@@ -36,23 +45,41 @@
 #endif
 
 /* Function prototypes */
-void eval(const char *cmdline);
+void eval(const char *cmdline, bool background);
+void eval_list(const char *cmdline);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
 void sigint_handler(int sig);
 void sigquit_handler(int sig);
 
-void handle_background(const char *cmdline, pid_t pid);
-void handle_foreground(const char *cmdline, pid_t pid);
+void handle_background(const char *cmdline, pid_t pid, long timeout);
+void handle_foreground(const char *cmdline, pid_t pid, long timeout);
 void state_bg_jobs(struct job_t *job);
 void state_change_info(int jid, int pid, int signum, char change);
-int get_job_id(struct cmdline_tokens token);
+int get_job_id(const struct cmdline_tokens *token);
+int status_code(int status);
+void builtin_wait(const struct cmdline_tokens *token, builtin_io *io);
+void list_counters(int output_fd);
+void report_time(pid_t pid, long start);
+pid_t server_spawn(const char *cmdline);
 
 // global variables
 int user_interrupt;
 sigset_t mask, old_mask;
-int def_in_desc, def_out_desc;
+pid_t last_bg_pid;          // pid of the last background job started
+int last_status;            // exit status of the last job waited for
+
+// State changes of children, recorded by sigchld_handler for wait. One
+// handler run can reap every job, so the ring holds several job lists' worth
+#define REAPED_RING (4 * MAXJOBS)
+struct reaped_t
+{
+	pid_t pid;
+	int status;             // as returned by waitpid
+} reaped[REAPED_RING];
+volatile sig_atomic_t reaped_count;     // entries ever written to reaped
+volatile sig_atomic_t wait_interrupted; // ctrl-c with no foreground job
 
 /*
  * main -
@@ -69,15 +96,24 @@ int def_in_desc, def_out_desc;
 int main(int argc, char **argv) 
 {
 	char c;
-	char cmdline[MAXLINE_TSH];  // Cmdline for fgets
+	char cmdline[MAXLINE_TSH];  // Cmdline read from stdin
+	input_t input;              // Reader for stdin
+	char expanded[MAXLINE_TSH]; // Cmdline after history expansion
+	char histpath[MAXLINE_TSH]; // Default history file
+	char *histfile;
 	bool emit_prompt = true;    // Emit prompt (default)
+	char *server_path = NULL;   // Serve commands on this socket (-S)
+	bool use_zygote = getenv("TSH_ZYGOTE") != NULL; // Spawn via zygote (-z)
+
+	// Remember the descriptors we inherit, which jobs inherit too
+	redir_init();
 
 	// Redirect stderr to stdout (so that driver will get all output
 	// on the pipe connected to stdout)
 	Dup2(STDOUT_FILENO, STDERR_FILENO); 
   
 	// Parse the command line
-	while ((c = getopt(argc, argv, "hvp")) != EOF)
+	while ((c = getopt(argc, argv, "hvpzS:")) != EOF)
 	{
 		switch (c)
 		{
@@ -90,11 +126,50 @@ int main(int argc, char **argv)
 			case 'p':                   // Disables prompt printing
 				emit_prompt = false;  
 				break;
+			case 'z':                   // Spawns jobs through a zygote
+				use_zygote = true;
+				break;
+			case 'S':                   // Runs as a command server
+				server_path = optarg;
+				break;
 			default:
 				usage();
 		}
 	}
 
+	// Map the metrics before any child is forked, so children share them
+	metrics_init();
+	stats_init();
+
+	// Record job control events in $TSH_TRACE_FILE (see tshtrace)
+	char *trace_file = getenv("TSH_TRACE_FILE");
+	char *trace_records = getenv("TSH_TRACE_RECORDS");
+	unsigned long nrecords = TRACE_NRECORDS;
+	if (trace_records != NULL)
+	{
+		char *end;
+		errno = 0;
+		nrecords = strtoul(trace_records, &end, 0);
+		if (errno != 0 || end == trace_records || *end != '\0' ||
+		    trace_records[0] == '-' || nrecords == 0 ||
+		    nrecords > TRACE_MAXRECORDS)
+		{
+			char msg[MAXLINE_TSH];
+			snprintf(msg, sizeof(msg), "TSH_TRACE_RECORDS: not a "
+				 "number from 1 to %d", TRACE_MAXRECORDS);
+			app_error(msg);
+		}
+	}
+	if (trace_file != NULL)
+		trace_init(trace_file, nrecords);
+
+	// Start the fork server while the shell is still small
+	if (use_zygote)
+		zygote_start();
+
+	// Find out which perf counters jobs can open
+	perf_init();
+
 	// Install the signal handlers
 	Signal(SIGINT,  sigint_handler);   // Handles ctrl-c
 	Signal(SIGTSTP, sigtstp_handler);  // Handles ctrl-z
@@ -106,15 +181,48 @@ int main(int argc, char **argv)
 	// trace0
 	Signal(SIGQUIT, sigquit_handler); 
 
-	// Initialize the job list
+	// Initialize the job list and the deadline timer
 	initjobs(job_list);
+	timer_init();
+
+	// the signals blocked while the job list is in use
+	Sigemptyset(&mask);
+	Sigaddset(&mask, SIGCHLD);
+	Sigaddset(&mask, SIGINT);
+	Sigaddset(&mask, SIGTSTP);
+
+	// Export metrics to $TSH_METRICS_FILE every $TSH_METRICS_INTERVAL
+	char *metrics_file = getenv("TSH_METRICS_FILE");
+	char *metrics_interval = getenv("TSH_METRICS_INTERVAL");
+	long interval;
+	if (metrics_interval == NULL)
+		metrics_interval = METRICS_INTERVAL;
+	if (!parse_duration(metrics_interval, &interval) || interval <= 0)
+		app_error("TSH_METRICS_INTERVAL: bad duration");
+	if (metrics_file != NULL)
+		metrics_start(metrics_file, interval);
+
+	// Open the command history. It is saved to $TSH_HISTFILE, or to
+	// ~/.tsh_history for interactive shells, and kept in memory otherwise
+	histfile = getenv("TSH_HISTFILE");
+	if (histfile == NULL && isatty(STDIN_FILENO) && getenv("HOME") != NULL)
+	{
+		snprintf(histpath, MAXLINE_TSH, "%s/%s", getenv("HOME"), HIST_FILENAME);
+		histfile = histpath;
+	}
+	hist_init(histfile);
+
+	// Read stdin through a large buffer unless it is a terminal
+	char *bufsize = getenv("TSH_INPUT_BUFSIZE");
+	input_init(&input, STDIN_FILENO, bufsize ? strtoul(bufsize, NULL, 0) : 0);
 
 	// initialize user_interrupt to 0
 	user_interrupt = 0;
-	
-	// initializing def_in_desc and def_out_desc
-	// def_in_desc = dup(STDIN_FILENO);
-	// def_out_desc = dup(STDOUT_FILENO);
+
+	// In server mode, run commands from socket clients instead of stdin
+	if (server_path != NULL)
+		server_run(server_path, server_spawn);
+
 
 	// Execute the shell's read/eval loop
 	while (true)
@@ -126,25 +234,34 @@ int main(int argc, char **argv)
             		fflush(stdout);
         	}
 
-        	if ((fgets(cmdline, MAXLINE_TSH, stdin) == NULL) && ferror(stdin))
-        	{
-			app_error("fgets error");
-        	}
+		// Read the next command line, killing jobs that reach their
+		// deadline while we wait for it
+		if (!input_ready(&input))
+			timer_wait_input(STDIN_FILENO, &mask);
+		if (input_readline(&input, cmdline, MAXLINE_TSH) < 0)
+		{
+			// End of file (ctrl-d)
+			printf ("\n");
+			fflush(stdout);
+			fflush(stderr);
+			return 0;
+		}
 
-        	if (feof(stdin))
-        	{ 
-            		// End of file (ctrl-d)
-            		printf ("\n");
-            		fflush(stdout);
-            		fflush(stderr);
-            		return 0;
-        	}
-        
-        	// Remove the trailing newline
-        	cmdline[strlen(cmdline)-1] = '\0';
+		// Expand !! and !n, echoing the result, and record the command
+		int expand_result = hist_expand(cmdline, expanded, MAXLINE_TSH);
+		if (expand_result < 0)
+			continue;
+		if (expand_result > 0)
+		{
+			printf("%s\n", expanded);
+			fflush(stdout);
+			strcpy(cmdline, expanded);
+		}
+		if (cmdline[strspn(cmdline, " \t")] != '\0')
+			hist_add(cmdline);
         
         	// Evaluate the command line
-        	eval(cmdline);
+        	eval_list(cmdline);
         
         	fflush(stdout);
     	} 
@@ -160,9 +277,10 @@ int main(int argc, char **argv)
  *	-> calls helper functions to handle background and foreground jobs
  *	-> calls helper functions to display background jobs
  *
- * cmdline : command entered in the shell
+ * cmdline    : command entered in the shell
+ * background : run a job in the background even without a trailing '&'
  */
-void eval(const char *cmdline) 
+void eval(const char *cmdline, bool background) 
 {
 	// create a mask
 	Sigemptyset(&mask);
@@ -174,57 +292,186 @@ void eval(const char *cmdline)
 	parseline_return parse_result;    
 	struct cmdline_tokens token;
 	// Parse command line
+	long parse_start = metrics_now();
 	parse_result = parseline(cmdline, &token);		  
 	
 	if (parse_result == PARSELINE_ERROR || parse_result == PARSELINE_EMPTY)
+	{
+		if (parse_result == PARSELINE_ERROR)
+			last_status = 2;
+		Sigprocmask(SIG_SETMASK, &old_mask, NULL);
         	return;
-	
-	int in_desc = STDIN_FILENO;
-	int out_desc = STDOUT_FILENO; 
-	// I/O redirection for builtin commands
-	if (token.builtin != BUILTIN_NONE)	
+	}
+	if (background)
+		parse_result = PARSELINE_BG;
+
+	// time runs the rest of the command line and reports its usage
+	bool timed = false;
+	if (token.builtin == BUILTIN_TIME)
+	{
+		if (token.argc < 2)
+		{
+			fprintf(stderr, "Usage: time command [args...]\n");
+			last_status = 2;
+			Sigprocmask(SIG_SETMASK, &old_mask, NULL);
+			return;
+		}
+		// the usage is reported when the shell waits for the job
+		if (parse_result == PARSELINE_BG)
+		{
+			fprintf(stderr, "time: cannot time a background job\n");
+			last_status = 2;
+			Sigprocmask(SIG_SETMASK, &old_mask, NULL);
+			return;
+		}
+		memmove(token.argv, token.argv + 1,
+			token.argc * sizeof(char *));
+		token.argc -= 1;
+		token.builtin = builtin_lookup(token.argv[0]);
+		timed = true;
+
+		// only a job can be timed, or a timeout of one
+		if (token.builtin != BUILTIN_NONE &&
+		    token.builtin != BUILTIN_TIMEOUT)
+		{
+			fprintf(stderr, "time: %s: cannot time a builtin\n",
+				token.argv[0]);
+			last_status = 2;
+			Sigprocmask(SIG_SETMASK, &old_mask, NULL);
+			return;
+		}
+	}
+
+	// timeout runs the rest of the command line as a job with a deadline
+	long timeout = 0;
+	if (token.builtin == BUILTIN_TIMEOUT)
 	{
-		// input redirection
- 		if (token.infile)
+		if (token.argc < 3 || !parse_duration(token.argv[1], &timeout) ||
+		    timeout <= 0)
 		{
-			in_desc = Open(token.infile, O_RDONLY, S_IRWXU);
-			def_in_desc = dup(STDIN_FILENO);
-			Dup2(in_desc, STDIN_FILENO);
+			fprintf(stderr, "Usage: timeout DURATION command [args...]\n");
+			last_status = 2;
+			Sigprocmask(SIG_SETMASK, &old_mask, NULL);
+			return;
 		}
-		// output redirection
-		if (token.outfile)
+		memmove(token.argv, token.argv + 2,
+			(token.argc - 1) * sizeof(char *));
+		token.argc -= 2;
+
+		// the deadline is a job's, so a builtin cannot have one
+		if (builtin_lookup(token.argv[0]) != BUILTIN_NONE)
 		{
-			out_desc = Open(token.outfile, O_WRONLY | O_CREAT, S_IRWXU);
-			def_out_desc = dup(STDOUT_FILENO);
-			Dup2(out_desc, STDOUT_FILENO);
+			fprintf(stderr, "timeout: %s: cannot run a builtin "
+				"with a timeout\n", token.argv[0]);
+			last_status = 2;
+			Sigprocmask(SIG_SETMASK, &old_mask, NULL);
+			return;
+		}
+		token.builtin = BUILTIN_NONE;
+	}
+
+	metrics_command(token.builtin != BUILTIN_NONE);
+	int cmd = stats_command(token.argv[0]);
+	trace_event(TRACE_EVAL, 0, 0, 0, 0, token.builtin);
+	stats_record(STAGE_PARSE, cmd, metrics_now() - parse_start);
+
+	// builtins and background jobs succeed unless they say otherwise,
+	// foreground jobs get their status in sigchld_handler
+	last_status = 0;
+	
+	// builtins do their I/O through a context that holds their
+	// redirections, so the shell's own stdin and stdout never change
+	builtin_io io;
+	if (token.builtin != BUILTIN_NONE &&
+	    !bio_init(&io, token.redir, token.nredir))
+	{
+		last_status = 1;
+		Sigprocmask(SIG_SETMASK, &old_mask, NULL);
+		return;
+	}
+	struct job_t *job = NULL;
+	if (token.builtin == BUILTIN_FG || token.builtin == BUILTIN_BG ||
+	    token.builtin == BUILTIN_DEADLINE)
+	{
+		// parse the argument to get the job
+		if (token.argc < 2)
+			bio_error(&io, "%s command requires PID or %%jobid argument\n",
+				  token.argv[0]);
+		else if ((job = getjobjid(job_list, get_job_id(&token))) == NULL)
+			bio_error(&io, "%s: No such job\n", token.argv[1]);
+		if (job == NULL)
+		{
+			last_status = 1;
+			bio_close(&io);
+			Sigprocmask(SIG_SETMASK, &old_mask, NULL);
+			return;
 		}
 	}
 
 	// builtin QUIT command
 	if (token.builtin == BUILTIN_QUIT)                      
+	{
+		bio_close(&io);
         	exit(0); 
+	}
 	
 	// builtin JOBS command
 	else if (token.builtin == BUILTIN_JOBS)                
 	{
-		listjobs(job_list, STDOUT_FILENO);
+		bio_flush(&io);
+		if (io.out_fd >= 0)
+		{
+			listjobs(job_list, io.out_fd);
+			// jobs -l: the perf counters of each job so far
+			if (token.argc > 1 && strcmp(token.argv[1], "-l") == 0)
+				list_counters(io.out_fd);
+		}
+		Sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	}
+	// builtin HISTORY command
+	else if (token.builtin == BUILTIN_HISTORY)
+	{
+		bio_flush(&io);
+		if (io.out_fd >= 0)
+			hist_builtin(token.argc, token.argv, io.out_fd);
+		Sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	}
+	// builtin METRICS command
+	else if (token.builtin == BUILTIN_METRICS)
+	{
+		bio_flush(&io);
+		if (io.out_fd >= 0 && !metrics_write(io.out_fd, job_list))
+			last_status = 1;
+		Sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	}
+	// builtin STATS command
+	else if (token.builtin == BUILTIN_STATS)
+	{
+		bio_flush(&io);
+		if (io.out_fd >= 0)
+			stats_builtin(token.argc, token.argv, io.out_fd);
+		Sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	}
+	// builtin WAIT command
+	else if (token.builtin == BUILTIN_WAIT)
+	{
+		builtin_wait(&token, &io);
 		Sigprocmask(SIG_UNBLOCK, &mask, NULL);
 	}
 	// builtin foreground job
 	else if (token.builtin == BUILTIN_FG)                   
 	{
-		// parse the argument to get job id
-		int job_id = get_job_id(token);
-
 		// change the job state to FG
 		// forward SIGCONT signal to every associated FG child process
-		struct job_t *job = getjobjid(job_list, job_id);
+		trace_event(TRACE_STATE, job->pid, job->jid, job->state, FG, 0);
 		job->state = FG;
 		Kill(- job->pid, SIGCONT);
+		metrics_signal(SIGCONT);
+		trace_event(TRACE_KILL, job->pid, job->jid, 0, 0, SIGCONT);
 		
 		// suspend until child process are done
 		while (!user_interrupt) {
-        	Sigsuspend(&old_mask);
+        	timer_suspend(&old_mask);
     	}
     	user_interrupt = 0;
     	Sigprocmask(SIG_UNBLOCK, &old_mask, NULL);		
@@ -234,37 +481,66 @@ void eval(const char *cmdline)
 	// built in background job
 	else if (token.builtin == BUILTIN_BG)                   
 	{
-		// parse the argument to get job id
-		int job_id = get_job_id(token); 
-		
 		// change the job state to BG
 		// forward SIGCONT signal to every associated BG child process
-		struct job_t *job = getjobjid(job_list, job_id);
+		trace_event(TRACE_STATE, job->pid, job->jid, job->state, BG, 0);
 		job->state = BG;
 		Kill(-job->pid, SIGCONT);
+		metrics_signal(SIGCONT);
+		trace_event(TRACE_KILL, job->pid, job->jid, 0, 0, SIGCONT);
 		
 		// print background job info	
-		state_bg_jobs(job);	
+		bio_printf(&io, "[%d] (%d)  %s\n", job->jid, job->pid, job->cmdline);
 	
 		Sigprocmask(SIG_UNBLOCK, &mask, NULL);	
 	}
+	// builtin DEADLINE command: 0 removes the job's deadline
+	else if (token.builtin == BUILTIN_DEADLINE)
+	{
+		if (token.argc < 3 || !parse_duration(token.argv[2], &timeout))
+		{
+			bio_error(&io, "Usage: deadline %%jobid DURATION\n");
+			last_status = 1;
+		}
+		else
+			timer_set(job, timeout);
+		Sigprocmask(SIG_UNBLOCK, &mask, NULL);
+	}
     
 	// Non builtin commands
 	else                                                    
 	{
-		pid_t pid = Fork();
+		// let the zygote spawn the job if it runs, fork otherwise
+		pid_t pid = -1;
+		bool by_zygote = false;
+		long spawn_start = metrics_now();
+		stats_spawn_begin(cmd);
+		if (zygote_enabled())
+			by_zygote = (pid = zygote_spawn(token.argv, token.redir,
+							token.nredir)) > 0;
+		if (pid < 0 && (pid = fork()) < 0)
+		{
+			// keep the shell running when the system is out of processes
+			metrics_fork_failed();
+			fprintf(stderr, "Fork error: %s\n", strerror(errno));
+			last_status = 1;
+		}
 		// parent process
         	if (pid > 0)                                        
         	{      
+			stats_spawn_end();
+			trace_event(TRACE_SPAWN, pid, 0, 0, 0, by_zygote);
             		if (parse_result == PARSELINE_FG)               
             		{   
                 		// handles and executes foreground job 
-				handle_foreground(cmdline, pid);
+				handle_foreground(cmdline, pid, timeout);
+				if (timed)
+					report_time(pid, spawn_start);
             		}
             		else if (parse_result == PARSELINE_BG)   
             		{
 				// handles and executes background job
-                		handle_background(cmdline, pid);
+                		handle_background(cmdline, pid, timeout);
             		}
         	}
         	// child process
@@ -277,73 +553,133 @@ void eval(const char *cmdline)
             		Signal(SIGINT, SIG_DFL);
             		Signal(SIGTSTP, SIG_DFL);
 
+			// open the job's perf counters before it sheds our fds
+			perf_child();
+
             		// set new process id group for child process
             		Setpgid(0, 0);
-			// input redirection				    				
-            		if (token.infile)
-			{
-				in_desc = Open(token.infile, O_RDONLY, S_IRWXU);
-				Dup2(in_desc,  STDIN_FILENO);
-			}
-			// output redirection
-			if (token.outfile) 
-			{
-				out_desc = Open(token.outfile, O_WRONLY | O_CREAT, S_IRWXU);
-				Dup2(out_desc,  STDOUT_FILENO);
-			}
-            		Execve(token.argv[0], token.argv, environ);
+			// I/O redirection, closing the shell's own descriptors
+			redir_apply(token.redir, token.nredir);
+			stats_exec_ready();
+            		execve(token.argv[0], token.argv, environ);
+			metrics_exec_failed();
+			unix_error("Execve error");
         	}
 		Sigprocmask(SIG_UNBLOCK, &mask, NULL);
     	}
 	
+	// write out what the builtin printed and close its files
 	if (token.builtin != BUILTIN_NONE)
+		bio_close(&io);
+	return;
+}
+
+/*
+ * eval_list -
+ * 	-> splits the command line into a list of commands
+ * 	-> runs the commands one after the other with eval, skipping a
+ * 	   command after "&&" if the last status is not 0, and after "||"
+ * 	   if it is 0
+ * 	-> expands $? in each command just before running it
+ *
+ * cmdline : command entered in the shell
+ */
+void eval_list(const char *cmdline)
+{
+	static struct cmdline_list list;
+	char cmd[MAXLINE_TSH];
+	list_op prev = LIST_SEQ;
+	int i, n;
+
+	if ((n = parselist(cmdline, &list)) < 0)
 	{
-		// input redirection				    				
-		if (token.infile)
-		{
-			Dup2(def_in_desc, STDIN_FILENO);
-			// Close the infile
-			Close(in_desc);
-		}
-		// output redirection
-		if (token.outfile) 
+		last_status = 2;
+		return;
+	}
+	for (i = 0; i < n; i++)
+	{
+		bool skip = (prev == LIST_AND && last_status != 0) ||
+			    (prev == LIST_OR && last_status == 0);
+		prev = list.op[i];
+		if (skip)
+			continue;
+
+		if (!expand_status(list.cmd[i], cmd, MAXLINE_TSH - 2, last_status))
 		{
-			Dup2(def_out_desc, STDOUT_FILENO);
-			// close the outfile
-			Close(out_desc);
+			fprintf(stderr, "Error: command line too long\n");
+			last_status = 2;
+			return;
 		}
+		// put the '&' back, so a job shows its command line as typed
+		if (list.op[i] == LIST_BG)
+			strcat(cmd, isspace(cmd[strlen(cmd) - 1]) ? "&" : " &");
+		eval(cmd, false);
 	}
-	return;
 }
 
 /*
  * handle_background - 
  * 		-> adds job to the job list
+ * 		-> gives it a deadline if it runs under timeout
  * cmdline : command line arguments  
  * pid     : process id of the job
+ * timeout : ms the job may run for, 0 if there is no limit
  *          
  */
-void handle_background(const char *cmdline, pid_t pid)
+void handle_background(const char *cmdline, pid_t pid, long timeout)
 {
+	last_bg_pid = pid;
 	addjob(job_list, pid, BG, cmdline);                 
 	struct job_t *j = getjobpid(job_list, pid);        
+	timer_set(j, timeout);
+	stats_job_added(j);
 	state_bg_jobs(j);	
 }
 
+/*
+ * server_spawn -
+ * 		-> runs a command line from a server client as a background job
+ * cmdline : command line sent by the client
+ *
+ * return  : pid of the job, or 0 if cmdline is not an external command
+ */
+pid_t server_spawn(const char *cmdline)
+{
+	static struct cmdline_tokens token;
+
+	parseline_return parse_result = parseline(cmdline, &token);
+	if (parse_result == PARSELINE_ERROR || parse_result == PARSELINE_EMPTY
+	    || token.builtin != BUILTIN_NONE)
+		return 0;
+
+	// the server waits for the job itself, so always run it in background
+	last_bg_pid = 0;
+	eval(cmdline, true);
+	return last_bg_pid;
+}
+
 /*
  * handle_foreground -
  * 		-> adds job to the job list
+ * 		-> gives it a deadline if it runs under timeout
  * 		-> suspend process until signal not in mask is delivered
+ * 		   or the deadline passes
  * cmdline : command line arguments
  * pid     : process id of the job
- * mask    : signal mask used by sigsuspend
+ * timeout : ms the job may run for, 0 if there is no limit
  */ 
-void handle_foreground(const char *cmdline, pid_t pid)
+void handle_foreground(const char *cmdline, pid_t pid, long timeout)
 {
 	addjob(job_list, pid, FG, cmdline);
+	struct job_t *job = getjobpid(job_list, pid);
+	timer_set(job, timeout);
+	stats_job_added(job);
+	int cmd = job->stats_cmd;
+	long wait_start = metrics_now();
 	while (!user_interrupt) {
-        	Sigsuspend(&old_mask);
+        	timer_suspend(&old_mask);
     	}
+	stats_record(STAGE_WAIT, cmd, metrics_now() - wait_start);
     	user_interrupt = 0;
     	Sigprocmask(SIG_UNBLOCK, &old_mask, NULL);
 }
@@ -404,15 +740,177 @@ void state_bg_jobs(struct job_t *job)
  *	token	: struct that contains commandline tokens
  *	return	: job id 
  */
-int get_job_id(struct cmdline_tokens token)
+int get_job_id(const struct cmdline_tokens *token)
 {
-	int s = strlen(token.argv[1]);
+	int s = strlen(token->argv[1]);
 	char str_job_id[s];
-	memcpy(str_job_id, token.argv[1] + 1, s-1);
+	memcpy(str_job_id, token->argv[1] + 1, s-1);
 	str_job_id[s-1] = '\0';
 	int job_id = atoi (str_job_id);
 	return job_id;
 }
+
+/*
+ * status_code - exit status of a job in the form the shell reports it
+ * status	: status as returned by waitpid
+ * return	: exit code, or 128 plus the signal that ended or stopped it
+ */
+int status_code(int status)
+{
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return 128 + WSTOPSIG(status);
+}
+
+/*
+ * list_counters - prints the perf counters of every job so far
+ * output_fd	: descriptor to print to
+ *
+ * called with SIGCHLD, SIGINT and SIGTSTP blocked
+ */
+void list_counters(int output_fd)
+{
+	struct perf_counts pc;
+	char buf[MAXLINE_TSH], counts[MAXLINE_TSH / 2];
+	int i;
+
+	for (i = 0; i < MAXJOBS; i++)
+	{
+		if (job_list[i].pid == 0 || !perf_read(job_list[i].pid, &pc))
+			continue;
+		perf_format(&pc, counts, sizeof(counts));
+		snprintf(buf, sizeof(buf), "[%d] (%d) %s\n", job_list[i].jid,
+			 job_list[i].pid, counts);
+		rio_writen(output_fd, buf, strlen(buf));
+	}
+}
+
+/*
+ * report_time - prints the usage of a foreground job run by time
+ * pid		: process id of the job, which has been reaped
+ * start	: metrics_now() when the job was spawned
+ */
+void report_time(pid_t pid, long start)
+{
+	struct perf_counts pc;
+	char counts[MAXLINE_TSH];
+	double real = (metrics_now() - start) / 1e9;
+
+	if (!perf_last(pid, &pc))
+	{
+		// stopped rather than finished: only the wall time is known
+		fprintf(stderr, "real %.3fs\n", real);
+		return;
+	}
+	fprintf(stderr, "real %.3fs  user %.3fs  sys %.3fs\n", real,
+		pc.ru.ru_utime.tv_sec + pc.ru.ru_utime.tv_usec / 1e6,
+		pc.ru.ru_stime.tv_sec + pc.ru.ru_stime.tv_usec / 1e6);
+	perf_format(&pc, counts, sizeof(counts));
+	if (counts[0] != '\0')
+		fprintf(stderr, "%s\n", counts);
+}
+
+/*
+ * builtin_wait -
+ * 		-> wait           : waits for every background job to finish
+ * 		-> wait %jid, pid : waits for one job to finish or stop; for a
+ * 		   job already stopped, returns the status it stopped with
+ * 		-> wait -n        : waits for the next background job to finish
+ * 		-> sleeps in sigsuspend on the changes sigchld_handler records,
+ * 		   until one it waits for happens or ctrl-c interrupts it
+ * 		-> a job that left the job list or changed state without the
+ * 		   ring showing it (more changes came than the ring holds) is
+ * 		   done too, with status 127
+ * 		-> sets last_status to the status of the job waited for
+ * token	: struct that contains commandline tokens
+ * io		: I/O context of the builtin
+ *
+ * called with SIGCHLD, SIGINT and SIGTSTP blocked
+ */
+void builtin_wait(const struct cmdline_tokens *token, builtin_io *io)
+{
+	int start = reaped_count;
+	bool next = false;
+	pid_t pid = 0;
+	int state = UNDEF;
+	int i;
+
+	if (token->argc > 1 && strcmp(token->argv[1], "-n") == 0)
+		next = true;
+	else if (token->argc > 1)
+	{
+		struct job_t *job;
+		if (token->argv[1][0] == '%')
+			job = getjobjid(job_list, get_job_id(token));
+		else
+			job = getjobpid(job_list, atoi(token->argv[1]));
+		if (job == NULL)
+		{
+			bio_error(io, "%s: No such job\n", token->argv[1]);
+			last_status = 127;
+			return;
+		}
+		// a job that has already stopped is done at once
+		if (job->state == ST)
+		{
+			last_status = job->status;
+			return;
+		}
+		pid = job->pid;
+		state = job->state;
+	}
+
+	wait_interrupted = 0;
+	while (!wait_interrupted)
+	{
+		// changes before the last REAPED_RING have been overwritten
+		if (reaped_count - start > REAPED_RING)
+			start = reaped_count - REAPED_RING;
+
+		// look through the changes since the wait began
+		for (i = start; i < reaped_count; i++)
+		{
+			struct reaped_t *r = &reaped[i % REAPED_RING];
+			if ((pid != 0 && r->pid == pid) ||
+			    (next && !WIFSTOPPED(r->status)))
+			{
+				last_status = status_code(r->status);
+				return;
+			}
+		}
+		start = reaped_count;
+
+		// a job that changed without its entry being seen is done too
+		if (pid != 0)
+		{
+			struct job_t *job = getjobpid(job_list, pid);
+			if (job == NULL || job->state != state)
+			{
+				last_status = 127;      // its status is lost
+				return;
+			}
+		}
+
+		// done once no background job is left running
+		if (pid == 0)
+		{
+			for (i = 0; i < MAXJOBS && !(job_list[i].pid != 0 &&
+			     job_list[i].state == BG); i++)
+				;
+			if (i == MAXJOBS)
+			{
+				last_status = next ? 127 : 0;
+				return;
+			}
+		}
+
+		timer_suspend(&old_mask);
+	}
+	last_status = 128 + SIGINT;
+}
+
 /*****************
  * Signal handlers
  *****************/
@@ -439,11 +937,15 @@ void sigchld_handler(int sig)
 	Sigprocmask(SIG_BLOCK, &mask, NULL);
 
     	int status;
+    	struct rusage ru;
     	pid_t pid, fg_pid;
+    	long since = metrics_now();
+
+	trace_event(TRACE_SIGCHLD, 0, 0, 0, 0, 0);
 
     	while (1)
     	{
-        	pid = waitpid(-1, &status, WUNTRACED | WNOHANG);
+        	pid = wait4(-1, &status, WUNTRACED | WNOHANG, &ru);
 		// No child processes left
         	if (pid < 0)    					
           		break;
@@ -452,6 +954,11 @@ void sigchld_handler(int sig)
             		break;
         
         	fg_pid = fgpid(job_list);
+		struct job_t *changed = getjobpid(job_list, pid);
+		metrics_reaped(changed, status, since);
+		stats_job_changed(changed);
+		trace_event(TRACE_REAP, pid, changed ? changed->jid : 0, 0, 0,
+			    status);
 		// child process terminated normally
 		if  (WIFEXITED(status))								
             		deletejob(job_list, pid);
@@ -460,7 +967,9 @@ void sigchld_handler(int sig)
        		{
 			// change job state in job list to stop
             		struct job_t *job = getjobpid(job_list, pid);
+			trace_event(TRACE_STATE, pid, job->jid, job->state, ST, 0);
             		job->state = ST;
+            		job->status = status_code(status);
 		
 			// print stopped job info	
 			state_change_info(job->jid, pid, WSTOPSIG(status), 'S');
@@ -471,15 +980,31 @@ void sigchld_handler(int sig)
 			struct job_t *job = getjobpid(job_list, pid);
 			
 			// print the info on terminated process	
-			state_change_info(job->jid, pid, WTERMSIG(status), 'T');
+			if (job != NULL)
+				state_change_info(job->jid, pid, WTERMSIG(status), 'T');
 			
 			// deleting the terminated job from job list
 			deletejob(job_list, pid);
 		}
+
+		// report finished jobs to server clients
+		if (!WIFSTOPPED(status))
+		{
+			perf_reaped(pid, &ru);
+			server_reaped(pid, status, &ru);
+		}
+
+		// record the change for the wait builtin
+		reaped[reaped_count % REAPED_RING].pid = pid;
+		reaped[reaped_count % REAPED_RING].status = status;
+		reaped_count++;
 		
 		// foreground child process
 		if (pid == fg_pid)    
+		{
+			last_status = status_code(status);
             		user_interrupt = 1;
+		}
 	}
     	Sigprocmask(SIG_UNBLOCK, &mask, NULL);
 	return;
@@ -493,7 +1018,17 @@ void sigchld_handler(int sig)
 void sigint_handler(int sig) 
 {
 	Sigprocmask(SIG_BLOCK, &mask, NULL);
-	Kill(-fgpid(job_list), SIGINT);  
+	pid_t fg_pid = fgpid(job_list);
+	trace_event(TRACE_SIGINT, fg_pid, 0, 0, 0, 0);
+	// with no foreground job, kill(-0) would signal the shell itself
+	if (fg_pid != 0)
+	{
+		Kill(-fg_pid, SIGINT);
+		metrics_signal(SIGINT);
+		trace_event(TRACE_KILL, fg_pid, 0, 0, 0, SIGINT);
+	}
+	else
+		wait_interrupted = 1;
 	Sigprocmask(SIG_UNBLOCK, &mask, NULL);
 	return;
 }
@@ -506,7 +1041,14 @@ void sigint_handler(int sig)
 void sigtstp_handler(int sig) 
 {
 	Sigprocmask(SIG_BLOCK, &mask, NULL);
-	Kill(-fgpid(job_list), SIGTSTP);
+	pid_t fg_pid = fgpid(job_list);
+	trace_event(TRACE_SIGTSTP, fg_pid, 0, 0, 0, 0);
+	if (fg_pid != 0)
+	{
+		Kill(-fg_pid, SIGTSTP);
+		metrics_signal(SIGTSTP);
+		trace_event(TRACE_KILL, fg_pid, 0, 0, 0, SIGTSTP);
+	}
 	Sigprocmask(SIG_UNBLOCK, &mask, NULL);
 	return;
 }
@@ -0,0 +1,1065 @@
+/* tsh_glob.c
+ * pathname expansion for tshlab
+ */
+
+#include "tsh_glob.h"
+#include "csapp.h"
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+// Compiled pattern opcodes, one per pattern character (or bracket class)
+typedef enum glob_opcode
+{
+    GOP_CHAR,                   // match one literal character
+    GOP_ANY,                    // '?': match any one character
+    GOP_STAR,                   // '*': match any run of characters
+    GOP_CLASS                   // '[...]': match one character in a set
+} glob_opcode;
+
+struct glob_op
+{
+    glob_opcode op;
+    unsigned char c;            // GOP_CHAR: the character
+    uint32_t set[8];            // GOP_CLASS: bitmap of accepted bytes
+};
+
+// A compiled path component, e.g. "*.log" in "spool/*/*.log"
+struct glob_pat
+{
+    int nops;
+    bool wild;                  // false if the component is a plain name
+    bool dotok;                 // true if it may match a leading '.'
+    bool recurse;               // true for "**"
+    struct glob_op ops[];
+};
+
+// One directory listing, as read with getdents64
+struct dirlist
+{
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    size_t nents;
+    uint32_t *offs;             // offset of each name in names
+    unsigned char *types;       // d_type of each name
+    char *names;                // NUL-terminated names, back to back
+    size_t nbytes;              // bytes held by this listing
+    unsigned long lastuse;      // LRU clock value of the last lookup
+    int pins;                   // > 0 while a caller iterates over it
+    bool cached;                // false for a one-off, uncached listing
+};
+
+// Matches collected during one expansion
+struct glob_res
+{
+    char **v;
+    size_t n;
+    size_t cap;
+};
+
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static struct dirlist *dircache[GLOB_CACHE_DIRS];
+static size_t dircache_bytes;   // total bytes held by cached listings
+static unsigned long dircache_clock;
+static char *dentsbuf;          // getdents64 buffer, allocated on first use
+
+
+/***********************************
+ * Pattern compilation and matching
+ ***********************************/
+
+/* compile_class - Compile the bracket expression at p into op.
+ * Returns a pointer past the closing ']' or NULL if it is unterminated. */
+static const char *compile_class(const char *p, const char *end,
+                                 struct glob_op *op)
+{
+    bool negate = false;
+    int c, hi;
+
+    memset(op->set, 0, sizeof(op->set));
+    op->op = GOP_CLASS;
+    p++;                                    // skip '['
+    if (p < end && (*p == '!' || *p == '^'))
+    {
+        negate = true;
+        p++;
+    }
+    if (p < end && *p == ']')               // leading ']' is literal
+    {
+        op->set[']' >> 5] |= 1u << (']' & 31);
+        p++;
+    }
+    while (p < end && *p != ']')
+    {
+        c = (unsigned char)*p++;
+        hi = c;
+        if (p + 1 < end && *p == '-' && p[1] != ']')
+        {
+            hi = (unsigned char)p[1];
+            p += 2;
+        }
+        for (; c <= hi; c++)
+        {
+            op->set[c >> 5] |= 1u << (c & 31);
+        }
+    }
+    if (p >= end)
+    {
+        return NULL;
+    }
+    if (negate)
+    {
+        for (c = 0; c < 8; c++)
+        {
+            op->set[c] = ~op->set[c];
+        }
+    }
+    op->set[0] &= ~1u;                      // never match the NUL byte
+    return p + 1;
+}
+
+/* glob_compile - Compile one path component [p, end) */
+static struct glob_pat *glob_compile(const char *p, const char *end)
+{
+    struct glob_pat *pat;
+    const char *next;
+    int n = 0;
+
+    pat = Malloc(sizeof(*pat) + (end - p) * sizeof(struct glob_op));
+    pat->wild = false;
+    pat->dotok = (p < end && *p == '.');
+    pat->recurse = (end - p == 2 && p[0] == '*' && p[1] == '*');
+
+    while (p < end)
+    {
+        struct glob_op *op = &pat->ops[n];
+
+        if (*p == '*')
+        {
+            // collapse runs of '*'
+            if (n == 0 || pat->ops[n-1].op != GOP_STAR)
+            {
+                op->op = GOP_STAR;
+                n++;
+            }
+            pat->wild = true;
+            p++;
+            continue;
+        }
+        if (*p == '?')
+        {
+            op->op = GOP_ANY;
+            pat->wild = true;
+            n++;
+            p++;
+            continue;
+        }
+        if (*p == '[' && (next = compile_class(p, end, op)) != NULL)
+        {
+            pat->wild = true;
+            n++;
+            p = next;
+            continue;
+        }
+        op->op = GOP_CHAR;
+        op->c = (unsigned char)*p++;
+        n++;
+    }
+    pat->nops = n;
+    return pat;
+}
+
+/* glob_match - Return true if name matches the compiled component.
+ * Backtracks only to the most recent '*', so it runs in O(n*m) worst
+ * case and linear time for the common "*.ext" and "prefix*" forms. */
+static bool glob_match(const struct glob_pat *pat, const char *name)
+{
+    const struct glob_op *op = pat->ops;
+    const struct glob_op *end = op + pat->nops;
+    const struct glob_op *star_op = NULL;
+    const char *star_name = NULL;
+    unsigned char c;
+
+    if (*name == '.' && !pat->dotok)
+    {
+        return false;
+    }
+
+    while (*name)
+    {
+        c = (unsigned char)*name;
+        if (op < end)
+        {
+            if (op->op == GOP_STAR)
+            {
+                star_op = ++op;
+                star_name = name;
+                continue;
+            }
+            if ((op->op == GOP_CHAR && op->c == c) ||
+                op->op == GOP_ANY ||
+                (op->op == GOP_CLASS && (op->set[c >> 5] & (1u << (c & 31)))))
+            {
+                op++;
+                name++;
+                continue;
+            }
+        }
+        if (star_op == NULL)
+        {
+            return false;
+        }
+        // let the last '*' swallow one more character and retry
+        op = star_op;
+        name = ++star_name;
+    }
+    while (op < end && op->op == GOP_STAR)
+    {
+        op++;
+    }
+    return op == end;
+}
+
+
+/***************************
+ * Directory listing cache
+ ***************************/
+
+/* dirlist_free - Release a listing and everything it owns */
+static void dirlist_free(struct dirlist *dl)
+{
+    Free(dl->offs);
+    Free(dl->types);
+    Free(dl->names);
+    Free(dl);
+}
+
+/* dirlist_read - Read every entry of the open directory fd, using the
+ * GLOB_DENTS_BUFSIZE bytes at dents as the getdents64 buffer */
+static struct dirlist *dirlist_read(int fd, char *dents)
+{
+    struct dirlist *dl = Calloc(1, sizeof(*dl));
+    size_t cap = 64, namecap = 4096, namelen = 0;
+    long n, pos;
+
+    dl->offs = Malloc(cap * sizeof(*dl->offs));
+    dl->types = Malloc(cap);
+    dl->names = Malloc(namecap);
+
+    while ((n = syscall(SYS_getdents64, fd, dents, GLOB_DENTS_BUFSIZE)) > 0)
+    {
+        for (pos = 0; pos < n; )
+        {
+            struct linux_dirent64 *d = (void *)(dents + pos);
+            const char *nm = d->d_name;
+            size_t len = strlen(nm) + 1;
+
+            pos += d->d_reclen;
+            if (nm[0] == '.' && (nm[1] == '\0' ||
+                                 (nm[1] == '.' && nm[2] == '\0')))
+            {
+                continue;
+            }
+            if (dl->nents == cap)
+            {
+                cap *= 2;
+                dl->offs = Realloc(dl->offs, cap * sizeof(*dl->offs));
+                dl->types = Realloc(dl->types, cap);
+            }
+            while (namelen + len > namecap)
+            {
+                namecap *= 2;
+                dl->names = Realloc(dl->names, namecap);
+            }
+            memcpy(dl->names + namelen, nm, len);
+            dl->offs[dl->nents] = namelen;
+            dl->types[dl->nents] = d->d_type;
+            dl->nents++;
+            namelen += len;
+        }
+    }
+    dl->nbytes = sizeof(*dl) + cap * (sizeof(*dl->offs) + 1) + namecap;
+    if (n < 0)
+    {
+        dirlist_free(dl);
+        return NULL;
+    }
+    return dl;
+}
+
+/* dircache_evict - Drop unpinned listings, least recently used first,
+ * until a listing of need bytes fits. Returns a free slot or -1. */
+static int dircache_evict(size_t need)
+{
+    int i, victim, slot = -1;
+
+    for (;;)
+    {
+        victim = -1;
+        for (i = 0; i < GLOB_CACHE_DIRS; i++)
+        {
+            if (dircache[i] == NULL)
+            {
+                slot = i;
+            }
+            else if (dircache[i]->pins == 0 &&
+                     (victim < 0 ||
+                      dircache[i]->lastuse < dircache[victim]->lastuse))
+            {
+                victim = i;
+            }
+        }
+        if (slot >= 0 && dircache_bytes + need <= GLOB_CACHE_BYTES)
+        {
+            return slot;
+        }
+        if (victim < 0)
+        {
+            return -1;
+        }
+        dircache_bytes -= dircache[victim]->nbytes;
+        dirlist_free(dircache[victim]);
+        dircache[victim] = NULL;
+    }
+}
+
+/* dircache_get - Return the listing of directory path, pinned.
+ * A cached listing is reused while the directory's inode and mtime are
+ * unchanged. Listings read in the same second as the directory was last
+ * modified are never reused, since a later change within the file
+ * system's timestamp granularity would go unnoticed. */
+static struct dirlist *dircache_get(const char *path)
+{
+    struct dirlist *dl;
+    struct stat st;
+    struct timespec now;
+    int fd, i, slot;
+
+    if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    for (i = 0; i < GLOB_CACHE_DIRS; i++)
+    {
+        dl = dircache[i];
+        if (dl != NULL && dl->dev == st.st_dev && dl->ino == st.st_ino)
+        {
+            if (dl->mtime.tv_sec == st.st_mtim.tv_sec &&
+                dl->mtime.tv_nsec == st.st_mtim.tv_nsec)
+            {
+                close(fd);
+                dl->lastuse = ++dircache_clock;
+                dl->pins++;
+                return dl;
+            }
+            if (dl->pins == 0)          // stale: drop it and reread
+            {
+                dircache_bytes -= dl->nbytes;
+                dirlist_free(dl);
+                dircache[i] = NULL;
+            }
+            break;
+        }
+    }
+
+    if (dentsbuf == NULL)
+    {
+        dentsbuf = Malloc(GLOB_DENTS_BUFSIZE);
+    }
+    dl = dirlist_read(fd, dentsbuf);
+    close(fd);
+    if (dl == NULL)
+    {
+        return NULL;
+    }
+    dl->dev = st.st_dev;
+    dl->ino = st.st_ino;
+    dl->mtime = st.st_mtim;
+    dl->pins = 1;
+    dl->lastuse = ++dircache_clock;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (st.st_mtim.tv_sec < now.tv_sec - 1 &&
+        (slot = dircache_evict(dl->nbytes)) >= 0)
+    {
+        dl->cached = true;
+        dircache[slot] = dl;
+        dircache_bytes += dl->nbytes;
+    }
+    return dl;
+}
+
+/* dircache_put - Unpin a listing returned by dircache_get */
+static void dircache_put(struct dirlist *dl)
+{
+    dl->pins--;
+    if (!dl->cached)
+    {
+        dirlist_free(dl);
+    }
+}
+
+/* glob_cache_flush - Drop every cached directory listing */
+void glob_cache_flush(void)
+{
+    int i;
+
+    for (i = 0; i < GLOB_CACHE_DIRS; i++)
+    {
+        if (dircache[i] != NULL && dircache[i]->pins == 0)
+        {
+            dircache_bytes -= dircache[i]->nbytes;
+            dirlist_free(dircache[i]);
+            dircache[i] = NULL;
+        }
+    }
+}
+
+
+/*******************
+ * Expansion driver
+ *******************/
+
+/* res_add - Append a copy of path to the match list */
+static void res_add(struct glob_res *res, const char *path, size_t len)
+{
+    if (res->n == res->cap)
+    {
+        res->cap = res->cap ? res->cap * 2 : 16;
+        res->v = Realloc(res->v, res->cap * sizeof(char *));
+    }
+    res->v[res->n] = Malloc(len + 1);
+    memcpy(res->v[res->n], path, len + 1);
+    res->n++;
+}
+
+/* isdir - Decide if entry name (of type dtype) below the path prefix
+ * dir is a directory. Only symlinks and file systems that do not fill
+ * in d_type cost a stat call. */
+static bool isdir(const char *dir, const char *name, unsigned char dtype)
+{
+    struct stat st;
+    char path[PATH_MAX];
+
+    if (dtype == DT_DIR)
+    {
+        return true;
+    }
+    if (dtype != DT_LNK && dtype != DT_UNKNOWN)
+    {
+        return false;
+    }
+    if (snprintf(path, sizeof(path), "%s%s", dir, name) >= (int)sizeof(path))
+    {
+        return false;
+    }
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/********************************
+ * Recursive "**" directory walk
+ ********************************/
+
+// A directory being walked; its fd anchors openat() of its children
+struct walk_dir
+{
+    int fd;
+    int refs;                   // held by its own task and queued children
+    size_t len;
+    char path[];                // path prefix, with a trailing '/'
+};
+
+struct walk_task
+{
+    struct walk_dir *dir;       // the parent, or the root for the first task
+    char *name;                 // NULL for the root task
+};
+
+// Per-worker task deque. The owner pushes and pops at the bottom, so it
+// walks depth first and keeps few directories open; thieves take from
+// the top, where the oldest and usually largest subtrees are.
+struct walk_deque
+{
+    pthread_mutex_t lock;
+    struct walk_task *v;
+    size_t top;                 // v[top..bot) are queued
+    size_t bot;
+    size_t cap;
+};
+
+struct walk_pool
+{
+    int nworkers;
+    struct walk_deque *deques;
+    struct glob_pat **pats;     // components that follow the "**"
+    int npats;
+    bool dirsonly;
+    long pending;               // tasks queued or running
+};
+
+struct walk_worker
+{
+    struct walk_pool *pool;
+    int id;
+    unsigned seed;              // for picking steal victims
+    char *dents;                // private getdents64 buffer
+    struct glob_res res;        // private match list
+    pthread_t tid;
+};
+
+/* walk_dir_put - Drop one reference to dir, closing it on the last */
+static void walk_dir_put(struct walk_dir *dir)
+{
+    if (__atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        close(dir->fd);
+        Free(dir);
+    }
+}
+
+/* deque_push - Queue a task at the bottom of the owner's deque */
+static void deque_push(struct walk_pool *pool, struct walk_deque *dq,
+                       struct walk_dir *dir, char *name)
+{
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bot == dq->cap)
+    {
+        if (dq->top > dq->cap / 2)
+        {
+            memmove(dq->v, dq->v + dq->top,
+                    (dq->bot - dq->top) * sizeof(*dq->v));
+        }
+        else
+        {
+            dq->cap = dq->cap ? dq->cap * 2 : 64;
+            dq->v = Realloc(dq->v, dq->cap * sizeof(*dq->v));
+            memmove(dq->v, dq->v + dq->top,
+                    (dq->bot - dq->top) * sizeof(*dq->v));
+        }
+        dq->bot -= dq->top;
+        dq->top = 0;
+    }
+    dq->v[dq->bot].dir = dir;
+    dq->v[dq->bot].name = name;
+    dq->bot++;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+/* deque_take - Take a task from the bottom (owner) or top (thief) */
+static bool deque_take(struct walk_deque *dq, bool steal,
+                       struct walk_task *t)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->top < dq->bot)
+    {
+        *t = steal ? dq->v[dq->top++] : dq->v[--dq->bot];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+/* walk_at - Match components pats[0..n) below the subdirectory name of
+ * dirfd, whose path prefix (ending in name and '/') is path[0..len).
+ * This is glob_walk without the cache, so worker threads can use it. */
+static void walk_at(int dirfd, const char *name, struct glob_pat **pats,
+                    int n, bool dirsonly, char *path, size_t len,
+                    struct glob_res *res, char *dents)
+{
+    struct dirlist *dl;
+    struct stat st;
+    size_t k, nlen;
+    int fd;
+
+    if ((fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    {
+        return;
+    }
+    if ((dl = dirlist_read(fd, dents)) == NULL)
+    {
+        close(fd);
+        return;
+    }
+    for (k = 0; k < dl->nents; k++)
+    {
+        const char *ent = dl->names + dl->offs[k];
+
+        nlen = strlen(ent);
+        if (!glob_match(pats[0], ent) || len + nlen + 2 >= PATH_MAX)
+        {
+            continue;
+        }
+        memcpy(path + len, ent, nlen);
+        if (n > 1)
+        {
+            path[len + nlen] = '/';
+            walk_at(fd, ent, pats + 1, n - 1, dirsonly,
+                    path, len + nlen + 1, res, dents);
+            continue;
+        }
+        if (dirsonly)
+        {
+            if (dl->types[k] != DT_DIR &&
+                (fstatat(fd, ent, &st, 0) < 0 || !S_ISDIR(st.st_mode)))
+            {
+                continue;
+            }
+            path[len + nlen++] = '/';
+        }
+        path[len + nlen] = '\0';
+        res_add(res, path, len + nlen);
+    }
+    dirlist_free(dl);
+    close(fd);
+}
+
+/* walk_visit - List one directory: record its matches and queue its
+ * subdirectories. Symlinks and hidden directories are not descended. */
+static void walk_visit(struct walk_worker *w, struct walk_task *t)
+{
+    struct walk_pool *pool = w->pool;
+    struct walk_deque *dq = &pool->deques[w->id];
+    struct walk_dir *dir = t->dir;
+    struct dirlist *dl;
+    struct stat st;
+    char path[PATH_MAX];
+    size_t k, nlen;
+    bool sub;
+    int fd;
+
+    if (t->name != NULL)
+    {
+        nlen = strlen(t->name);
+        fd = openat(dir->fd, t->name,
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0 || dir->len + nlen + 2 >= PATH_MAX)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            walk_dir_put(dir);
+            Free(t->name);
+            return;
+        }
+        dir = Malloc(sizeof(*dir) + t->dir->len + nlen + 2);
+        dir->fd = fd;
+        dir->refs = 1;
+        memcpy(dir->path, t->dir->path, t->dir->len);
+        memcpy(dir->path + t->dir->len, t->name, nlen);
+        dir->len = t->dir->len + nlen + 1;
+        dir->path[dir->len - 1] = '/';
+        walk_dir_put(t->dir);
+        Free(t->name);
+    }
+
+    if ((dl = dirlist_read(dir->fd, w->dents)) == NULL)
+    {
+        walk_dir_put(dir);
+        return;
+    }
+    memcpy(path, dir->path, dir->len);
+    for (k = 0; k < dl->nents; k++)
+    {
+        const char *name = dl->names + dl->offs[k];
+
+        nlen = strlen(name);
+        if (dir->len + nlen + 2 >= PATH_MAX)
+        {
+            continue;
+        }
+        sub = (dl->types[k] == DT_DIR);
+        if (dl->types[k] == DT_UNKNOWN &&
+            fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        {
+            sub = S_ISDIR(st.st_mode);
+        }
+
+        memcpy(path + dir->len, name, nlen);
+        path[dir->len + nlen] = '\0';
+        if (pool->npats == 0)
+        {
+            // a trailing "**" matches everything below it
+            if (name[0] != '.' && (!pool->dirsonly || sub))
+            {
+                if (pool->dirsonly)
+                {
+                    path[dir->len + nlen] = '/';
+                    path[dir->len + nlen + 1] = '\0';
+                }
+                res_add(&w->res, path, strlen(path));
+            }
+        }
+        else if (glob_match(pool->pats[0], name))
+        {
+            if (pool->npats > 1)
+            {
+                path[dir->len + nlen] = '/';
+                walk_at(dir->fd, name, pool->pats + 1, pool->npats - 1,
+                        pool->dirsonly, path, dir->len + nlen + 1,
+                        &w->res, w->dents);
+            }
+            else if (!pool->dirsonly)
+            {
+                res_add(&w->res, path, dir->len + nlen);
+            }
+            else if (sub || (dl->types[k] == DT_LNK &&
+                             fstatat(dir->fd, name, &st, 0) == 0 &&
+                             S_ISDIR(st.st_mode)))
+            {
+                path[dir->len + nlen] = '/';
+                path[dir->len + nlen + 1] = '\0';
+                res_add(&w->res, path, dir->len + nlen + 1);
+            }
+        }
+
+        if (sub && name[0] != '.')
+        {
+            __atomic_add_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL);
+            deque_push(pool, dq, dir, strdup(name));
+        }
+    }
+    dirlist_free(dl);
+    walk_dir_put(dir);
+}
+
+/* walk_run - Worker loop: run own tasks, then steal, until none are left */
+static void *walk_run(void *vargp)
+{
+    struct walk_worker *w = vargp;
+    struct walk_pool *pool = w->pool;
+    struct walk_task t;
+    struct timespec nap = {0, 50000};
+    int i, idle = 0;
+    bool found;
+
+    for (;;)
+    {
+        found = deque_take(&pool->deques[w->id], false, &t);
+        for (i = 1; !found && i < pool->nworkers; i++)
+        {
+            int victim = (w->id + i + rand_r(&w->seed)) % pool->nworkers;
+            found = (victim != w->id &&
+                     deque_take(&pool->deques[victim], true, &t));
+        }
+        if (found)
+        {
+            walk_visit(w, &t);
+            __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+            idle = 0;
+            continue;
+        }
+        if (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0)
+        {
+            break;
+        }
+        if (++idle < 64)
+        {
+            sched_yield();
+        }
+        else
+        {
+            nanosleep(&nap, NULL);
+        }
+    }
+    return NULL;
+}
+
+/* walk_threads - Number of walker threads: $TSH_GLOB_THREADS, or the
+ * number of online CPUs capped at GLOB_WALK_THREADS */
+static int walk_threads(void)
+{
+    char *env = getenv("TSH_GLOB_THREADS");
+    long n;
+
+    if (env != NULL && (n = atol(env)) > 0)
+    {
+        return n < GLOB_WALK_MAXTHREADS ? n : GLOB_WALK_MAXTHREADS;
+    }
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : (n < GLOB_WALK_THREADS ? n : GLOB_WALK_THREADS);
+}
+
+/* glob_recurse - Expand "**" followed by components pats[0..n) below
+ * the directory whose path prefix is path[0..len), on a thread pool */
+static void glob_recurse(struct glob_pat **pats, int n, bool dirsonly,
+                         const char *path, size_t len, struct glob_res *res)
+{
+    struct walk_pool pool;
+    struct walk_worker *workers;
+    struct walk_dir *root;
+    sigset_t all, old;
+    size_t k;
+    int i, fd;
+
+    root = Malloc(sizeof(*root) + len + 1);
+    memcpy(root->path, path, len);
+    root->path[len] = '\0';
+    fd = open(len ? root->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        Free(root);
+        return;
+    }
+    root->fd = fd;
+    root->refs = 1;
+    root->len = len;
+
+    // a trailing "**" also matches zero directories: the base itself
+    if (n == 0 && len > 0)
+    {
+        res_add(res, root->path, len);
+    }
+
+    pool.nworkers = walk_threads();
+    pool.pats = pats;
+    pool.npats = n;
+    pool.dirsonly = dirsonly;
+    pool.pending = 0;
+    pool.deques = Calloc(pool.nworkers, sizeof(*pool.deques));
+    workers = Calloc(pool.nworkers, sizeof(*workers));
+    for (i = 0; i < pool.nworkers; i++)
+    {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        workers[i].seed = i + 1;
+        workers[i].dents = Malloc(GLOB_DENTS_BUFSIZE);
+    }
+    deque_push(&pool, &pool.deques[0], root, NULL);
+
+    // Signals stay with the shell's main thread
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 1; i < pool.nworkers; i++)
+    {
+        Pthread_create(&workers[i].tid, NULL, walk_run, &workers[i]);
+    }
+    walk_run(&workers[0]);
+    for (i = 1; i < pool.nworkers; i++)
+    {
+        Pthread_join(workers[i].tid, NULL);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    for (i = 0; i < pool.nworkers; i++)
+    {
+        for (k = 0; k < workers[i].res.n; k++)
+        {
+            if (res->n == res->cap)
+            {
+                res->cap = res->cap ? res->cap * 2 : 16;
+                res->v = Realloc(res->v, res->cap * sizeof(char *));
+            }
+            res->v[res->n++] = workers[i].res.v[k];
+        }
+        Free(workers[i].res.v);
+        Free(workers[i].dents);
+        Free(pool.deques[i].v);
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    Free(workers);
+    Free(pool.deques);
+}
+
+/* glob_walk - Match components pats[i..n) below the directory whose
+ * path (with a trailing '/', or empty for ".") is path[0..len). */
+static void glob_walk(struct glob_pat **pats, int i, int n, bool dirsonly,
+                      char *path, size_t len, struct glob_res *res)
+{
+    struct dirlist *dl;
+    struct stat st;
+    size_t k, nlen;
+
+    // plain components need no directory listing
+    while (i < n && !pats[i]->wild)
+    {
+        if (len + pats[i]->nops + 2 >= PATH_MAX)
+        {
+            return;
+        }
+        for (k = 0; k < (size_t)pats[i]->nops; k++)
+        {
+            path[len++] = pats[i]->ops[k].c;
+        }
+        if (++i < n || dirsonly)
+        {
+            path[len++] = '/';
+        }
+    }
+    if (i == n)
+    {
+        path[len] = '\0';
+        if (len > 0 && lstat(path, &st) == 0)
+        {
+            res_add(res, path, len);
+        }
+        return;
+    }
+    if (pats[i]->recurse)
+    {
+        glob_recurse(pats + i + 1, n - i - 1, dirsonly, path, len, res);
+        return;
+    }
+
+    path[len] = '\0';
+    if ((dl = dircache_get(len ? path : ".")) == NULL)
+    {
+        return;
+    }
+    for (k = 0; k < dl->nents; k++)
+    {
+        const char *name = dl->names + dl->offs[k];
+
+        if (!glob_match(pats[i], name))
+        {
+            continue;
+        }
+        nlen = strlen(name);
+        if (len + nlen + 2 >= PATH_MAX)
+        {
+            continue;
+        }
+        if (i + 1 < n || dirsonly)
+        {
+            path[len] = '\0';
+            if (!isdir(path, name, dl->types[k]))
+            {
+                continue;
+            }
+        }
+        memcpy(path + len, name, nlen);
+        if (i + 1 < n)
+        {
+            path[len + nlen] = '/';
+            glob_walk(pats, i + 1, n, dirsonly, path, len + nlen + 1, res);
+        }
+        else
+        {
+            if (dirsonly)
+            {
+                path[len + nlen++] = '/';
+            }
+            path[len + nlen] = '\0';
+            res_add(res, path, len + nlen);
+        }
+    }
+    dircache_put(dl);
+}
+
+/* cmpstr - qsort comparator for an array of strings */
+static int cmpstr(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* glob_haswild - Return true if word is a candidate for expansion */
+bool glob_haswild(const char *word)
+{
+    return strpbrk(word, "*?[") != NULL;
+}
+
+/* glob_expand - Expand word and append the sorted matches to out */
+int glob_expand(const char *word, struct glob_out *out)
+{
+    struct glob_pat *pats[PATH_MAX / 2];
+    struct glob_res res = {NULL, 0, 0};
+    char path[PATH_MAX];
+    const char *p, *slash;
+    size_t len = 0, total = 0, k;
+    bool dirsonly = false;
+    int n = 0, i, rc;
+
+    p = word;
+    if (*p == '/')
+    {
+        path[len++] = '/';
+        while (*p == '/')
+        {
+            p++;
+        }
+    }
+    while (*p)
+    {
+        slash = strchr(p, '/');
+        if (slash == NULL)
+        {
+            slash = p + strlen(p);
+        }
+        if (n == (int)(sizeof(pats) / sizeof(pats[0])))
+        {
+            break;
+        }
+        pats[n++] = glob_compile(p, slash);
+        p = slash;
+        if (*p == '/')
+        {
+            while (*p == '/')
+            {
+                p++;
+            }
+            dirsonly = (*p == '\0');
+        }
+    }
+
+    if (n > 0)
+    {
+        glob_walk(pats, 0, n, dirsonly, path, len, &res);
+    }
+    for (i = 0; i < n; i++)
+    {
+        Free(pats[i]);
+    }
+
+    qsort(res.v, res.n, sizeof(char *), cmpstr);
+    for (k = 0; k < res.n; k++)
+    {
+        total += strlen(res.v[k]) + 1;
+    }
+    if (res.n == 0)
+    {
+        rc = 0;
+    }
+    else if (out->argc + (int)res.n > out->maxargc ||
+             out->textlen + total > out->textsize)
+    {
+        rc = -1;
+    }
+    else
+    {
+        for (k = 0; k < res.n; k++)
+        {
+            len = strlen(res.v[k]) + 1;
+            memcpy(out->text + out->textlen, res.v[k], len);
+            out->argv[out->argc++] = out->text + out->textlen;
+            out->textlen += len;
+        }
+        rc = res.n;
+    }
+
+    for (k = 0; k < res.n; k++)
+    {
+        Free(res.v[k]);
+    }
+    Free(res.v);
+    return rc;
+}
@@ -0,0 +1,60 @@
+/*
+ * tsh_glob.h: pathname expansion for tshlab
+ *
+ * tsh_glob.h defines the interface used by parseline to expand words
+ * containing the wildcard characters '*', '?' and '[...]' into the
+ * sorted list of matching pathnames.
+ *
+ * Directory listings are read with getdents64 and kept in a small cache
+ * keyed by (device, inode, mtime), so repeated globs over the same large
+ * directories do not re-read them.
+ *
+ * A "**" component matches zero or more directories. The tree below it
+ * is walked with openat() by a small work-stealing thread pool, without
+ * the cache, and the matches are sorted like any other expansion. Only
+ * the first "**" in a word recurses; later ones behave like '*'.
+ */
+
+#ifndef __TSH_GLOB_H__
+#define __TSH_GLOB_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define GLOB_CACHE_DIRS     64          // max directory listings cached
+#define GLOB_CACHE_BYTES    (64<<20)    // max bytes held by the cache
+#define GLOB_DENTS_BUFSIZE  (256<<10)   // getdents64 read size
+#define GLOB_WALK_THREADS   8           // default max "**" walker threads
+#define GLOB_WALK_MAXTHREADS 64         // cap for $TSH_GLOB_THREADS
+
+// Destination for the words produced by glob_expand
+struct glob_out
+{
+    char **argv;                // Argument vector to append to
+    int argc;                   // Number of arguments in argv
+    int maxargc;                // Capacity of argv (excluding NULL slot)
+    char *text;                 // Storage for the expanded words
+    size_t textlen;             // Bytes of text in use
+    size_t textsize;            // Capacity of text
+};
+
+/*
+ * glob_haswild returns true if word contains a wildcard character,
+ * i.e. if it is a candidate for pathname expansion.
+ */
+bool glob_haswild(const char *word);
+
+/*
+ * glob_expand matches word against the file system and appends the
+ * matching pathnames, sorted, to out. It returns the number of words
+ * appended, 0 if nothing matched (out is untouched, and the caller is
+ * expected to keep the word literally), or -1 if out is too small.
+ */
+int glob_expand(const char *word, struct glob_out *out);
+
+/*
+ * glob_cache_flush drops every cached directory listing.
+ */
+void glob_cache_flush(void);
+
+#endif
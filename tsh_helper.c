@@ -3,6 +3,9 @@
  */
 
 #include "tsh_helper.h"
+#include "tsh_glob.h"
+#include "tsh_metrics.h"
+#include "tsh_trace.h"
 
 /* Global variables */
 extern char **environ;          // Defined in libc
@@ -16,19 +19,113 @@ char sbuf[MAXLINE_TSH];         // For composing sprintf messages
 typedef enum parse_state
 {
     ST_NORMAL,
-    ST_INFILE,
-    ST_OUTFILE
+    ST_REDIR
 } parse_state;
 
 
 struct job_t job_list[MAXJOBS]; // The job list
 
+/*
+ * parse_redir - Parse the redirection operator at buf into r, leaving
+ *    the file name of REDIR_OPEN for the caller. Returns a pointer past
+ *    the operator, or NULL if it names no valid descriptor.
+ */
+static char *parse_redir(char *buf, struct redir_t *r)
+{
+    size_t digits = strspn(buf, "0123456789");
+    bool input = (buf[digits] == '<');
+
+    r->fd = digits ? atoi(buf) : (input ? STDIN_FILENO : STDOUT_FILENO);
+    r->path = NULL;
+    buf += digits;
+
+    if (buf[1] == '&')                          /* [n]>&m, [n]<&m, [n]>&- */
+    {
+        buf += 2;
+        if (*buf == '-')
+        {
+            r->type = REDIR_CLOSE;
+            return buf + 1;
+        }
+        if ((digits = strspn(buf, "0123456789")) == 0)
+        {
+            return NULL;
+        }
+        r->type = REDIR_DUP;
+        r->src = atoi(buf);
+        return buf + digits;
+    }
+
+    r->type = REDIR_OPEN;
+    if (buf[1] == '>')                          /* [n]<>file, [n]>>file */
+    {
+        r->flags = input ? O_RDWR | O_CREAT : O_WRONLY | O_CREAT | O_APPEND;
+        return buf + 2;
+    }
+    r->flags = input ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC;
+    return buf + 1;
+}
+
+/*
+ * builtin_lookup - The builtin named name, or BUILTIN_NONE
+ */
+builtin_state builtin_lookup(const char *name)
+{
+    if ((strcmp(name, "quit")) == 0)        /* quit command */
+    {
+        return BUILTIN_QUIT;
+    }
+    else if ((strcmp(name, "jobs")) == 0)   /* jobs command */
+    {
+        return BUILTIN_JOBS;
+    }
+    else if ((strcmp(name, "bg")) == 0)     /* bg command */
+    {
+        return BUILTIN_BG;
+    }
+    else if ((strcmp(name, "fg")) == 0)     /* fg command */
+    {
+        return BUILTIN_FG;
+    }
+    else if ((strcmp(name, "history")) == 0) /* history command */
+    {
+        return BUILTIN_HISTORY;
+    }
+    else if ((strcmp(name, "wait")) == 0)   /* wait command */
+    {
+        return BUILTIN_WAIT;
+    }
+    else if ((strcmp(name, "timeout")) == 0) /* timeout command */
+    {
+        return BUILTIN_TIMEOUT;
+    }
+    else if ((strcmp(name, "deadline")) == 0) /* deadline command */
+    {
+        return BUILTIN_DEADLINE;
+    }
+    else if ((strcmp(name, "metrics")) == 0) /* metrics command */
+    {
+        return BUILTIN_METRICS;
+    }
+    else if ((strcmp(name, "stats")) == 0)  /* stats command */
+    {
+        return BUILTIN_STATS;
+    }
+    else if ((strcmp(name, "time")) == 0)   /* time command */
+    {
+        return BUILTIN_TIME;
+    }
+    return BUILTIN_NONE;
+}
+
 /* 
  * parseline - Parse the command line and build the argv array.
  * 
  *   cmdline:  The command line, in the form:
  *
- *                command [arguments...] [< infile] [> oufile] [&]
+ *                command [arguments...] [redirections...] [&]
+ *
+ *             where the redirections are described in tsh_redir.h.
  *
  *   token:    Pointer to a cmdline_tokens structure. The elements of this
  *             structure will be populated with the parsed tokens. Characters 
@@ -49,6 +146,10 @@ parseline_return parseline(const char *cmdline,
     char *buf;                          // ptr that traverses command line
     char *next;                         // ptr to the end of the current arg
     char *endbuf;                       // ptr to end of cmdline string
+    bool quoted;                        // true if the current arg is quoted
+    struct glob_out gout;               // destination for glob expansion
+    struct redir_t *redir;              // redirection being parsed
+    int nglob;
 
     parse_state parsing_state;          // indicates if the next token is the
                                         // input or output file
@@ -68,6 +169,14 @@ parseline_return parseline(const char *cmdline,
     token->argc = 0;
     token->infile = NULL;
     token->outfile = NULL;
+    token->outflags = 0;
+    token->nredir = 0;
+
+    gout.argv = token->argv;
+    gout.maxargc = MAXARGS-1;
+    gout.text = token->globtext;
+    gout.textlen = 0;
+    gout.textsize = MAXGLOB_TSH;
 
     /* Build the argv list */
     parsing_state = ST_NORMAL;
@@ -77,29 +186,40 @@ parseline_return parseline(const char *cmdline,
         /* Skip the white-spaces */
         buf += strspn(buf, delims);
         if (buf >= endbuf) break;
+        quoted = false;
 
         /* Check for I/O redirection specifiers */
-        if (*buf == '<')
+        next = buf + strspn(buf, "0123456789");
+        if (*next == '<' || *next == '>')
         {
-            if (token->infile) // infile already exists
+            if (parsing_state != ST_NORMAL)
             {
-                fprintf(stderr, "Error: Ambiguous I/O redirection\n");
+                break;                  // reported as a missing file name
+            }
+            if (token->nredir >= MAXREDIR)
+            {
+                fprintf(stderr, "Error: too many redirections\n");
                 return PARSELINE_ERROR;
             }
-            parsing_state = ST_INFILE;
-            buf++;
-            continue;
-        }
-
-        else if (*buf == '>')
-        {
-            if (token->outfile) // outfile already exists
+            redir = &token->redir[token->nredir];
+            if ((next = parse_redir(buf, redir)) == NULL)
+            {
+                fprintf(stderr, "Error: bad file descriptor in redirection\n");
+                return PARSELINE_ERROR;
+            }
+            if (redir->type == REDIR_OPEN &&
+                ((redir->fd == STDIN_FILENO && token->infile) ||
+                 (redir->fd == STDOUT_FILENO && token->outfile)))
             {
                 fprintf(stderr, "Error: Ambiguous I/O redirection\n");
                 return PARSELINE_ERROR;
             }
-            parsing_state = ST_OUTFILE;
-            buf++;
+            token->nredir++;
+            if (redir->type == REDIR_OPEN)
+            {
+                parsing_state = ST_REDIR;
+            }
+            buf = next;
             continue;
         }
 
@@ -108,6 +228,7 @@ parseline_return parseline(const char *cmdline,
             /* Detect quoted tokens */
             buf++;
             next = strchr(buf, *(buf-1));
+            quoted = true;
         }
        
         else
@@ -131,14 +252,36 @@ parseline_return parseline(const char *cmdline,
         switch (parsing_state)
         {
         case ST_NORMAL:
+            /* Expand wildcards; keep the word as is if nothing matches */
+            if (!quoted && glob_haswild(buf))
+            {
+                gout.argc = token->argc;
+                if ((nglob = glob_expand(buf, &gout)) < 0)
+                {
+                    fprintf(stderr, "Error: too many arguments\n");
+                    return PARSELINE_ERROR;
+                }
+                if (nglob > 0)
+                {
+                    token->argc = gout.argc;
+                    break;
+                }
+            }
             token->argv[token->argc] = buf;
             token->argc = token->argc+1;
             break;
-        case ST_INFILE:
-            token->infile = buf;
-            break;
-        case ST_OUTFILE:
-            token->outfile = buf;
+        case ST_REDIR:
+            redir = &token->redir[token->nredir - 1];
+            redir->path = buf;
+            if (redir->fd == STDIN_FILENO)
+            {
+                token->infile = buf;
+            }
+            else if (redir->fd == STDOUT_FILENO)
+            {
+                token->outfile = buf;
+                token->outflags = redir->flags;
+            }
             break;
         default:
             fprintf(stderr, "Error: Ambiguous I/O redirection\n");
@@ -166,26 +309,7 @@ parseline_return parseline(const char *cmdline,
         return PARSELINE_EMPTY;
     }
 
-    if ((strcmp(token->argv[0], "quit")) == 0)        /* quit command */
-    {
-        token->builtin = BUILTIN_QUIT;
-    }
-    else if ((strcmp(token->argv[0], "jobs")) == 0)   /* jobs command */
-    {
-        token->builtin = BUILTIN_JOBS;
-    }
-    else if ((strcmp(token->argv[0], "bg")) == 0)     /* bg command */
-    {
-        token->builtin = BUILTIN_BG;
-    }
-    else if ((strcmp(token->argv[0], "fg")) == 0)     /* fg command */
-    {
-        token->builtin = BUILTIN_FG;
-    }
-    else
-    {
-        token->builtin = BUILTIN_NONE;
-    }
+    token->builtin = builtin_lookup(token->argv[0]);
 
     // Returns 1 if job runs on background; 0 if job runs on foreground
 
@@ -200,6 +324,158 @@ parseline_return parseline(const char *cmdline,
     }
 }
 
+/*
+ * parselist - Split a command line into a list of commands.
+ *
+ *   cmdline:  The command line, in the form:
+ *
+ *                command [op command ...] [; | &]
+ *
+ *             where op is one of "&&", "||", ";" and "&". Operators
+ *             inside quoted arguments, and the '&' of redirections like
+ *             2>&1, are not recognized.
+ *
+ *   list:     Pointer to a cmdline_list structure, populated with the
+ *             commands and the operator that follows each of them.
+ *
+ * Returns the number of commands (0 for a blank line), or -1 if cmdline
+ * is incorrectly formatted.
+ */
+int parselist(const char *cmdline, struct cmdline_list *list)
+{
+    const char delims[] = " \t\r\n";
+    char *buf, *start, *next;
+    bool wordstart = true;              // buf is at the start of a word
+    const char *opname;
+    size_t oplen;
+    list_op op;
+    char c;
+
+    strncpy(list->text, cmdline, MAXLINE_TSH - 1);
+    list->text[MAXLINE_TSH - 1] = '\0';
+    list->count = 0;
+
+    for (buf = start = list->text; ; )
+    {
+        /* Skip quoted arguments, like parseline */
+        if (wordstart && (*buf == '\'' || *buf == '\"'))
+        {
+            if ((next = strchr(buf + 1, *buf)) == NULL)
+            {
+                fprintf(stderr, "Error: unmatched %c.\n", *buf);
+                return -1;
+            }
+            buf = next + 1;
+            wordstart = false;
+            continue;
+        }
+        if (*buf != '\0' && *buf != ';' &&
+            (*buf != '&' || (buf > start && strchr("<>", buf[-1]))) &&
+            !(buf[0] == '|' && buf[1] == '|'))
+        {
+            wordstart = (strchr(delims, *buf) != NULL);
+            buf++;
+            continue;
+        }
+
+        /* End of a command */
+        if (buf[0] == '&' && buf[1] == '&')
+        {
+            op = LIST_AND, opname = "&&", oplen = 2;
+        }
+        else if (buf[0] == '|')
+        {
+            op = LIST_OR, opname = "||", oplen = 2;
+        }
+        else if (buf[0] == '&')
+        {
+            op = LIST_BG, opname = "&", oplen = 1;
+        }
+        else if (buf[0] == ';')
+        {
+            op = LIST_SEQ, opname = ";", oplen = 1;
+        }
+        else
+        {
+            op = LIST_SEQ, opname = "newline", oplen = 0;
+        }
+        c = *buf;
+        *buf = '\0';
+
+        if (start[strspn(start, delims)] == '\0')
+        {
+            /* Only a blank line or a trailing ';' or '&' ends in nothing */
+            if (c == '\0' && (list->count == 0 ||
+                              list->op[list->count - 1] == LIST_SEQ ||
+                              list->op[list->count - 1] == LIST_BG))
+            {
+                break;
+            }
+            fprintf(stderr, "Error: syntax error near %s\n", opname);
+            return -1;
+        }
+        if (list->count >= MAXARGS)
+        {
+            fprintf(stderr, "Error: too many commands\n");
+            return -1;
+        }
+        list->cmd[list->count] = start;
+        list->op[list->count] = op;
+        list->count++;
+
+        if (c == '\0')
+        {
+            break;
+        }
+        buf = start = buf + oplen;
+        wordstart = true;
+    }
+    return list->count;
+}
+
+/*
+ * expand_status - Copy cmd to out (of size outsize), replacing "$?"
+ *    outside single quotes by status. Returns false if out is too small.
+ */
+bool expand_status(const char *cmd, char *out, size_t outsize, int status)
+{
+    char num[16];
+    bool squote = false, dquote = false;
+    size_t len = 0, n;
+
+    sprintf(num, "%d", status);
+    for (; *cmd; cmd++)
+    {
+        if (*cmd == '\'' && !dquote)
+        {
+            squote = !squote;
+        }
+        else if (*cmd == '\"' && !squote)
+        {
+            dquote = !dquote;
+        }
+        if (!squote && cmd[0] == '$' && cmd[1] == '?')
+        {
+            n = strlen(num);
+            if (len + n >= outsize)
+            {
+                return false;
+            }
+            memcpy(out + len, num, n);
+            len += n;
+            cmd++;
+            continue;
+        }
+        if (len + 1 >= outsize)
+        {
+            return false;
+        }
+        out[len++] = *cmd;
+    }
+    out[len] = '\0';
+    return true;
+}
+
 
 /*****************
  * Signal handlers
@@ -244,6 +520,12 @@ static void clearjob(struct job_t *job)
     job->pid = 0;
     job->jid = 0;
     job->state = UNDEF;
+    job->status = 0;
+    job->deadline = 0;
+    job->started = 0;
+    job->spawned = 0;
+    job->stats_cmd = 0;
+    job->ready_slot = -1;
     job->cmdline[0] = '\0';
 }
 
@@ -291,12 +573,19 @@ bool addjob(struct job_t *jl, pid_t pid, job_state state, const char *cmdline)
         {
             jl[i].pid = pid;
             jl[i].state = state;
+            jl[i].status = 0;
+            jl[i].deadline = 0;
+            jl[i].started = metrics_now();
+            jl[i].spawned = 0;
+            jl[i].stats_cmd = 0;
+            jl[i].ready_slot = -1;
             jl[i].jid = nextjid++;
             if (nextjid > MAXJOBS)
             {
                 nextjid = 1;
             }
             strcpy(jl[i].cmdline, cmdline);
+            trace_event(TRACE_ADDJOB, pid, jl[i].jid, UNDEF, state, 0);
             if(verbose)
             {
                 printf("Added job [%d] %d %s\n",
@@ -330,6 +619,8 @@ bool deletejob(struct job_t *jl, pid_t pid)
     {
         if (jl[i].pid == pid)
         {
+            trace_event(TRACE_DELETEJOB, pid, jl[i].jid, jl[i].state, UNDEF,
+                        0);
             clearjob(&jl[i]);
             nextjid = maxjid(jl)+1;
             return true;
@@ -505,6 +796,129 @@ void listjobs(struct job_t *jl, int output_fd)
  ******************************/
 
 
+/*****************************
+ * I/O context of builtins
+ *****************************/
+
+/* bio_init - Apply the redirections of a builtin to a new I/O context */
+bool bio_init(builtin_io *io, const struct redir_t *redir, int n)
+{
+    int vfd[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    int i, fd;
+
+    io->nopened = 0;
+    io->len = 0;
+    io->err_fd = STDERR_FILENO;
+
+    for (i = 0; i < n; i++)
+    {
+        switch (redir[i].type)
+        {
+        case REDIR_OPEN:
+            fd = open(redir[i].path, redir[i].flags | O_CLOEXEC, DEF_MODE);
+            if (fd < 0)
+            {
+                io->err_fd = vfd[STDERR_FILENO];
+                bio_error(io, "%s: %s\n", redir[i].path, strerror(errno));
+                io->len = 0;
+                bio_close(io);
+                return false;
+            }
+            io->opened[io->nopened++] = fd;
+            break;
+        case REDIR_DUP:
+            fd = (redir[i].src <= STDERR_FILENO) ? vfd[redir[i].src]
+                                                 : redir[i].src;
+            break;
+        default:
+            fd = -1;
+            break;
+        }
+        // Only stdin, stdout and stderr mean anything to a builtin
+        if (redir[i].fd <= STDERR_FILENO)
+        {
+            vfd[redir[i].fd] = fd;
+        }
+    }
+
+    io->in_fd = vfd[STDIN_FILENO];
+    io->out_fd = vfd[STDOUT_FILENO];
+    io->err_fd = vfd[STDERR_FILENO];
+    return true;
+}
+
+/* bio_flush - Write out the buffered output of a builtin */
+void bio_flush(builtin_io *io)
+{
+    if (io->len > 0 && io->out_fd >= 0)
+    {
+        rio_writen(io->out_fd, io->buf, io->len);
+    }
+    io->len = 0;
+}
+
+/* bio_printf - Buffered formatted output of a builtin */
+void bio_printf(builtin_io *io, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(io->buf + io->len, BIO_BUFSIZE - io->len, fmt, ap);
+    va_end(ap);
+    if (n >= 0 && (size_t)n >= BIO_BUFSIZE - io->len)
+    {
+        // It did not fit: flush, and format again into the empty buffer
+        bio_flush(io);
+        va_start(ap, fmt);
+        n = vsnprintf(io->buf, BIO_BUFSIZE, fmt, ap);
+        va_end(ap);
+        if (n >= BIO_BUFSIZE)
+        {
+            n = BIO_BUFSIZE - 1;
+        }
+    }
+    if (n > 0)
+    {
+        io->len += n;
+    }
+}
+
+/* bio_error - Unbuffered error message of a builtin */
+void bio_error(builtin_io *io, const char *fmt, ...)
+{
+    char msg[MAXLINE_TSH];
+    va_list ap;
+    int n;
+
+    bio_flush(io);
+    va_start(ap, fmt);
+    n = vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    if (n >= (int)sizeof(msg))
+    {
+        n = sizeof(msg) - 1;
+    }
+    if (n > 0 && io->err_fd >= 0)
+    {
+        rio_writen(io->err_fd, msg, n);
+    }
+}
+
+/* bio_close - Flush the output of a builtin and close its files */
+void bio_close(builtin_io *io)
+{
+    int i;
+
+    bio_flush(io);
+    for (i = 0; i < io->nopened; i++)
+    {
+        close(io->opened[i]);
+    }
+    io->nopened = 0;
+}
+
+
 /***********************
  * Other helper routines
  ***********************/
@@ -514,9 +928,11 @@ void listjobs(struct job_t *jl, int output_fd)
  */
 void usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpz] [-S <socket>]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -z   spawn jobs through a fork server (also $TSH_ZYGOTE)\n");
+    printf("   -S   run commands sent by clients on a Unix domain socket\n");
     exit(EXIT_FAILURE);
 }
@@ -14,12 +14,16 @@
 
 #include <assert.h>
 #include "csapp.h"
+#include "tsh_redir.h"
 #include <stdbool.h>
 
 #define MAXLINE_TSH     1024    // max line size
 #define MAXARGS         128     // max args on a command line
+#ifndef MAXJOBS                 // may be raised with -DMAXJOBS=n
 #define MAXJOBS         16      // max jobs at any point in time
+#endif
 #define MAXJID          1<<16   // max job ID
+#define MAXGLOB_TSH     (1 << 16) // max bytes of glob-expanded arguments
 
 /* 
  * Job states: FG (foreground), BG (background), ST (stopped),
@@ -57,14 +61,36 @@ typedef enum builtin_state
     BUILTIN_QUIT,
     BUILTIN_JOBS,
     BUILTIN_BG,
-    BUILTIN_FG
+    BUILTIN_FG,
+    BUILTIN_HISTORY,
+    BUILTIN_WAIT,
+    BUILTIN_TIMEOUT,
+    BUILTIN_DEADLINE,
+    BUILTIN_METRICS,
+    BUILTIN_STATS,
+    BUILTIN_TIME
 } builtin_state;
 
+// Operators between the commands of a list
+typedef enum list_op
+{
+    LIST_SEQ,                   // ';' or end of line
+    LIST_BG,                    // '&': run the command in background
+    LIST_AND,                   // "&&": run the next command on success
+    LIST_OR                     // "||": run the next command on failure
+} list_op;
+
 struct job_t                    // The job struct
 {
     pid_t pid;                  // Job PID
     int jid;                    // Job ID [1, 2, ...] defined in tsh_helper.c
     job_state state;            // UNDEF, BG, FG, or ST
+    int status;                 // 128+signal it stopped with, while ST
+    long deadline;              // ms on CLOCK_MONOTONIC it times out at, or 0
+    long started;               // ns on CLOCK_MONOTONIC it was added at
+    long spawned;               // ns it was forked at, 0 once it has changed
+    int stats_cmd;              // its command's histograms (tsh_stats.h)
+    int ready_slot;             // its exec readiness slot, or -1
     char cmdline[MAXLINE_TSH];  // Command line
 };
 
@@ -75,10 +101,36 @@ struct cmdline_tokens
     char *argv[MAXARGS];        // The arguments list
     char *infile;               // The input file
     char *outfile;              // The output file
+    int outflags;               // Flags to open outfile with
+    int nredir;                 // Number of redirections
+    struct redir_t redir[MAXREDIR]; // Redirections, in command line order
     builtin_state builtin;      // Indicates if argv[0] is a builtin command
+    char globtext[MAXGLOB_TSH]; // Words produced by pathname expansion
 
 };
 
+#define BIO_BUFSIZE     4096    // output buffered by a builtin
+
+// I/O context of a builtin: the descriptors its redirections select,
+// and its buffered output. Builtins never touch the shell's own stdio
+typedef struct
+{
+    int in_fd;                  // Standard input of the builtin
+    int out_fd;                 // Standard output, or -1 if closed
+    int err_fd;                 // Standard error, or -1 if closed
+    int opened[MAXREDIR];       // Files opened for the redirections
+    int nopened;
+    size_t len;                 // Bytes in buf
+    char buf[BIO_BUFSIZE];      // Output not yet written to out_fd
+} builtin_io;
+
+struct cmdline_list
+{
+    char text[MAXLINE_TSH];     // Modified text from command line
+    int count;                  // Number of commands
+    char *cmd[MAXARGS];         // The commands
+    list_op op[MAXARGS];        // The operator after each command
+};
 
 // These variables are externally defined in tsh_helper.c.
 extern char prompt[];           // Command line prompt (do not change)
@@ -89,7 +141,9 @@ extern struct job_t job_list[MAXJOBS];  // The job list
 
 /*
  * parseline takes in the command line and pointer to a token struct.
- * It parses the command line and populates the token struct
+ * It parses the command line and populates the token struct.
+ * Unquoted arguments containing '*', '?' or '[' are replaced by the
+ * sorted list of matching pathnames, or kept as is if nothing matches.
  * It returns the following values of enumerated type parseline_return:
  *   PARSELINE_EMPTY        if the command line is empty
  *   PARSELINE_BG           if the user has requested a BG job
@@ -99,6 +153,25 @@ extern struct job_t job_list[MAXJOBS];  // The job list
 parseline_return parseline(const char *cmdline,
                            struct cmdline_tokens *token);
 
+/*
+ * builtin_lookup returns the builtin named name, or BUILTIN_NONE.
+ */
+builtin_state builtin_lookup(const char *name);
+
+/*
+ * parselist splits the command line into commands separated by "&&",
+ * "||", ";" and "&", outside quoted arguments, and populates the list
+ * struct. It returns the number of commands (0 if the line is blank),
+ * or -1 if cmdline is incorrectly formatted.
+ */
+int parselist(const char *cmdline, struct cmdline_list *list);
+
+/*
+ * expand_status copies cmd to out (of size outsize), replacing "$?"
+ * outside single quotes by status. It returns false if out is too small.
+ */
+bool expand_status(const char *cmd, char *out, size_t outsize, int status);
+
 /*
  * sigquit_handler terminates the shell due to SIGQUIT signal.
  */
@@ -155,6 +228,37 @@ int pid2jid(struct job_t *jl, pid_t pid);
  */
 void listjobs(struct job_t *jl, int output_fd);
 
+/*
+ * bio_init sets up the I/O context of a builtin by applying its n
+ * redirections, in order, to a copy of the shell's stdin, stdout and
+ * stderr. It opens files but never changes the shell's descriptors.
+ * It returns false, after printing an error, if a file cannot be opened.
+ */
+bool bio_init(builtin_io *io, const struct redir_t *redir, int n);
+
+/*
+ * bio_printf appends formatted output of a builtin to its buffer, which
+ * is written to out_fd when full and by bio_flush or bio_close.
+ */
+void bio_printf(builtin_io *io, const char *fmt, ...);
+
+/*
+ * bio_error writes an error message of a builtin to err_fd at once,
+ * after the output buffered before it.
+ */
+void bio_error(builtin_io *io, const char *fmt, ...);
+
+/*
+ * bio_flush writes out the buffered output of a builtin.
+ */
+void bio_flush(builtin_io *io);
+
+/*
+ * bio_close flushes the output of a builtin and closes the files its
+ * redirections opened.
+ */
+void bio_close(builtin_io *io);
+
 /*
  * usage prints the usage of the tiny shell.
  */
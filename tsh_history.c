@@ -0,0 +1,524 @@
+/* tsh_history.c
+ * command history for tshlab
+ *
+ * File layout: a struct hist_header, followed by records. Each record is
+ * a 64-bit word holding the length of the command and its state, then
+ * the command text (NUL-terminated), padded to 8 bytes.
+ *
+ * A writer claims the record at header.tail by a CAS of its word from
+ * zero to the length (state PENDING), and only then advances tail past
+ * it with a second CAS. A writer that finds the word at tail already
+ * claimed advances tail past that record itself, so a session that dies
+ * between the two CASes holds up nobody. The writer then copies the text
+ * and publishes the record by storing state DONE with release ordering.
+ * Every record below tail therefore has its length, and readers skip the
+ * ones still PENDING, including those of a session that died mid-append.
+ */
+
+#include "tsh_history.h"
+#include "csapp.h"
+#include <stdint.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+
+#define HIST_MAGIC      0x3154534948485354ULL   // "TSHHIST1"
+#define HIST_PENDING    1
+#define HIST_DONE       2
+#define HIST_ALIGN(n)   (((n) + 7) & ~(size_t)7)
+#define HIST_WORD(len, state)   (((uint64_t)(len) << 32) | (state))
+#define HIST_ANCHOR     '\001'  // marks the start of a command in trigrams
+
+struct hist_header
+{
+    uint64_t magic;
+    uint64_t capacity;          // bytes of the file in use by the mapping
+    uint64_t tail;              // offset of the next free byte
+    uint64_t reserved[5];
+};
+
+// A posting list: ids of the entries containing a trigram
+struct hist_posting
+{
+    uint32_t *ids;
+    uint32_t n;
+    uint32_t cap;
+};
+
+static int hist_fd = -1;
+static char *hist_base;                 // start of the mapping
+static size_t hist_maplen;              // bytes mapped
+static size_t hist_scanned;             // offset of the first unscanned record
+static uint64_t *hist_offs;             // offset of each entry's record
+static size_t hist_n;                   // number of entries
+static size_t hist_cap;
+static struct hist_posting *hist_index; // trigram index, NULL until needed
+static size_t hist_indexed;             // entries [0, hist_indexed) indexed
+
+#define HDR ((struct hist_header *)hist_base)
+
+
+/*****************************
+ * Mapping and file management
+ *****************************/
+
+/* hist_map - (Re)map the file to cover its current capacity */
+static bool hist_map(void)
+{
+    size_t cap = __atomic_load_n(&HDR->capacity, __ATOMIC_ACQUIRE);
+    char *base;
+
+    if (cap <= hist_maplen)
+    {
+        return true;
+    }
+    base = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, hist_fd, 0);
+    if (base == MAP_FAILED)
+    {
+        return false;
+    }
+    munmap(hist_base, hist_maplen);
+    hist_base = base;
+    hist_maplen = cap;
+    return true;
+}
+
+/* hist_grow - Make the file at least need bytes long. Growing is the
+ * only operation that takes the file lock; appends never do. */
+static bool hist_grow(size_t need)
+{
+    size_t cap;
+    bool ok = true;
+
+    flock(hist_fd, LOCK_EX);
+    cap = __atomic_load_n(&HDR->capacity, __ATOMIC_ACQUIRE);
+    if (cap < need)
+    {
+        while (cap < need)
+        {
+            cap *= 2;
+        }
+        ok = (ftruncate(hist_fd, cap) == 0);
+        if (ok)
+        {
+            __atomic_store_n(&HDR->capacity, cap, __ATOMIC_RELEASE);
+        }
+    }
+    flock(hist_fd, LOCK_UN);
+    return ok && hist_map();
+}
+
+/* hist_open - Open or create the history file; -1 if it is unusable */
+static int hist_open(const char *path)
+{
+    struct hist_header hdr;
+    struct stat st;
+    int fd;
+
+    if (path != NULL)
+    {
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    }
+    else
+    {
+        fd = syscall(SYS_memfd_create, "tsh_history", MFD_CLOEXEC);
+    }
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &st) < 0)
+    {
+        goto fail;
+    }
+    if (st.st_size == 0)
+    {
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = HIST_MAGIC;
+        hdr.capacity = HIST_INITSIZE;
+        hdr.tail = sizeof(hdr);
+        if (ftruncate(fd, HIST_INITSIZE) < 0 ||
+            pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        {
+            goto fail;
+        }
+    }
+    else if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+             hdr.magic != HIST_MAGIC || hdr.capacity > (uint64_t)st.st_size)
+    {
+        goto fail;
+    }
+    flock(fd, LOCK_UN);
+    return fd;
+
+fail:
+    flock(fd, LOCK_UN);
+    close(fd);
+    return -1;
+}
+
+/* hist_init - Open and map the history */
+void hist_init(const char *path)
+{
+    if (path != NULL && (hist_fd = hist_open(path)) < 0)
+    {
+        fprintf(stderr, "tsh: %s: unusable history file, "
+                "history will not be saved\n", path);
+    }
+    if (hist_fd < 0 && (hist_fd = hist_open(NULL)) < 0)
+    {
+        unix_error("hist_init error");
+    }
+    hist_base = Mmap(NULL, sizeof(struct hist_header),
+                     PROT_READ | PROT_WRITE, MAP_SHARED, hist_fd, 0);
+    hist_maplen = sizeof(struct hist_header);
+    if (!hist_map())
+    {
+        unix_error("hist_init mmap error");
+    }
+    hist_scanned = sizeof(struct hist_header);
+}
+
+
+/****************
+ * Trigram index
+ ****************/
+
+/* ngram_bucket - Hash a trigram to its index bucket */
+static uint32_t ngram_bucket(unsigned char a, unsigned char b,
+                             unsigned char c)
+{
+    uint32_t g = a | (b << 8) | ((uint32_t)c << 16);
+    return (g * 2654435761u) >> (32 - HIST_NGRAM_BITS);
+}
+
+/* index_entry - Add entry id (text s) to the posting lists of each of
+ * its trigrams. The text is prefixed with HIST_ANCHOR so that prefix
+ * searches can use the trigrams of the command's first characters. */
+static void index_entry(uint32_t id, const char *s)
+{
+    unsigned char a = HIST_ANCHOR, b, c;
+    struct hist_posting *p;
+
+    if (s[0] == '\0')
+    {
+        return;
+    }
+    b = s[0];
+    for (s++; *s; s++)
+    {
+        c = *s;
+        p = &hist_index[ngram_bucket(a, b, c)];
+        if (p->n == 0 || p->ids[p->n - 1] != id)
+        {
+            if (p->n == p->cap)
+            {
+                p->cap = p->cap ? p->cap * 2 : 4;
+                p->ids = Realloc(p->ids, p->cap * sizeof(uint32_t));
+            }
+            p->ids[p->n++] = id;
+        }
+        a = b;
+        b = c;
+    }
+}
+
+/* hist_text - Text of entry i (0-based) */
+static const char *hist_text(size_t i)
+{
+    return hist_base + hist_offs[i] + sizeof(uint64_t);
+}
+
+/* hist_sync - Pick up records appended since the last call, by this
+ * or any other session, and index them if the index is in use */
+static void hist_sync(void)
+{
+    size_t tail = __atomic_load_n(&HDR->tail, __ATOMIC_ACQUIRE);
+    uint64_t word;
+
+    if (tail > hist_maplen && !hist_map())
+    {
+        return;
+    }
+    while (hist_scanned + sizeof(uint64_t) <= tail)
+    {
+        word = __atomic_load_n((uint64_t *)(hist_base + hist_scanned),
+                               __ATOMIC_ACQUIRE);
+        if (word == 0)
+        {
+            break;                          // never below tail; be safe
+        }
+        if ((word & 0xff) == HIST_DONE)
+        {
+            if (hist_n == hist_cap)
+            {
+                hist_cap = hist_cap ? hist_cap * 2 : 1024;
+                hist_offs = Realloc(hist_offs, hist_cap * sizeof(uint64_t));
+            }
+            hist_offs[hist_n++] = hist_scanned;
+        }
+        hist_scanned += sizeof(uint64_t) + HIST_ALIGN((word >> 32) + 1);
+    }
+
+    if (hist_index != NULL)
+    {
+        for (; hist_indexed < hist_n; hist_indexed++)
+        {
+            index_entry(hist_indexed, hist_text(hist_indexed));
+        }
+    }
+}
+
+
+/*************
+ * Public API
+ *************/
+
+/* hist_add - Append cmdline to the history */
+void hist_add(const char *cmdline)
+{
+    size_t len = strlen(cmdline);
+    size_t size = sizeof(uint64_t) + HIST_ALIGN(len + 1);
+    uint64_t tail, word, *rec;
+
+    if (hist_base == NULL || len > UINT32_MAX)
+    {
+        return;
+    }
+    for (;;)
+    {
+        tail = __atomic_load_n(&HDR->tail, __ATOMIC_ACQUIRE);
+        if (tail + size > __atomic_load_n(&HDR->capacity, __ATOMIC_ACQUIRE))
+        {
+            if (!hist_grow(tail + size))
+            {
+                return;
+            }
+            continue;
+        }
+        if (tail + size > hist_maplen && !hist_map())
+        {
+            return;
+        }
+
+        // claim the record at tail, then move tail past it
+        rec = (uint64_t *)(hist_base + tail);
+        word = 0;
+        if (__atomic_compare_exchange_n(rec, &word,
+                                        HIST_WORD(len, HIST_PENDING), false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            __atomic_compare_exchange_n(&HDR->tail, &tail, tail + size,
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE);
+            break;
+        }
+
+        // another session claimed it: help it by moving tail past it
+        __atomic_compare_exchange_n(&HDR->tail, &tail, tail +
+                                    sizeof(uint64_t) +
+                                    HIST_ALIGN((word >> 32) + 1),
+                                    false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE);
+    }
+
+    memcpy(rec + 1, cmdline, len + 1);
+    __atomic_store_n(rec, HIST_WORD(len, HIST_DONE), __ATOMIC_RELEASE);
+}
+
+/* hist_lookup - Return the text of the command named by the reference
+ * at p ("!!", "!n" or "!-n"), storing its length in *reflen, or NULL */
+static const char *hist_lookup(const char *p, size_t *reflen)
+{
+    char *end;
+    long n;
+
+    if (p[1] == '!')
+    {
+        *reflen = 2;
+        n = hist_n;
+    }
+    else
+    {
+        n = strtol(p + 1, &end, 10);
+        *reflen = end - p;
+        if (n < 0)
+        {
+            n += hist_n + 1;
+        }
+    }
+    if (n < 1 || (size_t)n > hist_n)
+    {
+        return NULL;
+    }
+    return hist_text(n - 1);
+}
+
+/* hist_expand - Replace history references in cmdline */
+int hist_expand(const char *cmdline, char *out, size_t outsize)
+{
+    const char *p, *text;
+    size_t len = 0, reflen, tlen;
+    bool squote = false, found = false;
+
+    for (p = cmdline; *p; )
+    {
+        if (*p == '\'')
+        {
+            squote = !squote;
+        }
+        if (!squote && p[0] == '!' &&
+            (p[1] == '!' || isdigit((unsigned char)p[1]) ||
+             (p[1] == '-' && isdigit((unsigned char)p[2]))))
+        {
+            if (!found)
+            {
+                hist_sync();
+                found = true;
+            }
+            if ((text = hist_lookup(p, &reflen)) == NULL)
+            {
+                fprintf(stderr, "tsh: %.*s: event not found\n",
+                        (int)reflen, p);
+                return -1;
+            }
+            tlen = strlen(text);
+            if (len + tlen >= outsize)
+            {
+                fprintf(stderr, "Error: command line too long\n");
+                return -1;
+            }
+            memcpy(out + len, text, tlen);
+            len += tlen;
+            p += reflen;
+            continue;
+        }
+        if (len + 1 >= outsize)
+        {
+            fprintf(stderr, "Error: command line too long\n");
+            return -1;
+        }
+        out[len++] = *p++;
+    }
+    out[len] = '\0';
+    return found;
+}
+
+/* hist_print - Buffer "  n  text" for entry i, flushing when needed */
+static void hist_print(int fd, char *buf, size_t *len, size_t i)
+{
+    const char *text = hist_text(i);
+    size_t tlen = strlen(text);
+
+    if (*len + tlen + 32 > MAXBUF)
+    {
+        rio_writen(fd, buf, *len);
+        *len = 0;
+    }
+    if (tlen + 32 > MAXBUF)
+    {
+        tlen = MAXBUF - 32;
+    }
+    *len += sprintf(buf + *len, "%5zu  %.*s\n", i + 1, (int)tlen, text);
+}
+
+/* hist_search - Print the entries matching pat using the trigram index.
+ * Candidates come from the shortest posting list among pat's trigrams
+ * and are then checked with strstr (or strncmp, for anchored patterns);
+ * patterns too short to have a trigram fall back to a linear scan. */
+static void hist_search(const char *pat, int fd, char *buf, size_t *len)
+{
+    struct hist_posting *best = NULL, *p;
+    bool anchored = (pat[0] == '^');
+    unsigned char a, b, c;
+    const char *s, *text;
+    size_t i, plen;
+
+    if (hist_index == NULL)
+    {
+        hist_index = Calloc(1 << HIST_NGRAM_BITS, sizeof(*hist_index));
+        hist_indexed = 0;
+        hist_sync();
+    }
+    if (anchored)
+    {
+        pat++;
+    }
+    plen = strlen(pat);
+
+    s = pat;
+    if (anchored && plen >= 2)
+    {
+        a = HIST_ANCHOR;
+    }
+    else if (plen >= 3)
+    {
+        a = *s++;
+    }
+    else
+    {
+        s = NULL;
+    }
+    if (s != NULL)
+    {
+        for (b = *s++; *s; s++)
+        {
+            c = *s;
+            p = &hist_index[ngram_bucket(a, b, c)];
+            if (best == NULL || p->n < best->n)
+            {
+                best = p;
+            }
+            a = b;
+            b = c;
+        }
+    }
+
+    for (i = 0; i < (best ? best->n : hist_n); i++)
+    {
+        size_t id = best ? best->ids[i] : i;
+
+        text = hist_text(id);
+        if (anchored ? strncmp(text, pat, plen) == 0
+                     : strstr(text, pat) != NULL)
+        {
+            hist_print(fd, buf, len, id);
+        }
+    }
+}
+
+/* hist_builtin - Run the history builtin */
+void hist_builtin(int argc, char **argv, int output_fd)
+{
+    char buf[MAXBUF];
+    size_t len = 0, i, first = 0;
+    long n;
+
+    hist_sync();
+    if (argc >= 3 && strcmp(argv[1], "-s") == 0)
+    {
+        hist_search(argv[2], output_fd, buf, &len);
+    }
+    else if (argc == 1 || (argc == 2 && (n = atol(argv[1])) > 0))
+    {
+        if (argc == 2 && (size_t)n < hist_n)
+        {
+            first = hist_n - n;
+        }
+        for (i = first; i < hist_n; i++)
+        {
+            hist_print(output_fd, buf, &len, i);
+        }
+    }
+    else
+    {
+        len = sprintf(buf, "usage: history [n | -s pattern]\n");
+    }
+    if (len > 0)
+    {
+        rio_writen(output_fd, buf, len);
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * tsh_history.h: command history for tshlab
+ *
+ * The history is an append-only log of command lines in a memory-mapped
+ * file that several tsh sessions can share. Appends reserve space with a
+ * compare-and-swap on the shared tail offset, so concurrent sessions
+ * never take a lock except to grow the file. Each session keeps an
+ * in-memory trigram index of the log for fast substring and prefix
+ * search, built on the first search and extended as the log grows.
+ */
+
+#ifndef __TSH_HISTORY_H__
+#define __TSH_HISTORY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HIST_FILENAME       ".tsh_history"  // default file, in $HOME
+#define HIST_INITSIZE       (1<<20)         // initial file size in bytes
+#define HIST_NGRAM_BITS     16              // log2 of trigram index buckets
+
+/*
+ * hist_init opens (creating it if needed) the history file at path and
+ * maps it. If path is NULL, or the file cannot be used, the history is
+ * kept in anonymous memory for the lifetime of the shell.
+ */
+void hist_init(const char *path);
+
+/*
+ * hist_add appends cmdline to the history.
+ */
+void hist_add(const char *cmdline);
+
+/*
+ * hist_expand copies cmdline to out (of size outsize), replacing the
+ * history references "!!" (last command), "!n" (command n) and "!-n"
+ * (n-th last command) outside single quotes. It returns 1 if anything
+ * was replaced, 0 if cmdline had no references, and -1 (after printing
+ * an error) if a reference names no command or out is too small.
+ */
+int hist_expand(const char *cmdline, char *out, size_t outsize);
+
+/*
+ * hist_builtin runs the history builtin with the given arguments and
+ * writes its output to output_fd:
+ *   history            list every command
+ *   history n          list the last n commands
+ *   history -s pat     list the commands containing pat; a leading '^'
+ *                      anchors pat to the start of the command
+ */
+void hist_builtin(int argc, char **argv, int output_fd);
+
+#endif
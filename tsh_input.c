@@ -0,0 +1,158 @@
+/* tsh_input.c
+ * command line input for tshlab
+ */
+
+#include "tsh_input.h"
+#include "csapp.h"
+
+/*
+ * input_fill - Read more input into the buffer, after moving the unread
+ *    bytes to its start. Like rio_read, it restarts reads interrupted by
+ *    signal handlers. Returns the number of bytes read, 0 at EOF.
+ */
+static ssize_t input_fill(input_t *ip)
+{
+    ssize_t n;
+
+    if (ip->eof)
+    {
+        return 0;
+    }
+    if (ip->bufptr != ip->buf)
+    {
+        memmove(ip->buf, ip->bufptr, ip->cnt);
+        ip->bufptr = ip->buf;
+    }
+    while ((n = read(ip->fd, ip->buf + ip->cnt, ip->bufsize - ip->cnt)) < 0)
+    {
+        if (errno != EINTR)
+        {
+            unix_error("input read error");
+        }
+    }
+    if (n == 0)
+    {
+        ip->eof = true;
+    }
+    ip->cnt += n;
+    return n;
+}
+
+/* input_init - Associate fd with the reader */
+void input_init(input_t *ip, int fd, size_t bufsize)
+{
+    ip->fd = fd;
+    ip->buf = NULL;
+    ip->bufptr = NULL;
+    ip->bufsize = 0;
+    ip->cnt = 0;
+    ip->eof = false;
+
+    if (isatty(fd))
+    {
+        // Unbuffered, so that fd being readable means a line is coming
+        // (see input_ready)
+        setvbuf(stdin, NULL, _IONBF, 0);
+        return;
+    }
+    if (bufsize == 0)
+    {
+        bufsize = INPUT_BUFSIZE;
+    }
+    if (bufsize < INPUT_MINBUF)
+    {
+        bufsize = INPUT_MINBUF;
+    }
+    ip->bufsize = bufsize;
+    ip->buf = Malloc(bufsize);
+    ip->bufptr = ip->buf;
+}
+
+/* input_readline_stdio - Read a line from a terminal with fgets */
+static ssize_t input_readline_stdio(char *line, size_t maxlen)
+{
+    size_t len;
+    int c;
+
+    if (fgets(line, maxlen, stdin) == NULL)
+    {
+        if (ferror(stdin))
+        {
+            app_error("fgets error");
+        }
+        return -1;
+    }
+    len = strlen(line);
+    if (len > 0 && line[len-1] == '\n')
+    {
+        line[--len] = '\0';
+    }
+    else if (len == maxlen - 1)
+    {
+        while ((c = getchar()) != EOF && c != '\n')
+            ;
+        fprintf(stderr, "Error: command line too long\n");
+        line[0] = '\0';
+        return 0;
+    }
+    return len;
+}
+
+/* input_readline - Read the next command line */
+ssize_t input_readline(input_t *ip, char *line, size_t maxlen)
+{
+    char *nl;
+    size_t len, consumed, scanned = 0;
+    bool toolong = false;
+
+    if (ip->buf == NULL)
+    {
+        return input_readline_stdio(line, maxlen);
+    }
+
+    for (;;)
+    {
+        nl = memchr(ip->bufptr + scanned, '\n', ip->cnt - scanned);
+        if (nl != NULL)
+        {
+            len = nl - ip->bufptr;
+            break;
+        }
+        scanned = ip->cnt;
+        if (ip->cnt == ip->bufsize)
+        {
+            // no newline in a full buffer: drop it and keep looking
+            toolong = true;
+            ip->bufptr = ip->buf;
+            ip->cnt = scanned = 0;
+        }
+        if (input_fill(ip) == 0)
+        {
+            if (ip->cnt == 0 && !toolong)
+            {
+                return -1;
+            }
+            len = ip->cnt;          // unterminated last line
+            nl = NULL;
+            break;
+        }
+    }
+
+    consumed = (nl != NULL) ? len + 1 : len;
+    if (toolong || len >= maxlen)
+    {
+        fprintf(stderr, "Error: command line too long\n");
+        len = 0;
+    }
+    memcpy(line, ip->bufptr, len);
+    line[len] = '\0';
+    ip->bufptr += consumed;
+    ip->cnt -= consumed;
+    return len;
+}
+
+/* input_ready - Can the next line be returned without reading? */
+bool input_ready(const input_t *ip)
+{
+    return ip->eof || (ip->cnt > 0 && memchr(ip->bufptr, '\n', ip->cnt));
+}
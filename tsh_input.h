@@ -0,0 +1,52 @@
+/*
+ * tsh_input.h: command line input for tshlab
+ *
+ * Interactive shells read their commands with stdio. When stdin is not a
+ * terminal (a pipe, file or socket, as when tsh runs under runtrace),
+ * commands are read through a Rio-style buffer instead: one read() fills
+ * a large buffer, and lines are split out of it with memchr, so a driver
+ * streaming commands does not pay for stdio and a syscall per line.
+ */
+
+#ifndef __TSH_INPUT_H__
+#define __TSH_INPUT_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define INPUT_BUFSIZE   (64<<10)    // default buffer size ($TSH_INPUT_BUFSIZE)
+#define INPUT_MINBUF    (4<<10)     // smallest buffer size accepted
+
+/* Persistent state for the buffered input reader */
+typedef struct
+{
+    int fd;                 // Descriptor read from
+    char *buf;              // Internal buffer
+    size_t bufsize;         // Size of buf
+    char *bufptr;           // Next unread byte in buf
+    size_t cnt;             // Unread bytes in buf
+    bool eof;               // read() returned 0
+} input_t;
+
+/*
+ * input_init prepares to read commands from fd. Unless fd is a terminal,
+ * a buffer of bufsize bytes is allocated (INPUT_BUFSIZE if bufsize is 0).
+ */
+void input_init(input_t *ip, int fd, size_t bufsize);
+
+/*
+ * input_readline reads the next command line into line (of maxlen
+ * bytes) without its trailing newline. A final line that is not
+ * terminated by a newline is returned as is. It returns the length of
+ * the line, or -1 at end of file. Lines longer than maxlen-1 bytes are
+ * reported and skipped.
+ */
+ssize_t input_readline(input_t *ip, char *line, size_t maxlen);
+
+/*
+ * input_ready returns true if input_readline can return without reading
+ * from the descriptor: a whole line is buffered, or end of file was seen.
+ */
+bool input_ready(const input_t *ip);
+
+#endif
@@ -0,0 +1,302 @@
+/* tsh_metrics.c
+ * activity metrics for tshlab
+ */
+
+#include "tsh_metrics.h"
+#include "tsh_timer.h"
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define HIST_MAXBUCKETS 10
+#define METRICS_BUFSIZE (16<<10)
+
+// Signals counted by metrics_signal, and their label values
+static const int sig_nums[] = {SIGINT, SIGTSTP, SIGCONT, SIGTERM, SIGKILL};
+static const char *sig_names[] = {"INT", "TSTP", "CONT", "TERM", "KILL"};
+#define NSIGS   (sizeof(sig_nums) / sizeof(sig_nums[0]))
+
+// A histogram; bucket i counts observations <= bound[i], and
+// bucket[nbounds] the rest. Buckets are made cumulative when written.
+struct hist
+{
+    atomic_ulong bucket[HIST_MAXBUCKETS + 1];
+    atomic_ulong count;
+    atomic_ulong sum;           // ns
+};
+
+// Upper bounds of the histogram buckets, in ns
+static const long handler_bounds[] = {
+    1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+static const long duration_bounds[] = {
+    1000000, 10000000, 100000000, 1000000000, 10000000000,
+    60000000000, 600000000000, 3600000000000
+};
+#define NBOUNDS(b)  ((int)(sizeof(b) / sizeof(b[0])))
+
+struct metrics
+{
+    atomic_ulong commands[2];   // external, builtin
+    atomic_ulong fork_failures;
+    atomic_ulong exec_failures;
+    atomic_ulong signals[NSIGS];
+    struct hist handler_reap;   // sigchld_handler start to wait returning
+    struct hist job_duration;
+};
+
+// Output buffer for metrics_write
+struct mbuf
+{
+    char *buf;
+    size_t len;
+    bool full;
+};
+
+static struct metrics *met;     // shared with the children
+static const char *export_path;
+static bool export_failing;     // the last export failed (reported once)
+
+
+/*
+ * metrics_init - Map the counters
+ */
+void metrics_init(void)
+{
+    met = mmap(NULL, sizeof(*met), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (met == MAP_FAILED)
+    {
+        unix_error("mmap error");
+    }
+}
+
+/*
+ * metrics_now - Monotonic time in ns
+ */
+long metrics_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * count - Add one to a counter
+ */
+static void count(atomic_ulong *c)
+{
+    atomic_fetch_add_explicit(c, 1, memory_order_relaxed);
+}
+
+/*
+ * observe - Record a value of ns in a histogram
+ */
+static void observe(struct hist *h, const long *bound, int nbounds, long ns)
+{
+    int i;
+
+    for (i = 0; i < nbounds && ns > bound[i]; i++)
+        ;
+    count(&h->bucket[i]);
+    count(&h->count);
+    atomic_fetch_add_explicit(&h->sum, ns, memory_order_relaxed);
+}
+
+void metrics_command(bool builtin)
+{
+    if (met != NULL)
+    {
+        count(&met->commands[builtin]);
+    }
+}
+
+void metrics_fork_failed(void)
+{
+    if (met != NULL)
+    {
+        count(&met->fork_failures);
+    }
+}
+
+void metrics_exec_failed(void)
+{
+    if (met != NULL)
+    {
+        count(&met->exec_failures);
+    }
+}
+
+void metrics_signal(int sig)
+{
+    size_t i;
+
+    for (i = 0; met != NULL && i < NSIGS; i++)
+    {
+        if (sig_nums[i] == sig)
+        {
+            count(&met->signals[i]);
+        }
+    }
+}
+
+/*
+ * metrics_reaped - Record a reaped child
+ */
+void metrics_reaped(const struct job_t *job, int status, long since)
+{
+    long now = metrics_now();
+
+    if (met == NULL)
+    {
+        return;
+    }
+    observe(&met->handler_reap, handler_bounds, NBOUNDS(handler_bounds),
+            now - since);
+    if (job != NULL && !WIFSTOPPED(status))
+    {
+        observe(&met->job_duration, duration_bounds, NBOUNDS(duration_bounds),
+                now - job->started);
+    }
+}
+
+/*
+ * put - Append to the output buffer
+ */
+static void put(struct mbuf *mb, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(mb->buf + mb->len, METRICS_BUFSIZE - mb->len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= METRICS_BUFSIZE - mb->len)
+    {
+        mb->full = true;
+        return;
+    }
+    mb->len += n;
+}
+
+/*
+ * put_hist - Append a histogram
+ */
+static void put_hist(struct mbuf *mb, const char *name, const char *help,
+                     struct hist *h, const long *bound, int nbounds)
+{
+    unsigned long cum = 0;
+    int i;
+
+    put(mb, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (i = 0; i <= nbounds; i++)
+    {
+        cum += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+        if (i < nbounds)
+        {
+            put(mb, "%s_bucket{le=\"%g\"} %lu\n", name, bound[i] / 1e9, cum);
+        }
+        else
+        {
+            put(mb, "%s_bucket{le=\"+Inf\"} %lu\n", name, cum);
+        }
+    }
+    put(mb, "%s_sum %.9f\n", name,
+        atomic_load_explicit(&h->sum, memory_order_relaxed) / 1e9);
+    put(mb, "%s_count %lu\n", name, cum);
+}
+
+/*
+ * metrics_write - Write the metrics in Prometheus text format
+ */
+bool metrics_write(int fd, struct job_t *jl)
+{
+    static char buf[METRICS_BUFSIZE];
+    struct mbuf mb = {buf, 0, false};
+    int jobs[3] = {0, 0, 0};    // FG, BG, ST
+    size_t i;
+
+    if (met == NULL)
+    {
+        return false;
+    }
+    for (i = 0; i < MAXJOBS; i++)
+    {
+        if (jl[i].pid != 0)
+        {
+            jobs[jl[i].state == FG ? 0 : jl[i].state == BG ? 1 : 2]++;
+        }
+    }
+
+    put(&mb, "# HELP tsh_commands_total Commands run.\n"
+        "# TYPE tsh_commands_total counter\n"
+        "tsh_commands_total{kind=\"external\"} %lu\n"
+        "tsh_commands_total{kind=\"builtin\"} %lu\n",
+        atomic_load(&met->commands[0]), atomic_load(&met->commands[1]));
+    put(&mb, "# HELP tsh_fork_failures_total Jobs that could not be forked.\n"
+        "# TYPE tsh_fork_failures_total counter\n"
+        "tsh_fork_failures_total %lu\n", atomic_load(&met->fork_failures));
+    put(&mb, "# HELP tsh_exec_failures_total Jobs whose program could not"
+        " be executed.\n"
+        "# TYPE tsh_exec_failures_total counter\n"
+        "tsh_exec_failures_total %lu\n", atomic_load(&met->exec_failures));
+    put(&mb, "# HELP tsh_jobs Jobs in the job list.\n"
+        "# TYPE tsh_jobs gauge\n"
+        "tsh_jobs{state=\"foreground\"} %d\n"
+        "tsh_jobs{state=\"running\"} %d\n"
+        "tsh_jobs{state=\"stopped\"} %d\n", jobs[0], jobs[1], jobs[2]);
+    put(&mb, "# HELP tsh_signals_forwarded_total Signals sent to jobs.\n"
+        "# TYPE tsh_signals_forwarded_total counter\n");
+    for (i = 0; i < NSIGS; i++)
+    {
+        put(&mb, "tsh_signals_forwarded_total{signal=\"%s\"} %lu\n",
+            sig_names[i], atomic_load(&met->signals[i]));
+    }
+    put_hist(&mb, "tsh_sigchld_handler_reap_seconds",
+             "Time from sigchld_handler starting to it reaping a child.",
+             &met->handler_reap, handler_bounds, NBOUNDS(handler_bounds));
+    put_hist(&mb, "tsh_job_duration_seconds",
+             "Time from starting a job to reaping it.",
+             &met->job_duration, duration_bounds, NBOUNDS(duration_bounds));
+
+    if (mb.full)
+    {
+        app_error("metrics_write: buffer too small");
+    }
+    return rio_writen(fd, buf, mb.len) == (ssize_t)mb.len;
+}
+
+/*
+ * metrics_export - Replace the metrics file with the current metrics
+ */
+static void metrics_export(void)
+{
+    char tmp[MAXLINE_TSH];
+    bool ok = false;
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", export_path);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) >= 0)
+    {
+        ok = metrics_write(fd, job_list);
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(tmp, export_path) == 0;
+    }
+    if (!ok && !export_failing)
+    {
+        fprintf(stderr, "tsh: cannot write metrics to %s: %s\n",
+                export_path, strerror(errno));
+    }
+    export_failing = !ok;
+}
+
+/*
+ * metrics_start - Export the metrics every interval_ms
+ */
+void metrics_start(const char *path, long interval_ms)
+{
+    export_path = path;
+    metrics_export();
+    timer_every(interval_ms, metrics_export);
+}
@@ -0,0 +1,67 @@
+/*
+ * tsh_metrics.h: activity metrics for tshlab
+ *
+ * Counters and histograms of what the shell does: commands run, fork and
+ * exec failures, signals forwarded to jobs, how far into sigchld_handler
+ * each child is reaped and how long jobs run. They are written in the
+ * Prometheus text exposition format, by the metrics builtin ("metrics >
+ * file") and, if $TSH_METRICS_FILE is set, to that file every
+ * $TSH_METRICS_INTERVAL (15s by default) for a node-exporter textfile
+ * collector. The file is written to a temporary name and renamed, so it
+ * is never seen half written.
+ *
+ * The values are lock-free atomics, updated from signal handlers as well
+ * as from the main loop. They live in a shared mapping made before any
+ * job is forked, so a child whose exec fails can count that itself.
+ */
+
+#ifndef __TSH_METRICS_H__
+#define __TSH_METRICS_H__
+
+#include <stdbool.h>
+#include "tsh_helper.h"
+
+#define METRICS_INTERVAL    "15s"   // default for $TSH_METRICS_INTERVAL
+
+/*
+ * metrics_init maps the counters. It must be called before any child is
+ * forked, including the zygote.
+ */
+void metrics_init(void);
+
+/*
+ * metrics_start writes the metrics to path every interval_ms
+ * milliseconds, using the deadline timer (see tsh_timer.h).
+ */
+void metrics_start(const char *path, long interval_ms);
+
+/*
+ * metrics_now returns the time in ns on CLOCK_MONOTONIC. It is
+ * async-signal-safe.
+ */
+long metrics_now(void);
+
+/*
+ * Event counters. All of them are async-signal-safe.
+ */
+void metrics_command(bool builtin);
+void metrics_fork_failed(void);
+void metrics_exec_failed(void);
+void metrics_signal(int sig);
+
+/*
+ * metrics_reaped records the reaping of job (which may be NULL for a
+ * child that is not a job): since is when sigchld_handler started, from
+ * metrics_now. This times the handler's own loop, not the delay from the
+ * child exiting, which the shell cannot see. Jobs that stopped only count
+ * towards that histogram, not towards the job duration.
+ */
+void metrics_reaped(const struct job_t *job, int status, long since);
+
+/*
+ * metrics_write writes all metrics to fd, with the jobs of jl counted by
+ * state. Signals must be blocked. It returns false if the write failed.
+ */
+bool metrics_write(int fd, struct job_t *jl);
+
+#endif
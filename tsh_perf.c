@@ -0,0 +1,351 @@
+/* tsh_perf.c
+ * per-job performance counters for tshlab
+ */
+
+#include "tsh_perf.h"
+#include "tsh_helper.h"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+// A counter and how to open it
+struct perf_event
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static const struct perf_event events[PERF_NCOUNTERS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+// Sent by a job along with its counter descriptors, in counter order
+struct perf_msg
+{
+    int32_t pid;
+    uint32_t mask;
+};
+
+// Counters of a running job
+struct perf_job
+{
+    pid_t pid;
+    unsigned int mask;
+    int fd[PERF_NCOUNTERS];
+};
+
+static bool usable[PERF_NCOUNTERS];
+static bool perf_enabled;
+static int perf_sock[2] = {-1, -1};     // shell's end, jobs' end
+static struct perf_job perf_jobs[MAXJOBS];
+static struct perf_counts last;         // of the last job reaped
+
+
+/*
+ * perf_open - Open counter i on the calling process
+ */
+static int perf_open(int i)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    // software events such as context switches happen in the kernel,
+    // and are permitted without excluding it
+    attr.exclude_kernel = events[i].type == PERF_TYPE_HARDWARE;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                   PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * perf_value - Read a counter, scaled up if it was multiplexed
+ */
+static uint64_t perf_value(int fd)
+{
+    uint64_t v[3];              // value, time enabled, time running
+
+    if (read(fd, v, sizeof(v)) != sizeof(v))
+    {
+        return 0;
+    }
+    if (v[2] > 0 && v[2] < v[1])
+    {
+        return (uint64_t)((double)v[0] * v[1] / v[2]);
+    }
+    return v[0];
+}
+
+/*
+ * perf_init - Probe the counters and make the socketpair
+ */
+void perf_init(void)
+{
+    char *env = getenv("TSH_PERF");
+    bool any = false;
+    int i, fd;
+
+    if (env != NULL && strcmp(env, "0") == 0)
+    {
+        return;
+    }
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+    {
+        if (i == PERF_TASK_CLOCK && usable[PERF_CYCLES])
+        {
+            continue;
+        }
+        if ((fd = perf_open(i)) >= 0)
+        {
+            usable[i] = any = true;
+            close(fd);
+        }
+    }
+    if (!any)
+    {
+        return;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, perf_sock) < 0)
+    {
+        unix_error("socketpair error");
+    }
+    fcntl(perf_sock[0], F_SETFL, O_NONBLOCK);
+    perf_enabled = true;
+}
+
+/*
+ * perf_child - Open the counters in a job and send them to the shell
+ */
+void perf_child(void)
+{
+    int fds[PERF_NCOUNTERS], n = 0, i;
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    struct perf_msg m = {getpid(), 0};
+    struct iovec iov = {&m, sizeof(m)};
+    struct msghdr msg;
+    struct cmsghdr *cm;
+
+    if (!perf_enabled)
+    {
+        return;
+    }
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+    {
+        if (usable[i] && (fds[n] = perf_open(i)) >= 0)
+        {
+            m.mask |= 1u << i;
+            n++;
+        }
+    }
+    if (n > 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(n * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, n * sizeof(int));
+        // never hold up the job if the shell has a backlog to collect
+        sendmsg(perf_sock[1], &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    for (i = 0; i < n; i++)
+    {
+        close(fds[i]);
+    }
+    close(perf_sock[1]);
+    close(perf_sock[0]);
+}
+
+/*
+ * perf_collect - Take in the counters jobs have sent
+ */
+static void perf_collect(void)
+{
+    int fds[PERF_NCOUNTERS], n, i, j, k;
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    struct perf_msg m;
+    struct iovec iov = {&m, sizeof(m)};
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct perf_job *pj;
+
+    for (;;)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        if (recvmsg(perf_sock[0], &msg, MSG_CMSG_CLOEXEC) <= 0)
+        {
+            return;
+        }
+        cm = CMSG_FIRSTHDR(&msg);
+        if (cm == NULL || cm->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+        n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cm), n * sizeof(int));
+
+        for (i = 0; i < MAXJOBS && perf_jobs[i].pid != 0; i++)
+            ;
+        if (i == MAXJOBS)
+        {
+            for (j = 0; j < n; j++)
+            {
+                close(fds[j]);
+            }
+            continue;
+        }
+        pj = &perf_jobs[i];
+        pj->pid = m.pid;
+        pj->mask = m.mask;
+        for (j = 0, k = 0; j < PERF_NCOUNTERS; j++)
+        {
+            pj->fd[j] = (m.mask & (1u << j)) && k < n ? fds[k++] : -1;
+        }
+    }
+}
+
+/*
+ * perf_find - Counters of a running job
+ */
+static struct perf_job *perf_find(pid_t pid)
+{
+    int i;
+
+    if (!perf_enabled)
+    {
+        return NULL;
+    }
+    perf_collect();
+    for (i = 0; i < MAXJOBS; i++)
+    {
+        if (perf_jobs[i].pid == pid)
+        {
+            return &perf_jobs[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * perf_fill - Read all the counters of a job
+ */
+static void perf_fill(const struct perf_job *pj, struct perf_counts *pc)
+{
+    int i;
+
+    pc->pid = pj->pid;
+    pc->mask = 0;
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+    {
+        pc->value[i] = 0;
+        if (pj->fd[i] >= 0)
+        {
+            pc->value[i] = perf_value(pj->fd[i]);
+            pc->mask |= 1u << i;
+        }
+    }
+}
+
+/*
+ * perf_read - Read the counters of a running job
+ */
+bool perf_read(pid_t pid, struct perf_counts *pc)
+{
+    struct perf_job *pj = perf_find(pid);
+
+    if (pj == NULL)
+    {
+        return false;
+    }
+    perf_fill(pj, pc);
+    return true;
+}
+
+/*
+ * perf_reaped - Read and close the counters of a finished job
+ */
+void perf_reaped(pid_t pid, const struct rusage *ru)
+{
+    struct perf_job *pj = perf_find(pid);
+    int i;
+
+    last.pid = pid;
+    last.mask = 0;
+    last.ru = *ru;
+    if (pj == NULL)
+    {
+        return;
+    }
+    perf_fill(pj, &last);
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+    {
+        if (pj->fd[i] >= 0)
+        {
+            close(pj->fd[i]);
+        }
+    }
+    pj->pid = 0;
+}
+
+/*
+ * perf_last - Final counts of the last job reaped
+ */
+bool perf_last(pid_t pid, struct perf_counts *pc)
+{
+    if (last.pid != pid || pid == 0)
+    {
+        return false;
+    }
+    *pc = last;
+    return true;
+}
+
+/*
+ * perf_format - Format counts as "name value" pairs
+ */
+void perf_format(const struct perf_counts *pc, char *buf, size_t size)
+{
+    size_t len = 0;
+    int i;
+
+    buf[0] = '\0';
+    for (i = 0; i < PERF_NCOUNTERS && len < size; i++)
+    {
+        if (!(pc->mask & (1u << i)))
+        {
+            continue;
+        }
+        if (i == PERF_TASK_CLOCK)
+        {
+            len += snprintf(buf + len, size - len, "%s%s %.3fms",
+                            len ? "  " : "", events[i].name,
+                            pc->value[i] / 1e6);
+        }
+        else
+        {
+            len += snprintf(buf + len, size - len, "%s%s %llu",
+                            len ? "  " : "", events[i].name,
+                            (unsigned long long)pc->value[i]);
+        }
+    }
+}
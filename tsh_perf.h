@@ -0,0 +1,79 @@
+/*
+ * tsh_perf.h: per-job performance counters for tshlab
+ *
+ * Each job forked by eval() opens perf_event counters on itself just
+ * before exec: cycles, instructions and cache misses where the hardware
+ * (or hypervisor) has them, task-clock instead when it does not, and
+ * page faults and context switches. The counters are opened with
+ * inherit, so they include every process of the job, and enable_on_exec,
+ * so the shell's own work in the child is not counted. The child passes
+ * the counter descriptors to the shell with SCM_RIGHTS over a socketpair
+ * made at startup, and the shell reads them while the job runs
+ * ("jobs -l") and once more when it is reaped ("time cmd").
+ *
+ * Jobs spawned by the zygote have no counters, nor do jobs started while
+ * the socketpair is full of counters the shell has not yet taken in. If
+ * perf_event_open is not permitted at all, or $TSH_PERF is "0", the shell
+ * does without.
+ */
+
+#ifndef __TSH_PERF_H__
+#define __TSH_PERF_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+typedef enum perf_counter
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_TASK_CLOCK,            // only when cycles cannot be counted
+    PERF_PAGE_FAULTS,
+    PERF_CONTEXT_SWITCHES,
+    PERF_NCOUNTERS
+} perf_counter;
+
+// Counts of one job
+struct perf_counts
+{
+    pid_t pid;
+    unsigned int mask;          // bit i set if counter i was counted
+    uint64_t value[PERF_NCOUNTERS];
+    struct rusage ru;           // once reaped
+};
+
+/*
+ * perf_init finds out which counters can be opened, and makes the
+ * socketpair jobs send them over.
+ */
+void perf_init(void);
+
+/*
+ * perf_child opens the counters in a newly forked job and sends them to
+ * the shell. It is called in the child, before the redirections.
+ */
+void perf_child(void);
+
+/*
+ * perf_read reads the counters of the running job pid into *pc. It
+ * returns false if the job has none. Signals must be blocked.
+ */
+bool perf_read(pid_t pid, struct perf_counts *pc);
+
+/*
+ * perf_reaped is called by sigchld_handler when job pid has terminated.
+ * It reads the final counts, with the job's rusage ru, and closes the
+ * counters; perf_last then returns them until the next job is reaped.
+ */
+void perf_reaped(pid_t pid, const struct rusage *ru);
+bool perf_last(pid_t pid, struct perf_counts *pc);
+
+/*
+ * perf_format writes the counts in pc to buf as "name value" pairs.
+ */
+void perf_format(const struct perf_counts *pc, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,137 @@
+/* tsh_redir.c
+ * I/O redirection for tshlab
+ */
+
+#include "tsh_redir.h"
+#include "csapp.h"
+#include <stdbool.h>
+#include <sys/syscall.h>
+#include <linux/close_range.h>
+
+static int keepfd[MAXKEEPFD];   // inherited descriptors above stderr
+static int nkeepfd;
+
+/*
+ * redir_init - Record the descriptors above stderr that are open when
+ *    the shell starts, from /proc/self/fd or by probing if /proc is not
+ *    mounted
+ */
+void redir_init(void)
+{
+    struct dirent *de;
+    DIR *dir;
+    int fd;
+
+    nkeepfd = 0;
+    if ((dir = opendir("/proc/self/fd")) != NULL)
+    {
+        while ((de = readdir(dir)) != NULL && nkeepfd < MAXKEEPFD)
+        {
+            fd = atoi(de->d_name);
+            if (fd > STDERR_FILENO && fd != dirfd(dir))
+            {
+                keepfd[nkeepfd++] = fd;
+            }
+        }
+        closedir(dir);
+        return;
+    }
+    for (fd = STDERR_FILENO + 1; fd < 1024 && nkeepfd < MAXKEEPFD; fd++)
+    {
+        if (fcntl(fd, F_GETFD) >= 0)
+        {
+            keepfd[nkeepfd++] = fd;
+        }
+    }
+}
+
+/*
+ * cmpint - qsort comparator for ints
+ */
+static int cmpint(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * redir_closerest - Mark close on exec every descriptor that is not
+ *    standard, redirected by one of the n actions or inherited. Calls
+ *    close_range once per gap between the descriptors kept.
+ */
+static void redir_closerest(const struct redir_t *redir, int n)
+{
+    int keep[3 + MAXKEEPFD + MAXREDIR];
+    unsigned lo = 0;
+    int i, nkeep = 0;
+
+    for (i = 0; i <= STDERR_FILENO; i++)
+    {
+        keep[nkeep++] = i;
+    }
+    for (i = 0; i < nkeepfd; i++)
+    {
+        keep[nkeep++] = keepfd[i];
+    }
+    for (i = 0; i < n; i++)
+    {
+        keep[nkeep++] = redir[i].fd;
+    }
+    qsort(keep, nkeep, sizeof(int), cmpint);
+
+    for (i = 0; i < nkeep; i++)
+    {
+        if ((unsigned)keep[i] > lo)
+        {
+            syscall(SYS_close_range, lo, keep[i] - 1, CLOSE_RANGE_CLOEXEC);
+        }
+        if ((unsigned)keep[i] + 1 > lo)
+        {
+            lo = keep[i] + 1;
+        }
+    }
+    // Older kernels lack close_range; the descriptors then stay open
+    syscall(SYS_close_range, lo, ~0U, CLOSE_RANGE_CLOEXEC);
+}
+
+/*
+ * redir_apply - Apply the redirections of a command in the child
+ */
+void redir_apply(const struct redir_t *redir, int n)
+{
+    const struct redir_t *r;
+    int i, fd;
+
+    for (i = 0; i < n; i++)
+    {
+        r = &redir[i];
+        switch (r->type)
+        {
+        case REDIR_OPEN:
+            fd = Open(r->path, r->flags | O_CLOEXEC, DEF_MODE);
+            if (fd != r->fd)
+            {
+                Dup2(fd, r->fd);
+                close(fd);
+            }
+            else
+            {
+                fcntl(fd, F_SETFD, 0);
+            }
+            break;
+        case REDIR_DUP:
+            if (r->src != r->fd)
+            {
+                Dup2(r->src, r->fd);
+            }
+            else if (fcntl(r->fd, F_SETFD, 0) < 0)
+            {
+                unix_error("Dup2 error");
+            }
+            break;
+        case REDIR_CLOSE:
+            close(r->fd);
+            break;
+        }
+    }
+    redir_closerest(redir, n);
+}
@@ -0,0 +1,58 @@
+/*
+ * tsh_redir.h: I/O redirection for tshlab
+ *
+ * parseline turns the redirections of a command into an ordered list of
+ * actions, which the child applies just before exec:
+ *   [n]<file   open file for reading on n (default 0)
+ *   [n]>file   open file for writing on n (default 1), truncating it
+ *   [n]>>file  open file for appending on n (default 1)
+ *   [n]<>file  open file for reading and writing on n (default 0)
+ *   [n]>&m     make n (default 1) a copy of m; [n]<&m likewise (default 0)
+ *   [n]>&-     close n
+ * Actions apply in command line order, so ">out 2>&1" sends both stdout
+ * and stderr to out, while "2>&1 >out" sends stderr to the old stdout.
+ *
+ * The job then gets only its stdin, stdout and stderr, the descriptors
+ * the redirections name, and those that the shell itself inherited when
+ * it started (like the SYNCFD socket of the trace driver). Every other
+ * descriptor of the shell is closed on exec with close_range, at a cost
+ * that does not grow with the number of descriptors the shell holds.
+ */
+
+#ifndef __TSH_REDIR_H__
+#define __TSH_REDIR_H__
+
+#define MAXREDIR        16      // max redirections per command
+#define MAXKEEPFD       64      // max inherited descriptors kept for jobs
+
+typedef enum redir_type
+{
+    REDIR_OPEN,                 // open path on fd
+    REDIR_DUP,                  // dup src onto fd
+    REDIR_CLOSE                 // close fd
+} redir_type;
+
+struct redir_t                  // One redirection action
+{
+    redir_type type;
+    int fd;                     // Descriptor redirected
+    int flags;                  // Flags for open (REDIR_OPEN)
+    int src;                    // Descriptor copied (REDIR_DUP)
+    char *path;                 // File opened (REDIR_OPEN)
+};
+
+/*
+ * redir_init records the descriptors the shell inherited, which jobs
+ * keep. It must run before the shell opens any file of its own.
+ */
+void redir_init(void);
+
+/*
+ * redir_apply applies the n actions of redir in order, then marks close
+ * on exec every descriptor that is neither standard, redirected nor
+ * inherited. It runs in the child between fork and exec, and on error
+ * prints a message and exits the child with status 1.
+ */
+void redir_apply(const struct redir_t *redir, int n);
+
+#endif
@@ -0,0 +1,449 @@
+/* tsh_server.c
+ * command-server mode for tshlab
+ */
+
+#include "tsh_server.h"
+#include "tsh_helper.h"
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+
+#define DONE_RING   (2 * MAXJOBS)   // > max jobs reaped between wakeups
+
+// A terminated job, queued by the SIGCHLD handler
+struct server_done
+{
+    pid_t pid;
+    int status;
+    struct rusage ru;
+};
+
+// A client connection
+struct conn
+{
+    int fd;
+    unsigned gen;               // tells reuses of the same fd apart
+    unsigned seq;               // requests received so far
+    size_t inlen;
+    char in[4 + MAXLINE_TSH];   // partial request frame
+    char *out;                  // reply frames not yet written
+    size_t outlen;
+    size_t outcap;
+    bool want_out;              // EPOLLOUT is enabled
+};
+
+// A submitted command line, queued or running
+struct request
+{
+    int fd;                     // client connection
+    unsigned gen;
+    unsigned seq;
+    pid_t pid;                  // 0 until the job is started
+    struct timespec start;
+    struct request *next;
+    char cmdline[];
+};
+
+static volatile sig_atomic_t serving;
+static struct server_done done_ring[DONE_RING];
+static volatile unsigned done_head;     // written by the SIGCHLD handler
+static unsigned done_tail;
+static int selfpipe[2];                 // wakes epoll_wait after a reap
+
+static int epfd;
+static struct conn **conns;             // indexed by fd
+static int nconns;
+static unsigned conngen;
+static struct request *queue_head, *queue_tail;
+static struct request *running[MAXJOBS];
+static int nrunning;
+
+
+/*******************
+ * Client connections
+ *******************/
+
+/* conn_events - Update the epoll registration of c */
+static void conn_events(struct conn *c, bool want_out)
+{
+    struct epoll_event ev;
+
+    if (c->want_out == want_out)
+    {
+        return;
+    }
+    ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+    ev.data.fd = c->fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = want_out;
+}
+
+/* conn_new - Register the freshly accepted descriptor fd */
+static void conn_new(int fd)
+{
+    struct epoll_event ev;
+    struct conn *c;
+
+    if (fd >= nconns)
+    {
+        int n = nconns ? nconns : 64;
+        while (n <= fd)
+        {
+            n *= 2;
+        }
+        conns = Realloc(conns, n * sizeof(*conns));
+        memset(conns + nconns, 0, (n - nconns) * sizeof(*conns));
+        nconns = n;
+    }
+    c = Calloc(1, sizeof(*c));
+    c->fd = fd;
+    c->gen = ++conngen;
+    conns[fd] = c;
+
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        unix_error("epoll_ctl error");
+    }
+}
+
+/* conn_close - Drop a client. Replies to its pending requests are
+ * discarded when they complete, since the generation no longer matches */
+static void conn_close(struct conn *c)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    conns[c->fd] = NULL;
+    Free(c->out);
+    Free(c);
+}
+
+/* conn_flush - Write as much pending output as the socket takes */
+static void conn_flush(struct conn *c)
+{
+    ssize_t n;
+
+    while (c->outlen > 0)
+    {
+        n = send(c->fd, c->out, c->outlen, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                conn_close(c);
+                return;
+            }
+            break;
+        }
+        memmove(c->out, c->out + n, c->outlen - n);
+        c->outlen -= n;
+    }
+    conn_events(c, c->outlen > 0);
+}
+
+/* conn_reply - Send a reply frame to the client of request r, if it is
+ * still connected */
+static void conn_reply(struct request *r, const char *text)
+{
+    struct conn *c = (r->fd < nconns) ? conns[r->fd] : NULL;
+    size_t len = strlen(text);
+    uint32_t hdr = htonl(len);
+
+    if (c == NULL || c->gen != r->gen)
+    {
+        return;
+    }
+    if (c->outlen + len + 4 > c->outcap)
+    {
+        c->outcap = 2 * (c->outlen + len + 4);
+        c->out = Realloc(c->out, c->outcap);
+    }
+    memcpy(c->out + c->outlen, &hdr, 4);
+    memcpy(c->out + c->outlen + 4, text, len);
+    c->outlen += len + 4;
+    conn_flush(c);
+}
+
+/* conn_read - Read from a client and queue every complete request */
+static void conn_read(struct conn *c)
+{
+    struct request *r;
+    uint32_t len;
+    ssize_t n;
+
+    n = recv(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen, MSG_DONTWAIT);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return;
+    }
+    if (n <= 0)
+    {
+        conn_close(c);
+        return;
+    }
+    c->inlen += n;
+
+    while (c->inlen >= 4)
+    {
+        memcpy(&len, c->in, 4);
+        len = ntohl(len);
+        if (len == 0 || len >= MAXLINE_TSH)
+        {
+            conn_close(c);                  // not speaking our protocol
+            return;
+        }
+        if (c->inlen < 4 + len)
+        {
+            break;
+        }
+        r = Malloc(sizeof(*r) + len + 1);
+        r->fd = c->fd;
+        r->gen = c->gen;
+        r->seq = ++c->seq;
+        r->pid = 0;
+        r->next = NULL;
+        memcpy(r->cmdline, c->in + 4, len);
+        r->cmdline[len] = '\0';
+        if (queue_tail)
+        {
+            queue_tail->next = r;
+        }
+        else
+        {
+            queue_head = r;
+        }
+        queue_tail = r;
+
+        c->inlen -= 4 + len;
+        memmove(c->in, c->in + 4 + len, c->inlen);
+    }
+}
+
+
+/*****************
+ * Job management
+ *****************/
+
+/* server_reaped - Queue a terminated job for the event loop */
+void server_reaped(pid_t pid, int status, const struct rusage *ru)
+{
+    int olderrno = errno;
+    struct server_done *d;
+
+    if (!serving)
+    {
+        return;
+    }
+    d = &done_ring[done_head % DONE_RING];
+    d->pid = pid;
+    d->status = status;
+    d->ru = *ru;
+    done_head++;
+    if (write(selfpipe[1], "", 1) < 0)
+    {
+        // the pipe is full, so the loop is already due to wake up
+    }
+    errno = olderrno;
+}
+
+/* server_collect - Reply to the clients of jobs that have terminated */
+static void server_collect(void)
+{
+    char reply[SERVER_MAXREPLY], status[32];
+    struct server_done d;
+    struct timespec now;
+    sigset_t mask, prev;
+    int i;
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    for (;;)
+    {
+        Sigprocmask(SIG_BLOCK, &mask, &prev);
+        if (done_tail == done_head)
+        {
+            Sigprocmask(SIG_SETMASK, &prev, NULL);
+            return;
+        }
+        d = done_ring[done_tail++ % DONE_RING];
+        Sigprocmask(SIG_SETMASK, &prev, NULL);
+
+        for (i = 0; i < nrunning && running[i]->pid != d.pid; i++)
+            ;
+        if (i == nrunning)
+        {
+            continue;                       // not one of ours
+        }
+        struct request *r = running[i];
+        running[i] = running[--nrunning];
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (WIFSIGNALED(d.status))
+        {
+            sprintf(status, "signal:%d", WTERMSIG(d.status));
+        }
+        else
+        {
+            sprintf(status, "exit:%d", WEXITSTATUS(d.status));
+        }
+        snprintf(reply, sizeof(reply),
+                 "seq=%u pid=%d status=%s wall=%.6f utime=%ld.%06ld "
+                 "stime=%ld.%06ld maxrss=%ld",
+                 r->seq, (int)d.pid, status,
+                 (now.tv_sec - r->start.tv_sec) +
+                 (now.tv_nsec - r->start.tv_nsec) / 1e9,
+                 (long)d.ru.ru_utime.tv_sec, (long)d.ru.ru_utime.tv_usec,
+                 (long)d.ru.ru_stime.tv_sec, (long)d.ru.ru_stime.tv_usec,
+                 d.ru.ru_maxrss);
+        conn_reply(r, reply);
+        Free(r);
+    }
+}
+
+/* server_dispatch - Start queued requests while the job list has room */
+static void server_dispatch(pid_t (*spawn)(const char *cmdline))
+{
+    char reply[SERVER_MAXREPLY];
+    struct request *r;
+
+    while (queue_head != NULL && nrunning < MAXJOBS)
+    {
+        r = queue_head;
+        queue_head = r->next;
+        if (queue_head == NULL)
+        {
+            queue_tail = NULL;
+        }
+        if (r->fd >= nconns || conns[r->fd] == NULL ||
+            conns[r->fd]->gen != r->gen)
+        {
+            Free(r);                        // client went away
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &r->start);
+        if ((r->pid = spawn(r->cmdline)) == 0)
+        {
+            snprintf(reply, sizeof(reply),
+                     "seq=%u status=error msg=not an external command",
+                     r->seq);
+            conn_reply(r, reply);
+            Free(r);
+            continue;
+        }
+        running[nrunning++] = r;
+    }
+}
+
+
+/*************
+ * Event loop
+ *************/
+
+/* server_listen - Create the listening socket at path */
+static int server_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        app_error("server socket path too long");
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    fd = Socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    Bind(fd, (SA *)&addr, sizeof(addr));
+    Listen(fd, LISTENQ);
+    return fd;
+}
+
+/* server_run - Serve clients on the socket at path */
+void server_run(const char *path, pid_t (*spawn)(const char *cmdline))
+{
+    struct epoll_event ev, events[SERVER_MAXEVENTS];
+    char drain[64];
+    int listenfd, fd, i, n;
+
+    listenfd = server_listen(path);
+    if (pipe(selfpipe) < 0)
+    {
+        unix_error("pipe error");
+    }
+    for (i = 0; i < 2; i++)
+    {
+        fcntl(selfpipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(selfpipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        unix_error("epoll_create1 error");
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = listenfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+    ev.data.fd = selfpipe[0];
+    epoll_ctl(epfd, EPOLL_CTL_ADD, selfpipe[0], &ev);
+    serving = 1;
+
+    if (verbose)
+    {
+        printf("tsh: serving on %s\n", path);
+        fflush(stdout);
+    }
+
+    for (;;)
+    {
+        n = epoll_wait(epfd, events, SERVER_MAXEVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            unix_error("epoll_wait error");
+        }
+        for (i = 0; i < n; i++)
+        {
+            fd = events[i].data.fd;
+            if (fd == listenfd)
+            {
+                // The csapp Accept wrapper exits on EAGAIN, which the
+                // non-blocking listening socket returns once drained
+                while ((fd = accept(listenfd, NULL, NULL)) >= 0)
+                {
+                    fcntl(fd, F_SETFL, O_NONBLOCK);
+                    fcntl(fd, F_SETFD, FD_CLOEXEC);
+                    conn_new(fd);
+                }
+            }
+            else if (fd == selfpipe[0])
+            {
+                while (read(selfpipe[0], drain, sizeof(drain)) > 0)
+                    ;
+                server_collect();
+            }
+            else if (fd < nconns && conns[fd] != NULL)
+            {
+                if (events[i].events & EPOLLOUT)
+                {
+                    conn_flush(conns[fd]);
+                }
+                if (fd < nconns && conns[fd] != NULL &&
+                    (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                {
+                    conn_read(conns[fd]);
+                }
+            }
+        }
+        server_dispatch(spawn);
+    }
+}
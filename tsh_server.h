@@ -0,0 +1,45 @@
+/*
+ * tsh_server.h: command-server mode for tshlab
+ *
+ * With -S path, tsh listens on a Unix domain stream socket instead of
+ * reading stdin, and runs the commands that local clients submit as
+ * background jobs in its job list. One epoll loop serves every client;
+ * there is no thread per client.
+ *
+ * Protocol: every message, in both directions, is a frame made of a
+ * 32-bit length in network byte order followed by that many bytes.
+ *   request:  a command line (at most MAXLINE_TSH-1 bytes, no NUL)
+ *   reply:    one line of text per request, sent when the job is done:
+ *             "seq=<n> pid=<pid> status=exit:<code> wall=<s> utime=<s>
+ *              stime=<s> maxrss=<kB>"
+ *             (status=signal:<signum> if a signal killed the job), or
+ *             "seq=<n> status=error msg=<text>" if it could not run.
+ * seq numbers a client's requests in the order sent, starting at 1.
+ * Replies come in completion order. While the job list is full, new
+ * requests wait in a queue.
+ */
+
+#ifndef __TSH_SERVER_H__
+#define __TSH_SERVER_H__
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#define SERVER_MAXEVENTS    256     // epoll events handled per wakeup
+#define SERVER_MAXREPLY     256     // max bytes of one reply
+
+/*
+ * server_run serves clients on the socket at path until the shell is
+ * killed. spawn runs one command line in the background, and returns
+ * the pid of its job or 0 if it did not start one.
+ */
+void server_run(const char *path, pid_t (*spawn)(const char *cmdline));
+
+/*
+ * server_reaped tells the server that the job with process ID pid has
+ * terminated. It is async-signal-safe, to be called from the SIGCHLD
+ * handler, and does nothing unless the shell is serving.
+ */
+void server_reaped(pid_t pid, int status, const struct rusage *ru);
+
+#endif
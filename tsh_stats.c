@@ -0,0 +1,346 @@
+/* tsh_stats.c
+ * per-stage latency histograms for tshlab
+ */
+
+#include "tsh_stats.h"
+#include "tsh_metrics.h"
+
+#define HDR_SUBBITS     4
+#define HDR_SUB         (1 << HDR_SUBBITS)
+#define HDR_MAXBITS     44                  // values up to ~4.9 hours in ns
+#define HDR_NBUCKETS    ((HDR_MAXBITS - HDR_SUBBITS + 1) * HDR_SUB)
+#define CMD_ALL         0                   // histograms of all commands
+#define VAL_SIZE        24                  // a formatted duration
+
+// A log-bucketed histogram of ns values
+struct hdr
+{
+    unsigned int count[HDR_NBUCKETS];
+    unsigned long total;
+    long max;
+};
+
+struct stats_cmd
+{
+    char *name;                 // the whole name, however long
+    struct hdr stage[NSTAGES];
+};
+
+// Written by the child just before execve
+struct ready_slot
+{
+    pid_t pid;
+    long when;                  // ns on CLOCK_MONOTONIC
+};
+
+static const char *stage_names[NSTAGES] = {
+    "parse", "fork", "exec", "sigchld", "wait"
+};
+
+static struct stats_cmd *cmds[STATS_MAXCMDS + 1];  // [0] is all commands
+static int ncmds;
+static struct ready_slot *ready;    // shared with the children
+static unsigned int next_slot;
+
+// The spawn in progress, from stats_spawn_begin to stats_job_added
+static struct
+{
+    int cmd;
+    int slot;
+    long spawned;
+} pending;
+
+
+/*
+ * hdr_index - Bucket of a value
+ */
+static int hdr_index(long v)
+{
+    int shift;
+
+    if (v < HDR_SUB)
+    {
+        return v < 0 ? 0 : v;
+    }
+    if (v >= 1L << HDR_MAXBITS)
+    {
+        v = (1L << HDR_MAXBITS) - 1;
+    }
+    shift = 63 - __builtin_clzl(v) - HDR_SUBBITS;
+    return (shift + 1) * HDR_SUB + (v >> shift) - HDR_SUB;
+}
+
+/*
+ * hdr_value - Highest value that falls in bucket i
+ */
+static long hdr_value(int i)
+{
+    int block = i / HDR_SUB;
+
+    if (block == 0)
+    {
+        return i;
+    }
+    return ((long)(HDR_SUB + i % HDR_SUB + 1) << (block - 1)) - 1;
+}
+
+/*
+ * hdr_percentile - Value at or below which pct percent of samples fall
+ */
+static long hdr_percentile(const struct hdr *h, double pct)
+{
+    unsigned long rank = (unsigned long)(pct / 100 * h->total + 0.5), seen = 0;
+    int i;
+
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    for (i = 0; i < HDR_NBUCKETS; i++)
+    {
+        if ((seen += h->count[i]) >= rank)
+        {
+            return hdr_value(i) < h->max ? hdr_value(i) : h->max;
+        }
+    }
+    return h->max;
+}
+
+/*
+ * cmd_new - Histograms for a command name
+ */
+static struct stats_cmd *cmd_new(const char *name)
+{
+    struct stats_cmd *c = Calloc(1, sizeof(struct stats_cmd));
+
+    c->name = Malloc(strlen(name) + 1);
+    strcpy(c->name, name);
+    return c;
+}
+
+/*
+ * stats_init - Map the exec readiness page
+ */
+void stats_init(void)
+{
+    ready = mmap(NULL, STATS_SLOTS * sizeof(*ready), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ready == MAP_FAILED)
+    {
+        unix_error("mmap error");
+    }
+    cmds[CMD_ALL] = cmd_new("all");
+    ncmds = 1;
+}
+
+/*
+ * stats_command - Index of a command's histograms
+ */
+int stats_command(const char *argv0)
+{
+    const char *name = strrchr(argv0, '/');
+    int i;
+
+    name = name != NULL && name[1] != '\0' ? name + 1 : argv0;
+    for (i = 1; i < ncmds; i++)
+    {
+        if (strcmp(cmds[i]->name, name) == 0)
+        {
+            return i;
+        }
+    }
+    if (ncmds <= STATS_MAXCMDS)
+    {
+        cmds[ncmds] = cmd_new(name);
+        return ncmds++;
+    }
+
+    // Out of room: the last command becomes "other", keeping its samples
+    i = STATS_MAXCMDS;
+    if (strcmp(cmds[i]->name, "other") != 0)
+    {
+        Free(cmds[i]->name);
+        cmds[i]->name = Malloc(sizeof("other"));
+        strcpy(cmds[i]->name, "other");
+    }
+    return i;
+}
+
+/*
+ * stats_record - Add a sample
+ */
+void stats_record(stats_stage stage, int cmd, long ns)
+{
+    struct hdr *h;
+    int k, c[2] = {CMD_ALL, cmd};
+
+    if (ready == NULL)
+    {
+        return;
+    }
+    for (k = cmd == CMD_ALL ? 1 : 0; k < 2; k++)
+    {
+        h = &cmds[c[k]]->stage[stage];
+        h->count[hdr_index(ns)]++;
+        h->total++;
+        if (ns > h->max)
+        {
+            h->max = ns;
+        }
+    }
+}
+
+/*
+ * stats_spawn_begin - Note the start of a spawn
+ */
+void stats_spawn_begin(int cmd)
+{
+    pending.cmd = cmd;
+    pending.slot = -1;
+    if (ready != NULL)
+    {
+        pending.slot = next_slot++ % STATS_SLOTS;
+        ready[pending.slot].pid = 0;
+    }
+    pending.spawned = metrics_now();
+}
+
+/*
+ * stats_spawn_end - Time the fork in the parent
+ */
+void stats_spawn_end(void)
+{
+    stats_record(STAGE_FORK, pending.cmd, metrics_now() - pending.spawned);
+}
+
+/*
+ * stats_exec_ready - In the child, report that it is about to exec
+ */
+void stats_exec_ready(void)
+{
+    if (pending.slot >= 0)
+    {
+        ready[pending.slot].when = metrics_now();
+        ready[pending.slot].pid = getpid();
+    }
+}
+
+/*
+ * stats_job_added - Give a new job the timestamps of its spawn
+ */
+void stats_job_added(struct job_t *job)
+{
+    job->spawned = pending.spawned;
+    job->stats_cmd = pending.cmd;
+    job->ready_slot = pending.slot;
+}
+
+/*
+ * stats_job_changed - Time the first state change of a job
+ */
+void stats_job_changed(struct job_t *job)
+{
+    struct ready_slot *r;
+
+    if (job == NULL || job->spawned == 0)
+    {
+        return;
+    }
+    stats_record(STAGE_SIGCHLD, job->stats_cmd, metrics_now() - job->spawned);
+    if (job->ready_slot >= 0)
+    {
+        r = &ready[job->ready_slot];
+        if (r->pid == job->pid)
+        {
+            stats_record(STAGE_EXEC, job->stats_cmd, r->when - job->spawned);
+        }
+    }
+    job->spawned = 0;
+}
+
+/*
+ * format_ns - Format a duration with a unit
+ */
+static void format_ns(char *buf, size_t size, long ns)
+{
+    if (ns < 1000)
+    {
+        snprintf(buf, size, "%ldns", ns);
+    }
+    else if (ns < 1000000)
+    {
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    }
+    else if (ns < 1000000000)
+    {
+        snprintf(buf, size, "%.2fms", ns / 1e6);
+    }
+    else
+    {
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+    }
+}
+
+/*
+ * stats_print - Write the percentiles of one command's stages
+ */
+static void stats_print(int fd, const struct stats_cmd *c)
+{
+    static const double pcts[] = {50, 90, 99};
+    char buf[2 * MAXLINE_TSH], val[4][VAL_SIZE];
+    const struct hdr *h;
+    int s, i;
+
+    for (s = 0; s < NSTAGES; s++)
+    {
+        h = &c->stage[s];
+        if (h->total == 0)
+        {
+            continue;
+        }
+        for (i = 0; i < 3; i++)
+        {
+            format_ns(val[i], sizeof(val[i]), hdr_percentile(h, pcts[i]));
+        }
+        format_ns(val[3], sizeof(val[3]), h->max);
+        snprintf(buf, sizeof(buf), "%-8s %-16s %8lu %9s %9s %9s %9s\n",
+                 stage_names[s], c->name, h->total,
+                 val[0], val[1], val[2], val[3]);
+        rio_writen(fd, buf, strlen(buf));
+    }
+}
+
+/*
+ * stats_builtin - Run the stats builtin
+ */
+void stats_builtin(int argc, char **argv, int output_fd)
+{
+    char buf[MAXLINE_TSH];
+    int i;
+
+    if (ready == NULL)
+    {
+        return;
+    }
+    if (argc == 2 && strcmp(argv[1], "-r") == 0)
+    {
+        for (i = 0; i < ncmds; i++)
+        {
+            memset(cmds[i]->stage, 0, sizeof(cmds[i]->stage));
+        }
+        return;
+    }
+    if (argc != 1)
+    {
+        snprintf(buf, sizeof(buf), "usage: stats [-r]\n");
+        rio_writen(output_fd, buf, strlen(buf));
+        return;
+    }
+    snprintf(buf, sizeof(buf), "%-8s %-16s %8s %9s %9s %9s %9s\n",
+             "stage", "command", "count", "p50", "p90", "p99", "max");
+    rio_writen(output_fd, buf, strlen(buf));
+    for (i = 0; i < ncmds; i++)
+    {
+        stats_print(output_fd, cmds[i]);
+    }
+}
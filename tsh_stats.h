@@ -0,0 +1,86 @@
+/*
+ * tsh_stats.h: per-stage latency histograms for tshlab
+ *
+ * eval() and sigchld_handler time each command through these stages:
+ *   parse      parseline, including pathname expansion
+ *   fork       the fork (or zygote request) as seen by the shell
+ *   exec       from the fork to the child calling execve
+ *   sigchld    from the fork to the first SIGCHLD for the job
+ *   wait       time the shell waits for a foreground job
+ *
+ * Each stage has a histogram for every command name (the last component
+ * of argv[0]) and one for all commands. The histograms are log-bucketed
+ * in the manner of HdrHistogram: 16 linear sub-buckets per power of two,
+ * so a percentile is exact to within 1/16 of its value, and recording
+ * costs a clock_gettime and a few instructions. The child reports its
+ * exec readiness by writing its pid and a timestamp to a slot of a
+ * shared page; jobs spawned by the zygote do not, and so have no exec
+ * sample.
+ *
+ * All updates happen with signals blocked (in eval or in the handler),
+ * so the histograms need no locking.
+ */
+
+#ifndef __TSH_STATS_H__
+#define __TSH_STATS_H__
+
+#include <stdbool.h>
+#include "tsh_helper.h"
+
+typedef enum stats_stage
+{
+    STAGE_PARSE,
+    STAGE_FORK,
+    STAGE_EXEC,
+    STAGE_SIGCHLD,
+    STAGE_WAIT,
+    NSTAGES
+} stats_stage;
+
+#define STATS_MAXCMDS   64      // command names tracked; the rest are "other"
+#define STATS_SLOTS     256     // exec readiness slots in the shared page
+
+/*
+ * stats_init maps the exec readiness page. It must be called before any
+ * child is forked.
+ */
+void stats_init(void);
+
+/*
+ * stats_command returns the index of the histograms for the command
+ * argv0, creating them on first use.
+ */
+int stats_command(const char *argv0);
+
+/*
+ * stats_record adds a sample of ns nanoseconds for stage of command cmd.
+ */
+void stats_record(stats_stage stage, int cmd, long ns);
+
+/*
+ * stats_spawn_begin is called just before command cmd is forked, and
+ * stats_spawn_end in the parent once it has the child's pid. The child
+ * calls stats_exec_ready just before execve. stats_job_added then copies
+ * the spawn's timestamps into job, the job just added for it.
+ */
+void stats_spawn_begin(int cmd);
+void stats_spawn_end(void);
+void stats_exec_ready(void);
+void stats_job_added(struct job_t *job);
+
+/*
+ * stats_job_changed is called by sigchld_handler for every state change
+ * of job (which may be NULL); the first one records the exec and
+ * sigchld stages.
+ */
+void stats_job_changed(struct job_t *job);
+
+/*
+ * stats_builtin runs the stats builtin, writing to output_fd:
+ *   stats          p50, p90, p99 and max of every stage, for all
+ *                  commands and then for each command name
+ *   stats -r       clear the histograms
+ */
+void stats_builtin(int argc, char **argv, int output_fd);
+
+#endif
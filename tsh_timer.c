@@ -0,0 +1,301 @@
+/* tsh_timer.c
+ * job deadlines for tshlab
+ */
+
+#include "tsh_timer.h"
+#include "tsh_metrics.h"
+#include "tsh_trace.h"
+#include <math.h>
+#include <poll.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+#define KERNEL_SIGSET_SIZE  (_NSIG / 8)
+
+// A pending deadline. It is stale if the job has gone, or its deadline
+// has changed since the entry was pushed
+struct timer_entry
+{
+    long when;                  // ms on CLOCK_MONOTONIC
+    pid_t pid;                  // 0 for the periodic callback
+    bool kill;                  // the SIGTERM was sent: send SIGKILL
+};
+
+static int timer_fd = -1;
+static struct timer_entry *heap;
+static int nheap, heapcap;
+static long period;             // ms between calls of periodic, or 0
+static long period_next;        // when periodic is due
+static void (*periodic)(void);
+
+
+/*
+ * timer_now - Current time in ms on CLOCK_MONOTONIC
+ */
+static long timer_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/*
+ * sys_ppoll - Poll with the signal mask set to mask. glibc only declares
+ *    ppoll under _GNU_SOURCE, which csapp.h does not build with.
+ */
+static int sys_ppoll(struct pollfd *fds, nfds_t n, const sigset_t *mask)
+{
+    return syscall(SYS_ppoll, fds, n, NULL, mask, KERNEL_SIGSET_SIZE);
+}
+
+/*
+ * timer_arm - Arm the timerfd for the earliest deadline
+ */
+static void timer_arm(void)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (nheap > 0)
+    {
+        its.it_value.tv_sec = heap[0].when / 1000;
+        its.it_value.tv_nsec = heap[0].when % 1000 * 1000000;
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+ * timer_push - Add an entry to the heap
+ */
+static void timer_push(long when, pid_t pid, bool kill)
+{
+    struct timer_entry e = {when, pid, kill};
+    int i, parent;
+
+    if (nheap == heapcap)
+    {
+        heapcap = heapcap ? 2 * heapcap : MAXJOBS;
+        heap = Realloc(heap, heapcap * sizeof(*heap));
+    }
+    for (i = nheap++; i > 0; i = parent)
+    {
+        parent = (i - 1) / 2;
+        if (heap[parent].when <= when)
+        {
+            break;
+        }
+        heap[i] = heap[parent];
+    }
+    heap[i] = e;
+    if (i == 0)
+    {
+        timer_arm();
+    }
+}
+
+/*
+ * timer_pop - Remove the earliest entry from the heap
+ */
+static struct timer_entry timer_pop(void)
+{
+    struct timer_entry top = heap[0], last = heap[--nheap];
+    int i, child;
+
+    for (i = 0; (child = 2 * i + 1) < nheap; i = child)
+    {
+        if (child + 1 < nheap && heap[child + 1].when < heap[child].when)
+        {
+            child++;
+        }
+        if (last.when <= heap[child].when)
+        {
+            break;
+        }
+        heap[i] = heap[child];
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*
+ * timer_expire - Act on every deadline that has passed
+ */
+static void timer_expire(void)
+{
+    struct timer_entry e;
+    struct job_t *job;
+    uint64_t ticks;
+    long now = timer_now();
+
+    if (read(timer_fd, &ticks, sizeof(ticks)) < 0)
+    {
+        // spurious wakeup, or the timer was rearmed: check anyway
+    }
+    while (nheap > 0 && heap[0].when <= now)
+    {
+        e = timer_pop();
+        if (e.pid == 0)
+        {
+            if (period > 0 && e.when == period_next)
+            {
+                // skip the calls we were too busy to make
+                while (period_next <= now)
+                {
+                    period_next += period;
+                }
+                timer_push(period_next, 0, false);
+                periodic();
+            }
+            continue;
+        }
+        job = getjobpid(job_list, e.pid);
+        if (job == NULL || job->deadline != e.when)
+        {
+            continue;                   // stale
+        }
+        if (!e.kill)
+        {
+            if (verbose)
+            {
+                printf("Job [%d] (%d) reached its deadline\n",
+                       job->jid, job->pid);
+            }
+            kill(-job->pid, SIGTERM);
+            kill(-job->pid, SIGCONT);
+            metrics_signal(SIGTERM);
+            trace_event(TRACE_KILL, job->pid, job->jid, 0, 0, SIGTERM);
+            job->deadline = e.when + TIMER_KILL_GRACE;
+            timer_push(job->deadline, job->pid, true);
+        }
+        else
+        {
+            kill(-job->pid, SIGKILL);
+            metrics_signal(SIGKILL);
+            trace_event(TRACE_KILL, job->pid, job->jid, 0, 0, SIGKILL);
+            job->deadline = 0;
+        }
+    }
+    timer_arm();
+}
+
+/*
+ * timer_init - Create the timerfd
+ */
+void timer_init(void)
+{
+    if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0)
+    {
+        unix_error("timerfd_create error");
+    }
+}
+
+/*
+ * parse_duration - Convert a duration to milliseconds
+ */
+bool parse_duration(const char *str, long *ms)
+{
+    char *unit;
+    double val = strtod(str, &unit);
+
+    if (unit == str || !isfinite(val) || val < 0)
+    {
+        return false;
+    }
+    if (*unit == '\0' || strcmp(unit, "s") == 0)
+    {
+        val *= 1000;
+    }
+    else if (strcmp(unit, "m") == 0)
+    {
+        val *= 60 * 1000;
+    }
+    else if (strcmp(unit, "h") == 0)
+    {
+        val *= 60 * 60 * 1000;
+    }
+    else if (strcmp(unit, "ms") != 0)
+    {
+        return false;
+    }
+    if (val > TIMER_MAXMS)
+    {
+        return false;                   // timer_now() + ms would overflow
+    }
+    *ms = (long)val;
+    return true;
+}
+
+/*
+ * timer_set - Give a job a new deadline
+ */
+void timer_set(struct job_t *job, long ms)
+{
+    if (ms <= 0)
+    {
+        job->deadline = 0;
+        return;
+    }
+    job->deadline = timer_now() + ms;
+    timer_push(job->deadline, job->pid, false);
+}
+
+/*
+ * timer_every - Call fn every ms milliseconds
+ */
+void timer_every(long ms, void (*fn)(void))
+{
+    periodic = fn;
+    period = ms;
+    if (ms > 0)
+    {
+        period_next = timer_now() + ms;
+        timer_push(period_next, 0, false);
+    }
+}
+
+/*
+ * timer_suspend - sigsuspend that also wakes up for deadlines
+ */
+void timer_suspend(const sigset_t *mask)
+{
+    struct pollfd p = {timer_fd, POLLIN, 0};
+
+    if (sys_ppoll(&p, 1, mask) > 0)
+    {
+        timer_expire();
+    }
+}
+
+/*
+ * timer_wait_input - Wait for input, acting on deadlines meanwhile
+ */
+void timer_wait_input(int fd, const sigset_t *mask)
+{
+    struct pollfd p[2] = {{fd, POLLIN, 0}, {timer_fd, POLLIN, 0}};
+    sigset_t prev;
+
+    while (nheap > 0)
+    {
+        if (poll(p, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            unix_error("poll error");
+        }
+        if (p[1].revents & POLLIN)
+        {
+            Sigprocmask(SIG_BLOCK, mask, &prev);
+            timer_expire();
+            Sigprocmask(SIG_SETMASK, &prev, NULL);
+        }
+        if (p[0].revents)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ * tsh_timer.h: job deadlines for tshlab
+ *
+ * A job may have a deadline, set when it starts ("timeout 30s cmd") or
+ * while it runs ("deadline %3 30s"). Deadlines are kept in a min-heap,
+ * and a single timerfd is armed for the earliest one. The places where
+ * the shell sleeps (waiting for a foreground job, the wait builtin, and
+ * reading the next command) wait on that timerfd as well, with ppoll.
+ *
+ * When a job reaches its deadline, its process group gets SIGTERM (and
+ * SIGCONT, in case it is stopped), then SIGKILL if it is still there
+ * TIMER_KILL_GRACE ms later. sigchld_handler then reports it like any
+ * job terminated by a signal.
+ *
+ * The same heap also drives one periodic callback (timer_every), used to
+ * export metrics.
+ */
+
+#ifndef __TSH_TIMER_H__
+#define __TSH_TIMER_H__
+
+#include <stdbool.h>
+#include <signal.h>
+#include "tsh_helper.h"
+
+#define TIMER_KILL_GRACE    2000    // ms from SIGTERM to SIGKILL
+#define TIMER_MAXMS         (100L * 365 * 24 * 3600 * 1000) // 100 years
+
+/*
+ * timer_init creates the timerfd.
+ */
+void timer_init(void);
+
+/*
+ * parse_duration converts a duration like "1.5", "30s", "250ms", "2m"
+ * or "1h" (seconds if there is no unit) to milliseconds in *ms. It
+ * returns false if str is not a finite duration of at most TIMER_MAXMS
+ * (100 years).
+ */
+bool parse_duration(const char *str, long *ms);
+
+/*
+ * timer_set gives job a deadline ms milliseconds from now, replacing
+ * any earlier one; ms == 0 removes the deadline. Signals must be
+ * blocked, as for the other job list functions.
+ */
+void timer_set(struct job_t *job, long ms);
+
+/*
+ * timer_every calls fn every ms milliseconds from then on, with signals
+ * blocked, whenever the shell is waiting as described above. A second
+ * call replaces the first.
+ */
+void timer_every(long ms, void (*fn)(void));
+
+/*
+ * timer_suspend is sigsuspend(mask) that also returns, after acting on
+ * them, when deadlines expire. It is called with SIGCHLD blocked.
+ */
+void timer_suspend(const sigset_t *mask);
+
+/*
+ * timer_wait_input sleeps until fd is readable, acting on deadlines
+ * that expire meanwhile. It returns at once if there are none. It is
+ * called with signals unblocked; mask holds those to block while the
+ * job list is used.
+ */
+void timer_wait_input(int fd, const sigset_t *mask);
+
+#endif
@@ -0,0 +1,92 @@
+/* tsh_trace.c
+ * binary event trace for tshlab
+ */
+
+#include "tsh_trace.h"
+#include "csapp.h"
+#include <stdatomic.h>
+#include <time.h>
+
+static const char *kind_names[TRACE_NKINDS] = {
+    "eval", "spawn", "addjob", "deletejob", "state", "sigchld", "reap",
+    "sigint", "sigtstp", "kill"
+};
+
+static struct trace_header *trace_hdr;
+static struct trace_record *trace_ring;
+
+
+/*
+ * trace_clock - Time in ns on a clock
+ */
+static int64_t trace_clock(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * trace_init - Map the ring
+ */
+void trace_init(const char *path, uint32_t nrecords)
+{
+    size_t size = TRACE_HDRSIZE + (size_t)nrecords * sizeof(*trace_ring);
+    void *p;
+    int fd;
+
+    fd = Open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (ftruncate(fd, size) < 0)
+    {
+        unix_error("ftruncate error");
+    }
+    p = Mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Close(fd);
+
+    trace_hdr = p;
+    trace_ring = (struct trace_record *)((char *)p + TRACE_HDRSIZE);
+    trace_hdr->nrecords = nrecords;
+    trace_hdr->shell_pid = getpid();
+    trace_hdr->start_mono = trace_clock(CLOCK_MONOTONIC);
+    trace_hdr->start_real = trace_clock(CLOCK_REALTIME);
+    trace_hdr->head = 0;
+    memcpy(trace_hdr->magic, TRACE_MAGIC, sizeof(trace_hdr->magic));
+}
+
+/*
+ * trace_event - Record an event
+ */
+void trace_event(trace_kind kind, pid_t pid, int jid, int old_state,
+                 int new_state, int arg)
+{
+    struct trace_record *r;
+    uint64_t i;
+
+    if (trace_hdr == NULL)
+    {
+        return;
+    }
+    i = atomic_fetch_add_explicit((_Atomic uint64_t *)&trace_hdr->head, 1,
+                                  memory_order_relaxed);
+    r = &trace_ring[i % trace_hdr->nrecords];
+    r->seq = 0;
+    atomic_signal_fence(memory_order_seq_cst);
+    r->time = trace_clock(CLOCK_MONOTONIC);
+    r->kind = kind;
+    r->old_state = old_state;
+    r->new_state = new_state;
+    r->pid = pid;
+    r->jid = jid;
+    r->arg = arg;
+    atomic_signal_fence(memory_order_seq_cst);
+    r->seq = i + 1;
+}
+
+/*
+ * trace_kind_name - Name of an event kind
+ */
+const char *trace_kind_name(int kind)
+{
+    return kind >= 0 && kind < TRACE_NKINDS ? kind_names[kind] : "?";
+}
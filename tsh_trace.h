@@ -0,0 +1,86 @@
+/*
+ * tsh_trace.h: binary event trace for tshlab
+ *
+ * If $TSH_TRACE_FILE is set, the shell records job control events in a
+ * ring of fixed-size records in that file, mapped with MAP_SHARED. Each
+ * record has a nanosecond timestamp, the kind of event, the pid and jid
+ * it concerns, the job's old and new state, and an argument (a signal
+ * number or wait status). Records are written with a few plain stores
+ * and one atomic add, so signal handlers can trace too. Since the data
+ * is in the page cache as soon as it is stored, the ring survives the
+ * shell crashing; tshtrace decodes it as text or Chrome trace JSON.
+ *
+ * Every record carries its sequence number, written last, so a decoder
+ * can tell records that were being written when the shell died, and
+ * which records the ring has overwritten.
+ */
+
+#ifndef __TSH_TRACE_H__
+#define __TSH_TRACE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define TRACE_MAGIC     "TSHTRC01"
+#define TRACE_NRECORDS  65536       // default for $TSH_TRACE_RECORDS
+#define TRACE_MAXRECORDS (1 << 22)  // largest $TSH_TRACE_RECORDS (128 MB)
+#define TRACE_HDRSIZE   64          // offset of the first record
+
+typedef enum trace_kind
+{
+    TRACE_EVAL,                 // eval() started a command; arg = builtin
+    TRACE_SPAWN,                // a job was forked; arg = 1 if by the zygote
+    TRACE_ADDJOB,               // addjob; new = state
+    TRACE_DELETEJOB,            // deletejob; old = state
+    TRACE_STATE,                // a job changed state from old to new
+    TRACE_SIGCHLD,              // sigchld_handler started
+    TRACE_REAP,                 // a child changed state; arg = wait status
+    TRACE_SIGINT,               // sigint_handler started; pid = fg job
+    TRACE_SIGTSTP,              // sigtstp_handler started; pid = fg job
+    TRACE_KILL,                 // the shell signalled a job; arg = signal
+    TRACE_NKINDS
+} trace_kind;
+
+// Header at the start of the file
+struct trace_header
+{
+    char magic[8];              // TRACE_MAGIC
+    uint32_t nrecords;          // size of the ring
+    int32_t shell_pid;
+    int64_t start_mono;         // CLOCK_MONOTONIC ns when tracing began
+    int64_t start_real;         // CLOCK_REALTIME ns at the same moment
+    uint64_t head;              // records written so far
+};
+
+// One event. seq is the record's index + 1, or 0 while it is written.
+struct trace_record
+{
+    uint64_t seq;
+    int64_t time;               // CLOCK_MONOTONIC ns
+    uint16_t kind;
+    uint8_t old_state;
+    uint8_t new_state;
+    int32_t pid;
+    int32_t jid;
+    int32_t arg;
+};
+
+/*
+ * trace_init maps the ring in path with room for nrecords events,
+ * replacing any earlier trace in the file.
+ */
+void trace_init(const char *path, uint32_t nrecords);
+
+/*
+ * trace_event records an event. It does nothing unless trace_init was
+ * called, and is async-signal-safe.
+ */
+void trace_event(trace_kind kind, pid_t pid, int jid, int old_state,
+                 int new_state, int arg);
+
+/*
+ * trace_kind_name returns the name of an event kind, for decoders.
+ */
+const char *trace_kind_name(int kind);
+
+#endif
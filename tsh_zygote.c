@@ -0,0 +1,286 @@
+/* tsh_zygote.c
+ * fork server for tshlab
+ */
+
+#include "tsh_zygote.h"
+#include "csapp.h"
+#include <stdint.h>
+#include <linux/sched.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define ZYGOTE_NFDS     3       // stdin, stdout and stderr of the shell
+
+extern char **environ;
+
+// Header of a spawn request. It is followed by nredir zygote_redir
+// records, then argc NUL-terminated arguments, then the nredir file
+// names of the redirections ("" for those that open no file)
+struct zygote_req
+{
+    uint32_t argc;
+    uint32_t nredir;
+    uint32_t len;               // bytes following the header
+};
+
+// A redirection, without its file name
+struct zygote_redir
+{
+    int32_t type;
+    int32_t fd;
+    int32_t flags;
+    int32_t src;
+};
+
+static int zygote_fd = -1;      // shell's end of the socketpair
+
+
+/*
+ * zygote_child - In the new job, install the shell's stdio and the
+ *    redirections and exec argv[0]. Runs in a clone of the zygote, so
+ *    it only makes system calls.
+ */
+static void zygote_child(int *fds, char **argv, const struct redir_t *redir,
+                         int nredir)
+{
+    int i;
+
+    Setpgid(0, 0);
+    for (i = 0; i < ZYGOTE_NFDS; i++)
+    {
+        if (fds[i] != i)
+        {
+            Dup2(fds[i], i);
+        }
+    }
+    redir_apply(redir, nredir);
+    Execve(argv[0], argv, environ);
+}
+
+/*
+ * zygote_serve - Main loop of the zygote: spawn a job for every request
+ *    and reply with its pid, until the shell closes the socket.
+ */
+static void zygote_serve(int sock)
+{
+    static char buf[ZYGOTE_MAXMSG];
+    static char *argv[ZYGOTE_MAXMSG / 2 + 1];
+    static struct redir_t redir[MAXREDIR];
+    struct zygote_redir zr;
+    char cbuf[CMSG_SPACE(ZYGOTE_NFDS * sizeof(int))];
+    struct zygote_req req;
+    struct iovec iov[2];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    int fds[ZYGOTE_NFDS];
+    char *p;
+    uint32_t i;
+    ssize_t n;
+    pid_t pid;
+
+    for (;;)
+    {
+        iov[0].iov_base = &req;
+        iov[0].iov_len = sizeof(req);
+        iov[1].iov_base = buf;
+        iov[1].iov_len = sizeof(buf) - 1;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+
+        if ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            _exit(0);                       // the shell has exited
+        }
+
+        cm = CMSG_FIRSTHDR(&msg);
+        if (cm == NULL || cm->cmsg_type != SCM_RIGHTS ||
+            cm->cmsg_len != CMSG_LEN(sizeof(fds)))
+        {
+            app_error("zygote: malformed request");
+        }
+        memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+
+        // Unpack the redirections and arguments
+        buf[req.len] = '\0';
+        if (req.nredir > MAXREDIR)
+        {
+            app_error("zygote: malformed request");
+        }
+        for (i = 0, p = buf; i < req.nredir; i++)
+        {
+            memcpy(&zr, p, sizeof(zr));
+            redir[i].type = zr.type;
+            redir[i].fd = zr.fd;
+            redir[i].flags = zr.flags;
+            redir[i].src = zr.src;
+            p += sizeof(zr);
+        }
+        for (i = 0; i < req.argc; i++)
+        {
+            argv[i] = p;
+            p += strlen(p) + 1;
+        }
+        argv[req.argc] = NULL;
+        for (i = 0; i < req.nredir; i++)
+        {
+            redir[i].path = p;
+            p += strlen(p) + 1;
+        }
+
+        // CLONE_PARENT makes the job a child of the shell
+        pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+        if (pid == 0)
+        {
+            close(sock);
+            zygote_child(fds, argv, redir, req.nredir);
+        }
+        for (i = 0; i < ZYGOTE_NFDS; i++)
+        {
+            close(fds[i]);
+        }
+        if (pid < 0)
+        {
+            pid = -1;
+        }
+        if (write(sock, &pid, sizeof(pid)) != sizeof(pid))
+        {
+            _exit(0);
+        }
+    }
+}
+
+/*
+ * zygote_start - Fork the zygote
+ */
+void zygote_start(void)
+{
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+        unix_error("socketpair error");
+    }
+    if ((pid = Fork()) == 0)
+    {
+        // Die with the shell, and keep out of its process group so
+        // signals for the foreground job never reach the zygote
+        close(sv[0]);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() == 1)
+        {
+            _exit(0);
+        }
+        setpgid(0, 0);
+        zygote_serve(sv[1]);
+    }
+    close(sv[1]);
+    zygote_fd = sv[0];
+}
+
+/*
+ * zygote_enabled - Is the zygote running?
+ */
+bool zygote_enabled(void)
+{
+    return zygote_fd >= 0;
+}
+
+/*
+ * zygote_spawn - Ask the zygote to start a job
+ */
+pid_t zygote_spawn(char **argv, const struct redir_t *redir, int nredir)
+{
+    static char buf[ZYGOTE_MAXMSG];
+    int fds[ZYGOTE_NFDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    struct zygote_req req;
+    struct iovec iov[2];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    size_t len = 0, n;
+    ssize_t rc;
+    pid_t pid;
+    struct zygote_redir zr;
+    const char *path;
+    int i;
+
+    if (zygote_fd < 0)
+    {
+        return -1;
+    }
+
+    // Pack the redirections, argv and the redirection file names
+    for (i = 0; i < nredir; i++)
+    {
+        zr.type = redir[i].type;
+        zr.fd = redir[i].fd;
+        zr.flags = redir[i].flags;
+        zr.src = redir[i].src;
+        memcpy(buf + len, &zr, sizeof(zr));
+        len += sizeof(zr);
+    }
+    for (i = 0; argv[i] != NULL; i++)
+    {
+        n = strlen(argv[i]) + 1;
+        if (len + n > sizeof(buf) - 1)
+        {
+            return -1;
+        }
+        memcpy(buf + len, argv[i], n);
+        len += n;
+    }
+    req.argc = i;
+    for (i = 0; i < nredir; i++)
+    {
+        path = redir[i].path ? redir[i].path : "";
+        n = strlen(path) + 1;
+        if (len + n > sizeof(buf) - 1)
+        {
+            return -1;
+        }
+        memcpy(buf + len, path, n);
+        len += n;
+    }
+    req.nredir = nredir;
+    req.len = len;
+
+    iov[0].iov_base = &req;
+    iov[0].iov_len = sizeof(req);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    while ((rc = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    if (rc < 0)
+    {
+        return -1;
+    }
+    while ((rc = read(zygote_fd, &pid, sizeof(pid))) < 0 && errno == EINTR)
+        ;
+    if (rc != sizeof(pid))
+    {
+        close(zygote_fd);                   // the zygote is gone
+        zygote_fd = -1;
+        return -1;
+    }
+    return pid;
+}
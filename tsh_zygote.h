@@ -0,0 +1,50 @@
+/*
+ * tsh_zygote.h: fork server for tshlab
+ *
+ * fork() copies the page tables of the calling process, so it slows down
+ * as the shell grows (history index, glob cache, job list). The zygote is
+ * a small helper forked when the shell starts, before it has built any of
+ * that state. eval() sends it the argv and redirections of a job over a
+ * socketpair, together with the shell's stdin, stdout and stderr (passed
+ * with SCM_RIGHTS), and the zygote forks and execs the job on the shell's
+ * behalf, applying the redirections as eval() does (see tsh_redir.h).
+ *
+ * The zygote creates jobs with clone(CLONE_PARENT), so they are children
+ * of the shell, not of the zygote: the shell reaps them, stops and
+ * continues them, and gets SIGCHLD for them exactly as for jobs it forks
+ * itself. The job puts itself in its own process group before exec, as
+ * in eval().
+ */
+
+#ifndef __TSH_ZYGOTE_H__
+#define __TSH_ZYGOTE_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "tsh_redir.h"
+
+#define ZYGOTE_MAXMSG   (128<<10)   // max bytes of one spawn request
+
+/*
+ * zygote_start forks the zygote. It should be called as early as
+ * possible, while the shell is still small and holds no open files
+ * besides stdin, stdout and stderr.
+ */
+void zygote_start(void);
+
+/*
+ * zygote_enabled returns true if the zygote is running.
+ */
+bool zygote_enabled(void);
+
+/*
+ * zygote_spawn runs argv[0] with arguments argv and the nredir
+ * redirections of redir. It returns the pid of the new child of the
+ * shell, or -1 if the request could not be sent, in which case the
+ * caller should fork the job itself.
+ * Callers should block SIGCHLD around zygote_spawn and recording the
+ * job, as they would around fork.
+ */
+pid_t zygote_spawn(char **argv, const struct redir_t *redir, int nredir);
+
+#endif
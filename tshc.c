@@ -0,0 +1,200 @@
+/*
+ * tshc.c - Client for the tsh command server (tsh -S)
+ *
+ * Opens one or more connections to a tsh command server, sends every
+ * command line given on the command line a number of times on each
+ * connection, and prints the replies as they arrive. With -q only the
+ * totals are printed, which makes it a load generator for the server.
+ *
+ * Usage: tshc [-hq] -S socket [-c conns] [-n reps] cmdline...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "tsh_server.h"
+
+/* Global variables */
+char *sockpath;             /* Server socket (-S) */
+int nconns = 1;             /* Concurrent connections (-c) */
+int reps = 1;               /* Times each command is sent per connection (-n) */
+int quiet = 0;              /* Print only the totals (-q) */
+
+/* One client connection and its partially read reply */
+struct client {
+    int fd;
+    int pending;            /* Replies still to come */
+    size_t inlen;
+    char in[4 + SERVER_MAXREPLY];
+};
+
+void usage(void);
+
+/*
+ * client_connect - Open a connection to the server
+ */
+int client_connect(void)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sockpath, sizeof(addr.sun_path) - 1);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        exit(1);
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(sockpath);
+        exit(1);
+    }
+    return fd;
+}
+
+/*
+ * send_request - Send one framed command line
+ */
+void send_request(int fd, const char *cmdline)
+{
+    char buf[4 + 1024];
+    uint32_t len = strlen(cmdline), hdr = htonl(len);
+    size_t off = 0, total = 4 + len;
+    ssize_t n;
+
+    if (len >= sizeof(buf) - 4) {
+        fprintf(stderr, "command line too long: %s\n", cmdline);
+        exit(1);
+    }
+    memcpy(buf, &hdr, 4);
+    memcpy(buf + 4, cmdline, len);
+    while (off < total) {
+        if ((n = write(fd, buf + off, total - off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            exit(1);
+        }
+        off += n;
+    }
+}
+
+/*
+ * read_replies - Read from c and print every complete reply
+ */
+void read_replies(struct client *c, int id)
+{
+    uint32_t len;
+    ssize_t n;
+
+    n = read(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen);
+    if (n <= 0) {
+        fprintf(stderr, "connection %d: server closed the connection "
+                "with %d replies pending\n", id, c->pending);
+        exit(1);
+    }
+    c->inlen += n;
+    while (c->inlen >= 4) {
+        memcpy(&len, c->in, 4);
+        len = ntohl(len);
+        if (c->inlen < 4 + len)
+            break;
+        if (!quiet)
+            printf("%d %.*s\n", id, (int)len, c->in + 4);
+        c->pending--;
+        c->inlen -= 4 + len;
+        memmove(c->in, c->in + 4 + len, c->inlen);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct client *clients;
+    struct pollfd *pfd;
+    struct timespec start, end;
+    int c, i, j, k, ncmds, left;
+    double secs;
+
+    while ((c = getopt(argc, argv, "hqS:c:n:")) != EOF) {
+        switch (c) {
+        case 'S': sockpath = optarg; break;
+        case 'c': nconns = atoi(optarg); break;
+        case 'n': reps = atoi(optarg); break;
+        case 'q': quiet = 1; break;
+        default: usage();
+        }
+    }
+    ncmds = argc - optind;
+    if (sockpath == NULL || ncmds < 1 || nconns < 1 || reps < 1)
+        usage();
+
+    clients = calloc(nconns, sizeof(struct client));
+    pfd = calloc(nconns, sizeof(struct pollfd));
+    if (!clients || !pfd) {
+        perror("calloc");
+        exit(1);
+    }
+
+    /* Open every connection and send all requests up front */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nconns; i++) {
+        clients[i].fd = client_connect();
+        clients[i].pending = ncmds * reps;
+        pfd[i].fd = clients[i].fd;
+        pfd[i].events = POLLIN;
+    }
+    for (k = 0; k < reps; k++)
+        for (i = 0; i < nconns; i++)
+            for (j = 0; j < ncmds; j++)
+                send_request(clients[i].fd, argv[optind + j]);
+
+    /* Collect the replies as they arrive */
+    for (left = nconns; left > 0; ) {
+        if (poll(pfd, nconns, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+        for (i = 0; i < nconns; i++) {
+            if (pfd[i].fd < 0 || !(pfd[i].revents & (POLLIN | POLLHUP)))
+                continue;
+            read_replies(&clients[i], i);
+            if (clients[i].pending == 0) {
+                close(clients[i].fd);
+                pfd[i].fd = -1;
+                left--;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%ld jobs on %d connections in %.3f s (%.1f jobs/s)\n",
+           (long)nconns * ncmds * reps, nconns, secs,
+           nconns * ncmds * reps / secs);
+    exit(0);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+void usage(void)
+{
+    printf("Usage: tshc [-hq] -S <socket> [-c conns] [-n reps] cmdline...\n");
+    printf("Options\n");
+    printf("\t-S <socket>  Socket of the tsh command server\n");
+    printf("\t-c <n>       Concurrent connections (default %d)\n", nconns);
+    printf("\t-n <n>       Times each command is sent per connection"
+           " (default %d)\n", reps);
+    printf("\t-q           Print only the totals\n");
+    exit(0);
+}
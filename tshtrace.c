@@ -0,0 +1,182 @@
+/*
+ * tshtrace.c - Decoder for the tsh event trace ($TSH_TRACE_FILE)
+ *
+ * Reads the ring written by a tsh, running or dead, and prints its
+ * events oldest first, one per line, with times relative to the start of
+ * tracing. With -j it writes Chrome trace JSON instead (for
+ * chrome://tracing or Perfetto): every event is an instant event on the
+ * thread of the pid it concerns, and every job is a slice from addjob to
+ * deletejob. Records that were being written when the shell stopped are
+ * reported and skipped.
+ *
+ * Usage: tshtrace [-hj] tracefile
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "tsh_trace.h"
+
+/* Global variables */
+int json = 0;               /* Write Chrome trace JSON (-j) */
+
+static const char *state_names[] = {"UNDEF", "FG", "BG", "ST"};
+
+void usage(void);
+
+/*
+ * state_name - Name of a job state
+ */
+const char *state_name(int state)
+{
+    return state >= 0 && state < 4 ? state_names[state] : "?";
+}
+
+/*
+ * describe - Format what an event's fields mean for its kind
+ */
+void describe(const struct trace_record *r, char *buf, size_t size)
+{
+    int s = r->arg;
+
+    switch (r->kind) {
+    case TRACE_EVAL:
+        snprintf(buf, size, "builtin=%d", r->arg);
+        break;
+    case TRACE_SPAWN:
+        snprintf(buf, size, "%s", r->arg ? "zygote" : "fork");
+        break;
+    case TRACE_ADDJOB:
+    case TRACE_DELETEJOB:
+    case TRACE_STATE:
+        snprintf(buf, size, "%s -> %s", state_name(r->old_state),
+                 state_name(r->new_state));
+        break;
+    case TRACE_REAP:
+        if (WIFEXITED(s))
+            snprintf(buf, size, "exited %d", WEXITSTATUS(s));
+        else if (WIFSIGNALED(s))
+            snprintf(buf, size, "killed by %s", strsignal(WTERMSIG(s)));
+        else if (WIFSTOPPED(s))
+            snprintf(buf, size, "stopped by %s", strsignal(WSTOPSIG(s)));
+        else
+            snprintf(buf, size, "status %#x", s);
+        break;
+    case TRACE_KILL:
+        snprintf(buf, size, "%s", strsignal(r->arg));
+        break;
+    default:
+        buf[0] = '\0';
+    }
+}
+
+/*
+ * print_text - Print one event as a line of text
+ */
+void print_text(const struct trace_header *h, const struct trace_record *r)
+{
+    char what[128];
+
+    describe(r, what, sizeof(what));
+    printf("%14.6f %-10s pid=%-7d jid=%-3d %s\n",
+           (r->time - h->start_mono) / 1e9, trace_kind_name(r->kind),
+           r->pid, r->jid, what);
+}
+
+/*
+ * print_json - Print one event as Chrome trace JSON objects
+ */
+void print_json(const struct trace_header *h, const struct trace_record *r,
+                int *first)
+{
+    double us = (r->time - h->start_mono) / 1e3;
+    int tid = r->pid > 0 ? r->pid : h->shell_pid;
+    char what[128];
+
+    describe(r, what, sizeof(what));
+    printf("%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+           "\"pid\":%d,\"tid\":%d,\"args\":{\"jid\":%d,\"detail\":\"%s\"}}",
+           *first ? "" : ",\n", trace_kind_name(r->kind), us, h->shell_pid,
+           tid, r->jid, what);
+    *first = 0;
+    if (r->kind == TRACE_ADDJOB || r->kind == TRACE_DELETEJOB)
+        printf(",\n{\"name\":\"job %d\",\"ph\":\"%s\",\"ts\":%.3f,"
+               "\"pid\":%d,\"tid\":%d}", r->jid,
+               r->kind == TRACE_ADDJOB ? "B" : "E", us, h->shell_pid, tid);
+}
+
+int main(int argc, char **argv)
+{
+    struct trace_header h;
+    struct trace_record *ring, *r;
+    uint64_t i, start;
+    size_t n;
+    FILE *fp;
+    int c, first = 1, torn = 0;
+
+    while ((c = getopt(argc, argv, "hj")) != EOF) {
+        switch (c) {
+        case 'j': json = 1; break;
+        default: usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    if ((fp = fopen(argv[optind], "r")) == NULL) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    if (fread(&h, sizeof(h), 1, fp) != 1 ||
+        memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0 ||
+        h.nrecords == 0) {
+        fprintf(stderr, "%s: not a tsh trace\n", argv[optind]);
+        exit(1);
+    }
+    if ((ring = malloc(h.nrecords * sizeof(*ring))) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    fseek(fp, TRACE_HDRSIZE, SEEK_SET);
+    n = fread(ring, sizeof(*ring), h.nrecords, fp);
+    fclose(fp);
+
+    /* The ring holds the last nrecords events */
+    start = h.head > h.nrecords ? h.head - h.nrecords : 0;
+    if (json)
+        printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    else
+        printf("# shell %d, %llu events, %llu overwritten\n", h.shell_pid,
+               (unsigned long long)h.head, (unsigned long long)start);
+    for (i = start; i < h.head; i++) {
+        r = &ring[i % h.nrecords];
+        if (i % h.nrecords >= n || r->seq != i + 1) {
+            torn++;
+            continue;
+        }
+        if (json)
+            print_json(&h, r, &first);
+        else
+            print_text(&h, r);
+    }
+    if (json)
+        printf("\n]}\n");
+    if (torn)
+        fprintf(stderr, "%d incomplete record(s) skipped\n", torn);
+    exit(0);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+void usage(void)
+{
+    printf("Usage: tshtrace [-hj] tracefile\n");
+    printf("Options\n");
+    printf("\t-h   Print this message\n");
+    printf("\t-j   Write Chrome trace JSON instead of text\n");
+    exit(0);
+}